@@ -0,0 +1,557 @@
+// src/batch.cc
+
+#include "batch.hh"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief Construct an empty batch
+ *
+ * @param threads Number of worker threads shared by every image
+ */
+HFractalBatch::HFractalBatch (int threads) {
+    worker_threads = threads;
+}
+
+/**
+ * @brief Destroy the batch, freeing the equations shared by its images
+ *
+ */
+HFractalBatch::~HFractalBatch () {
+    for (auto p : equations) if (p.second != NULL) delete p.second;
+}
+
+/**
+ * @brief Set the directory images from spec files and the database are written to, creating it if it does not exist
+ *
+ * @param path Path to the directory
+ * @return True for success, false if the directory could not be created
+ */
+bool HFractalBatch::setOutputDirectory (string path) {
+    if (path.length() > 0 && path.back() != '/' && path.back() != '\\') path += '/';
+    error_code ec;
+    if (path.length() > 0 && !filesystem::is_directory (path, ec)) {
+        filesystem::create_directories (path, ec);
+        if (ec) return false;
+    }
+    output_directory = path;
+    return true;
+}
+
+/**
+ * @brief Add an image to the batch
+ *
+ * @param spec Parameters of the image
+ */
+void HFractalBatch::addSpec (HFractalRenderSpec spec) {
+    HFractalBatchJob job;
+    job.spec = spec;
+    jobs.push_back (job);
+}
+
+/**
+ * @brief Add every image listed in a spec file. Each line holds the resolution, x offset, y offset, zoom, evaluation limit and equation, separated by whitespace, with the equation taking the rest of the line.
+ * Blank lines and lines starting with '#' are ignored. Images are written to the output directory, named by their line number
+ *
+ * @param path Path to the spec file
+ * @return Number of images added, or -1 if the file could not be read
+ */
+int HFractalBatch::readSpecFile (string path) {
+    ifstream file (path);
+    if (!file.is_open()) return -1;
+
+    int added = 0;
+    int line_number = 0;
+    string line;
+    while (getline (file, line)) {
+        line_number++;
+        if (line.length() > 0 && line.back() == '\r') line.pop_back();
+        size_t start = line.find_first_not_of (" \t");
+        if (start == string::npos || line[start] == '#') continue;
+
+        HFractalRenderSpec spec;
+        istringstream fields (line);
+        fields >> spec.resolution >> spec.offset_x >> spec.offset_y >> spec.zoom >> spec.eval_limit;
+        getline (fields >> ws, spec.equation);
+        if (fields.fail() || spec.resolution <= 0 || spec.zoom <= 0 || spec.eval_limit <= 0 || spec.equation.empty()) {
+            if (verbose) cout << "Skipping invalid spec on line " << line_number << endl;
+            continue;
+        }
+        spec.output_path = output_directory + "render_" + to_string (line_number);
+        addSpec (spec);
+        added++;
+    }
+    return added;
+}
+
+/**
+ * @brief Add every config profile saved in a database, as saved from the GUI. Images are written to the output directory, named by their profile ID
+ *
+ * @param path Base path of the database, e.g. FractalSavedStates.csv
+ * @param resolution Horizontal and vertical dimension to render every profile at
+ * @return Number of images added
+ */
+int HFractalBatch::readDatabase (string path, int resolution) {
+    HFractalDatabase database (path);
+    int added = 0;
+    for (auto description : database.getConfigDescriptions()) {
+        HFractalConfigProfile *config = database.getConfig (description.first);
+        if (config == NULL) continue;
+        HFractalRenderSpec spec;
+        spec.resolution = resolution;
+        spec.offset_x = config->x_offset;
+        spec.offset_y = config->y_offset;
+        spec.zoom = config->zoom;
+        spec.eval_limit = config->iterations;
+        spec.equation = config->equation;
+        spec.palette = config->palette;
+        spec.output_path = output_directory + "config_" + to_string (config->profile_id);
+        addSpec (spec);
+        added++;
+    }
+    return added;
+}
+
+/**
+ * @brief Add every frame of an animation through a list of keyframes. Between keyframes, the zoom is interpolated geometrically so the view zooms at a constant rate, and the offsets are interpolated linearly.
+ * Frames are written to the output directory, numbered from the first keyframe, and finished frames are kept so that later frames can copy the pixels which line up with them
+ *
+ * @param keyframes Views to pass through, in order of increasing frame index
+ * @param resolution Horizontal and vertical dimension of every frame
+ * @param eval_limit Evaluation limit for every frame
+ * @param equation String equation to render
+ * @return Number of frames added, or -1 if the keyframes are not in order
+ */
+int HFractalBatch::addAnimation (vector<HFractalKeyframe> keyframes, int resolution, int eval_limit, string equation) {
+    if (keyframes.empty()) return 0;
+    for (size_t i = 1; i < keyframes.size(); i++) if (keyframes[i].frame <= keyframes[i-1].frame) return -1;
+
+    int added = 0;
+    size_t segment = 0;
+    for (int frame = keyframes.front().frame; frame <= keyframes.back().frame; frame++) {
+        while (segment+1 < keyframes.size()-1 && frame > keyframes[segment+1].frame) segment++;
+        HFractalKeyframe from = keyframes[segment];
+        HFractalKeyframe to = keyframes[min (segment+1, keyframes.size()-1)];
+        long double t = (to.frame == from.frame) ? 0 : (long double)(frame-from.frame)/(to.frame-from.frame);
+
+        HFractalRenderSpec spec;
+        spec.resolution = resolution;
+        spec.offset_x = from.offset_x + ((to.offset_x-from.offset_x)*t);
+        spec.offset_y = from.offset_y + ((to.offset_y-from.offset_y)*t);
+        spec.zoom = from.zoom*powl (to.zoom/from.zoom, t);
+        spec.eval_limit = eval_limit;
+        spec.equation = equation;
+        string number = to_string (frame-keyframes.front().frame);
+        spec.output_path = output_directory + "frame_" + string (number.length() < 6 ? 6-number.length() : 0, '0') + number;
+        addSpec (spec);
+        added++;
+    }
+    reference_window = ANIMATION_REFERENCE_WINDOW;
+    return added;
+}
+
+/**
+ * @brief Add every frame of an animation through the keyframes listed in a file. Each line holds the frame index, x offset, y offset and zoom of a keyframe, separated by whitespace.
+ * Blank lines and lines starting with '#' are ignored
+ *
+ * @param path Path to the keyframe file
+ * @param resolution Horizontal and vertical dimension of every frame
+ * @param eval_limit Evaluation limit for every frame
+ * @param equation String equation to render
+ * @return Number of frames added, or -1 if the file could not be read or its keyframes are invalid
+ */
+int HFractalBatch::readKeyframeFile (string path, int resolution, int eval_limit, string equation) {
+    ifstream file (path);
+    if (!file.is_open()) return -1;
+
+    vector<HFractalKeyframe> keyframes;
+    string line;
+    while (getline (file, line)) {
+        size_t start = line.find_first_not_of (" \t\r");
+        if (start == string::npos || line[start] == '#') continue;
+
+        HFractalKeyframe keyframe;
+        istringstream fields (line);
+        fields >> keyframe.frame >> keyframe.offset_x >> keyframe.offset_y >> keyframe.zoom;
+        if (fields.fail() || keyframe.zoom <= 0) return -1;
+        keyframes.push_back (keyframe);
+    }
+    return addAnimation (keyframes, resolution, eval_limit, equation);
+}
+
+/**
+ * @brief Add every tile of a multi-resolution pyramid of a view, for web viewers to serve directly. Tiles are PYRAMID_TILE_SIZE pixels square, and each level has twice the resolution of the one above.
+ * Every tile is rendered as its own view at its level's pixel spacing, rather than downsampled from the level below, so pixels of a tile land exactly where they would in a single image of the whole level. Tiles are written as they complete, and tiles identical to one already written are hard linked to it
+ *
+ * @param view Offsets, zoom, evaluation limit, equation and palette of the whole view, whose resolution and output path are ignored
+ * @param levels Number of levels made of whole tiles, the deepest of which is PYRAMID_TILE_SIZE*2^(levels-1) pixels across
+ * @param layout How tiles are named and laid out in the output directory
+ * @return Number of tiles added, or -1 if the parameters are invalid or the directories could not be created
+ */
+int HFractalBatch::addPyramid (HFractalRenderSpec view, int levels, PYRAMID_LAYOUT layout) {
+    if (levels <= 0 || levels > 16 || view.zoom <= 0) return -1;
+    string extension = imageTypeExtension (image_type);
+    int first_level = 0;
+    string level_directory = output_directory;
+    if (layout == PL_DZI) {
+        // Deep Zoom levels are numbered from a single pixel, so the level with one whole tile is log2 of the tile size
+        while ((1 << first_level) < PYRAMID_TILE_SIZE) first_level++;
+        ofstream descriptor (output_directory + PYRAMID_DZI_NAME + ".dzi");
+        descriptor << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl;
+        descriptor << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"" << extension.substr (1) << "\" Overlap=\"0\" TileSize=\"" << PYRAMID_TILE_SIZE << "\">" << endl;
+        descriptor << "  <Size Width=\"" << (PYRAMID_TILE_SIZE << (levels-1)) << "\" Height=\"" << (PYRAMID_TILE_SIZE << (levels-1)) << "\"/>" << endl;
+        descriptor << "</Image>" << endl;
+        if (!descriptor.good()) return -1;
+        level_directory += string (PYRAMID_DZI_NAME) + "_files/";
+    }
+
+    int added = 0;
+    for (int level = 0; level < first_level+levels; level++) {
+        // Levels below the first whole tile level are a single tile smaller than the tile size
+        int level_size = (level < first_level) ? (1 << level) : (PYRAMID_TILE_SIZE << (level-first_level));
+        int tile_size = min (level_size, PYRAMID_TILE_SIZE);
+        int tiles = level_size/tile_size;
+        int level_name = (layout == PL_DZI) ? level : level-first_level;
+
+        error_code ec;
+        if (layout == PL_DZI) filesystem::create_directories (level_directory + to_string (level_name), ec);
+        for (int tile_x = 0; tile_x < tiles && !ec; tile_x++) {
+            if (layout == PL_XYZ) filesystem::create_directories (level_directory + to_string (level_name) + "/" + to_string (tile_x), ec);
+            for (int tile_y = 0; tile_y < tiles && !ec; tile_y++) {
+                HFractalRenderSpec spec = getPyramidTile (view, level_size, tile_size, tile_x, tile_y);
+                if (layout == PL_DZI) spec.output_path = level_directory + to_string (level_name) + "/" + to_string (tile_x) + "_" + to_string (tile_y);
+                else spec.output_path = level_directory + to_string (level_name) + "/" + to_string (tile_x) + "/" + to_string (tile_y);
+                addSpec (spec);
+                added++;
+            }
+        }
+        if (ec) return -1;
+    }
+    deduplicate = true;
+    return added;
+}
+
+/**
+ * @brief Get the view of one tile of a pyramid level, as its own image whose pixels land exactly where they would in a single image of the whole level
+ *
+ * @param view Offsets, zoom, evaluation limit, equation and palette of the whole view
+ * @param level_size Horizontal and vertical dimension of the whole level
+ * @param tile_size Horizontal and vertical dimension of the tile
+ * @param tile_x Column of the tile
+ * @param tile_y Row of the tile
+ * @return Parameters of the tile, with no output path
+ */
+HFractalRenderSpec HFractalBatch::getPyramidTile (HFractalRenderSpec view, int level_size, int tile_size, int tile_x, int tile_y) {
+    // Pixel (x, y) of the whole level lies at (p*x - q, r - p*y), as for an image of the view at the level's resolution
+    long double p = 2/(view.zoom*level_size);
+    long double q = (1/view.zoom)-view.offset_x;
+    long double r = (1/view.zoom)+view.offset_y;
+    // Keeping the level's pixel spacing, shift the view so that the tile's top left pixel is pixel (tile_x, tile_y)*tile_size of the level
+    HFractalRenderSpec spec = view;
+    spec.resolution = tile_size;
+    spec.zoom = view.zoom*level_size/tile_size;
+    spec.offset_x = (1/spec.zoom) - q + (p*tile_x*tile_size);
+    spec.offset_y = r - (p*tile_y*tile_size) - (1/spec.zoom);
+    spec.output_path = "";
+    return spec;
+}
+
+/**
+ * @brief Create the rendering environment for an image, using its shared equation, and prepare the image for rendering. Assumes the mutex is locked, and releases it while the image is allocated, with the job marked as starting so that other threads wait for it
+ *
+ * @param job The image to start
+ * @param lock Lock held on the mutex
+ */
+void HFractalBatch::startJob (HFractalBatchJob &job, unique_lock<mutex> &lock) {
+    HFractalMain *environment = new HFractalMain;
+    environment->setVerbose (false);
+    environment->setResolution (job.spec.resolution);
+    environment->setOffsetX (job.spec.offset_x);
+    environment->setOffsetY (job.spec.offset_y);
+    environment->setZoom (job.spec.zoom);
+    environment->setEvalLimit (job.spec.eval_limit);
+    environment->setWorkerThreads (1);
+    environment->setSharedEquation (job.spec.equation, equations[job.spec.equation]);
+    job.environment = environment;
+    if (reference_window > 0) chooseReference (job);
+    job.starting = true;
+    lock.unlock();
+    int result = environment->beginRender ();
+    lock.lock();
+    job.starting = false;
+    job_started.notify_all ();
+    if (result != 0) {
+        if (job.reference != NULL) job.reference->reference_users--;
+        job.reference = NULL;
+        job.environment = NULL;
+        delete environment;
+        job.failed = true;
+        failed++;
+        if (verbose) cout << "Failed " << job.spec.output_path << ": equation is invalid" << endl;
+        return;
+    }
+}
+
+/**
+ * @brief Pick the kept image from which the most pixels of an image can be copied, and mark it as in use. Assumes the mutex is locked
+ *
+ * @param job The image about to start, with its environment's parameters set
+ */
+void HFractalBatch::chooseReference (HFractalBatchJob &job) {
+    long best_pixels = 0;
+    for (auto candidate : finished) {
+        long pixels = job.environment->countReferencePixels (candidate->environment);
+        if (pixels > best_pixels) {
+            best_pixels = pixels;
+            job.reference = candidate;
+        }
+    }
+    if (job.reference == NULL) return;
+    job.reference->reference_users++;
+    job.environment->setReference (job.reference->environment);
+}
+
+/**
+ * @brief Free the oldest kept images beyond the reference window, stopping at any image still in use by a render. Assumes the mutex is locked
+ *
+ */
+void HFractalBatch::releaseFinished () {
+    while ((int)finished.size() > reference_window && finished.front()->reference_users == 0) {
+        delete finished.front()->environment;
+        finished.front()->environment = NULL;
+        finished.pop_front();
+    }
+}
+
+/**
+ * @brief Hash the values of a completed image, along with its size, palette and evaluation limit, which together decide the contents of the file it is written to
+ *
+ * @param job The completed image
+ * @return 64 bit FNV-1a hash
+ */
+uint64_t HFractalBatch::hashImage (HFractalBatchJob &job) {
+    int size = job.spec.resolution;
+    vector<uint16_t> values ((size_t)size*size+3);
+    job.environment->copyImage (values.data(), PF_VALUE16, size*sizeof (uint16_t), 0);
+    values[values.size()-3] = size;
+    values[values.size()-2] = job.spec.palette;
+    values[values.size()-1] = job.spec.eval_limit;
+    uint64_t hash = 0xcbf29ce484222325;
+    const uint8_t *bytes = (const uint8_t *)values.data();
+    for (size_t i = 0; i < values.size()*sizeof (uint16_t); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * @brief Check whether two files have exactly the same contents
+ *
+ * @param path_a Path to the first file
+ * @param path_b Path to the second file
+ * @return True if both files could be read and are byte for byte identical
+ */
+static bool filesIdentical (string path_a, string path_b) {
+    error_code ec;
+    uintmax_t size = filesystem::file_size (path_a, ec);
+    if (ec || filesystem::file_size (path_b, ec) != size || ec) return false;
+    ifstream file_a (path_a, ios::binary);
+    ifstream file_b (path_b, ios::binary);
+    vector<char> block_a (65536), block_b (65536);
+    while (file_a && file_b) {
+        file_a.read (block_a.data(), block_a.size());
+        file_b.read (block_b.data(), block_b.size());
+        if (file_a.gcount() != file_b.gcount() || memcmp (block_a.data(), block_b.data(), file_a.gcount()) != 0) return false;
+    }
+    return file_a.eof() && file_b.eof();
+}
+
+/**
+ * @brief Replace the file of a completed image with a hard link to the file of an identical image already written, so that repeated images take no extra space.
+ * Images with the same hash are only linked once their files are found to be byte for byte identical, and the link replaces the file in one rename, so the image is never left missing
+ *
+ * @param job The completed image, already written
+ * @param hash Hash of the image from hashImage
+ * @return True if the image was linked, false if no identical image has been written or the link could not be made
+ */
+bool HFractalBatch::linkDuplicate (HFractalBatchJob &job, uint64_t hash) {
+    string original;
+    {
+        lock_guard<mutex> lock (mut);
+        auto it = written_images.find (hash);
+        if (it == written_images.end()) return false;
+        original = it->second;
+    }
+    string extension = imageTypeExtension (image_type);
+    string path = job.spec.output_path + extension;
+    if (!filesIdentical (original + extension, path)) return false;
+    string link_path = path + ".link";
+    error_code ec;
+    filesystem::remove (link_path, ec);
+    filesystem::create_hard_link (original + extension, link_path, ec);
+    if (!ec) filesystem::rename (link_path, path, ec);
+    if (ec) {
+        filesystem::remove (link_path, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Write out a completed image. PNG images are encoded on the calling thread, since the batch already keeps every core busy
+ *
+ * @param job The completed image
+ * @return True for success, false for failure
+ */
+bool HFractalBatch::writeJob (HFractalBatchJob &job) {
+    if (image_type != PNG) return job.environment->writeImage (image_type, job.spec.output_path, job.spec.palette);
+    vector<uint8_t> png;
+    if (!job.environment->encodePNG (png, job.spec.palette)) return false;
+    ofstream file (job.spec.output_path + imageTypeExtension (image_type), ios::binary);
+    file.write ((const char *)png.data(), png.size());
+    file.close();
+    return !file.fail();
+}
+
+/**
+ * @brief Write out an image once all its tiles are rendered, and link it to an identical image if deduplicating, then free its rendering environment, or keep it if later images may copy from it
+ *
+ * @param job The completed image
+ */
+void HFractalBatch::finishJob (HFractalBatchJob &job) {
+    job.environment->endRender ();
+    bool written = writeJob (job);
+    uint64_t hash = 0;
+    bool linked = false;
+    if (deduplicate && written) {
+        hash = hashImage (job);
+        linked = linkDuplicate (job, hash);
+    }
+
+    lock_guard<mutex> lock (mut);
+    // Only record images once written, so that nothing is linked to a file which is incomplete
+    if (deduplicate && written && !linked) written_images.emplace (hash, job.spec.output_path);
+    if (linked) deduplicated++;
+    if (job.reference != NULL) job.reference->reference_users--;
+    job.reference = NULL;
+    job.environment->setReference (NULL);
+    if (reference_window > 0) {
+        // Keep the image so that later images can copy from it
+        finished.push_back (&job);
+    } else {
+        delete job.environment;
+        job.environment = NULL;
+    }
+    releaseFinished ();
+    if (written) completed++;
+    else {
+        job.failed = true;
+        failed++;
+    }
+    if (verbose) cout << "[" << completed+failed << "/" << jobs.size() << "] " << (linked ? "Linked " : (written ? "Wrote " : "Failed to write ")) << job.spec.output_path << imageTypeExtension (image_type) << endl;
+}
+
+/**
+ * @brief Main function called on each worker thread. Fetches tiles from the earliest image with tiles left, moving on as soon as an image's tiles are all handed out rather than waiting for them to finish
+ *
+ */
+void HFractalBatch::threadMain () {
+    unique_lock<mutex> lock (mut);
+    while (next_job < jobs.size()) {
+        HFractalBatchJob &job = jobs[next_job];
+        if (job.environment == NULL && !job.failed) startJob (job, lock);
+        if (job.starting) {
+            // Another thread is allocating this image, so wait until its tiles can be fetched
+            job_started.wait (lock, [&job] { return !job.starting; });
+            continue;
+        }
+        int tile = (job.environment == NULL) ? -1 : job.environment->fetchTile();
+        if (tile == -1) {
+            // Every tile of this image has been handed out, so move every thread on to the next image
+            next_job++;
+            job.exhausted = true;
+            if (job.environment != NULL && job.in_flight == 0) {
+                lock.unlock();
+                finishJob (job);
+                lock.lock();
+            }
+            continue;
+        }
+        job.in_flight++;
+        lock.unlock();
+
+        job.environment->renderTile (tile);
+
+        // The thread finishing the last tile of an image writes it out, while the others carry on with the next image
+        lock.lock();
+        job.in_flight--;
+        if (job.exhausted && job.in_flight == 0) {
+            lock.unlock();
+            finishJob (job);
+            lock.lock();
+        }
+    }
+}
+
+/**
+ * @brief Render and write out every image in the batch, blocking until all are done. Each distinct equation is parsed once up front. Unless images are kept for reuse, which needs them rendered in order, the most expensive images are started first so that the end of the batch is made up of small images which pack well across threads
+ *
+ * @return Number of images which could not be rendered or written
+ */
+int HFractalBatch::run () {
+    auto start = steady_clock::now();
+
+    // Parse each distinct equation once, shared by every image using it
+    for (auto &job : jobs) {
+        if (equations.count (job.spec.equation) != 0) continue;
+        HFractalEquation *parsed = NULL;
+        try {
+            parsed = HFractalMain::parseEquation (job.spec.equation);
+        } catch (...) {
+            parsed = NULL;
+        }
+        equations[job.spec.equation] = parsed;
+    }
+
+    if (reference_window == 0) stable_sort (jobs.begin(), jobs.end(), [] (const HFractalBatchJob &a, const HFractalBatchJob &b) {
+        return (long double)a.spec.resolution*a.spec.resolution*a.spec.eval_limit > (long double)b.spec.resolution*b.spec.resolution*b.spec.eval_limit;
+    });
+
+    if (verbose) cout << "Rendering " << jobs.size() << " images with " << equations.size() << " distinct equations on " << worker_threads << " threads" << endl;
+
+    next_job = 0;
+    completed = 0;
+    failed = 0;
+    deduplicated = 0;
+    written_images.clear();
+    vector<thread*> thread_pool;
+    for (int i = 0; i < worker_threads; i++) thread_pool.push_back (new thread (&HFractalBatch::threadMain, this));
+    for (auto th : thread_pool) {
+        th->join();
+        delete th;
+    }
+    for (auto job : finished) {
+        delete job->environment;
+        job->environment = NULL;
+    }
+    finished.clear();
+
+    if (verbose) {
+        double seconds = duration_cast<duration<double>> (steady_clock::now() - start).count();
+        cout << "Batch done in " << seconds << "s: " << completed << " written, " << failed << " failed";
+        if (deduplicate) cout << ", " << deduplicated << " linked to identical images";
+        cout << endl;
+    }
+    return failed;
+}
@@ -0,0 +1,122 @@
+// src/batch.hh
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+
+#include "hyperfractal.hh"
+#include "database.hh"
+
+// Number of finished frames of an animation kept in memory, so that later frames panned or zoomed by whole pixels or factors can copy their pixels
+#define ANIMATION_REFERENCE_WINDOW 32
+
+#define PYRAMID_TILE_SIZE 256 // Horizontal and vertical dimension of the tiles of a pyramid
+#define PYRAMID_DZI_NAME "pyramid" // Name of the descriptor file and tile directory of a Deep Zoom Image pyramid
+
+// Enum describing how the tiles of a pyramid are laid out in the output directory
+enum PYRAMID_LAYOUT {
+    PL_XYZ = 0, // Tiles at z/x/y, where level z covers the view with 2^z by 2^z tiles, as read by slippy map viewers
+    PL_DZI // Deep Zoom Image, with a descriptor file and tiles at <name>_files/level/column_row, where levels halve in size down to a single pixel
+};
+
+// Struct describing one image to be rendered by a batch
+struct HFractalRenderSpec {
+    int resolution; // Horizontal and vertical dimension of the image
+    long double offset_x; // Horizontal offset in the complex plane
+    long double offset_y; // Vertical offset in the complex plane
+    long double zoom; // Scaling value for the image
+    int eval_limit; // Evaluation limit for the image
+    std::string equation; // String equation to render
+    int palette = 0; // Colour scheme preset used for colour image types
+    std::string output_path; // Path the image is written to, without extension
+};
+
+// Struct describing the progress of one image within a batch
+struct HFractalBatchJob {
+    HFractalRenderSpec spec; // Parameters of the image
+    HFractalMain *environment = NULL; // Rendering environment, only allocated while the image is being rendered or kept for reuse
+    int in_flight = 0; // Number of tiles fetched from the image which are still being rendered
+    bool exhausted = false; // Whether every tile of the image has been fetched
+    bool failed = false; // Whether the image could not be rendered or written
+    bool starting = false; // Whether a thread is allocating the image, outside the mutex
+    HFractalBatchJob *reference = NULL; // Finished image whose pixels this image copies where they line up, or NULL
+    int reference_users = 0; // Number of images currently rendering which copy pixels from this image
+};
+
+// Struct describing the view at one frame of an animation, with the frames in between interpolated
+struct HFractalKeyframe {
+    int frame; // Index of the frame this view is reached at
+    long double offset_x; // Horizontal offset in the complex plane
+    long double offset_y; // Vertical offset in the complex plane
+    long double zoom; // Scaling value for the image
+};
+
+/**
+ * Class rendering a list of images through one shared pool of worker threads.
+ * Threads fetch tiles from the earliest image which still has tiles left, so once an image's tiles are all handed out, idle threads start on the next image while the last tiles are finished, and whichever thread finishes the last tile writes the image out.
+ * Each distinct equation string is parsed once and shared by every image using it.
+ * For animations, finished frames can be kept for a while so that later frames copy the pixels which line up exactly with them
+ */
+class HFractalBatch {
+private:
+    std::vector<HFractalBatchJob> jobs; // Images to render, in the order they are started
+    std::map<std::string, HFractalEquation*> equations; // Parsed equations against their strings, NULL for strings which failed to parse
+    std::string output_directory = ""; // Directory images read from spec files or the database are written to
+    IMAGE_TYPE image_type = PGM; // Format images are written in
+    int worker_threads; // Number of worker threads shared by every image
+    int reference_window = 0; // Number of finished images kept for later images to copy pixels from, 0 to free images as soon as they are written
+    std::deque<HFractalBatchJob*> finished; // Finished images kept for reuse, oldest first
+    bool verbose = true; // Whether progress and statistics are written to the terminal
+    bool deduplicate = false; // Whether images identical to one already written are hard linked to it rather than written again
+    std::unordered_map<uint64_t, std::string> written_images; // Paths of written images, without extension, against a hash of their values, for deduplication
+
+    size_t next_job = 0; // Index of the earliest image which may still have tiles left to fetch
+    int completed = 0; // Number of images written so far
+    int failed = 0; // Number of images which could not be rendered or written
+    int deduplicated = 0; // Number of images linked to an identical image rather than written
+    std::mutex mut; // Mutex object used to lock job progress between worker threads
+    std::condition_variable job_started; // Signalled when an image has finished being allocated
+
+    void threadMain (); // Method called on each worker thread, fetching and rendering tiles from any image
+    void startJob (HFractalBatchJob &, std::unique_lock<std::mutex> &); // Create the rendering environment for an image and prepare it for rendering, assuming the mutex is locked and releasing it while the image is allocated
+    void finishJob (HFractalBatchJob &); // Write out a completed image and free its rendering environment, or keep it for reuse
+    void chooseReference (HFractalBatchJob &); // Pick the kept image the most pixels of an image can be copied from, assuming the mutex is locked
+    void releaseFinished (); // Free kept images which are outside the reference window and not in use, assuming the mutex is locked
+    uint64_t hashImage (HFractalBatchJob &); // Hash the values of a completed image along with everything else which affects how it is written
+    bool linkDuplicate (HFractalBatchJob &, uint64_t); // Replace a written image with a hard link to an identical image already written, if there is one
+    bool writeJob (HFractalBatchJob &); // Write out a completed image on the calling thread
+
+public:
+    HFractalBatch (int); // Initialise an empty batch with a number of worker threads
+    ~HFractalBatch (); // Destructor, frees the parsed equations
+
+    bool setOutputDirectory (std::string); // Set the directory images are written to, creating it if needed
+    void addSpec (HFractalRenderSpec); // Add an image to the batch
+    int readSpecFile (std::string); // Add every image listed in a spec file
+    int readDatabase (std::string, int); // Add every config profile saved in a database, at a given resolution
+    int addAnimation (std::vector<HFractalKeyframe>, int, int, std::string); // Add every frame of an animation through a list of keyframes
+    int readKeyframeFile (std::string, int, int, std::string); // Add every frame of an animation through the keyframes listed in a file
+    int addPyramid (HFractalRenderSpec, int, PYRAMID_LAYOUT); // Add every tile of a multi-resolution tile pyramid of a view
+    static HFractalRenderSpec getPyramidTile (HFractalRenderSpec, int, int, int, int); // Get the view of one tile of a level of a pyramid
+
+    size_t getJobCount () { return jobs.size(); } // Get the number of images in the batch
+    int getReferenceWindow () { return reference_window; } // Inline methods to get/set the number of finished images kept for reuse. Images are rendered in the order they were added when this is not 0
+    void setReferenceWindow (int rw_) { reference_window = rw_; }
+    IMAGE_TYPE getImageType () { return image_type; } // Inline methods to get/set the format images are written in
+    void setImageType (IMAGE_TYPE it_) { image_type = it_; }
+    bool getVerbose () { return verbose; } // Inline methods to get/set whether progress is written to the terminal
+    void setVerbose (bool v_) { verbose = v_; }
+    bool getDeduplicate () { return deduplicate; } // Inline methods to get/set whether images identical to one already written are linked to it
+    void setDeduplicate (bool d_) { deduplicate = d_; }
+
+    int run (); // Render every image in the batch, blocking until all are written
+};
+
+#endif
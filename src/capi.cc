@@ -0,0 +1,170 @@
+// src/capi.cc
+
+#include "capi.h"
+
+#include "hyperfractal.hh"
+
+using namespace std;
+
+// Pixel formats are passed straight through as PIXEL_FORMAT values, so the C constants must match them
+static_assert (HF_VALUE16 == PF_VALUE16, "HF_VALUE16 does not match PIXEL_FORMAT");
+static_assert (HF_GREY8 == PF_GREY8, "HF_GREY8 does not match PIXEL_FORMAT");
+static_assert (HF_RGBA32 == PF_RGBA32, "HF_RGBA32 does not match PIXEL_FORMAT");
+static_assert (HF_BGRA32 == PF_BGRA32, "HF_BGRA32 does not match PIXEL_FORMAT");
+static_assert (HF_RGB24 == PF_RGB24, "HF_RGB24 does not match PIXEL_FORMAT");
+
+// The handle is the rendering environment itself, kept opaque to C callers
+struct HFractalHandle {
+    HFractalMain main;
+};
+
+/**
+ * @brief Create a rendering environment which writes nothing to the terminal
+ *
+ * @return Handle to the environment, or NULL if it could not be allocated
+ */
+HFractalHandle *hfCreate (void) {
+    HFractalHandle *handle = new (nothrow) HFractalHandle;
+    if (handle != NULL) handle->main.setVerbose (false);
+    return handle;
+}
+
+/**
+ * @brief Destroy a rendering environment created by hfCreate
+ *
+ * @param handle Handle to destroy, may be NULL
+ */
+void hfDestroy (HFractalHandle *handle) {
+    delete handle;
+}
+
+/**
+ * @brief Set the equation to render
+ *
+ * @param handle Rendering environment
+ * @param equation Equation string, in the same form as the GUI and console accept
+ * @return 0 for success, 1 if the equation is invalid or the arguments are NULL
+ */
+int hfSetEquation (HFractalHandle *handle, const char *equation) {
+    if (handle == NULL || equation == NULL) return 1;
+    try {
+        handle->main.setEquation (string (equation));
+    } catch (...) {
+        return 1;
+    }
+    return handle->main.isValidEquation() ? 0 : 1;
+}
+
+/**
+ * @brief Set the area of the complex plane to render, and the size of the square image
+ *
+ * @param handle Rendering environment
+ * @param resolution Width and height of the image
+ * @param offset_x Horizontal offset in the complex plane
+ * @param offset_y Vertical offset in the complex plane
+ * @param zoom Scaling value for the image
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetView (HFractalHandle *handle, int resolution, double offset_x, double offset_y, double zoom) {
+    if (handle == NULL || resolution <= 0 || zoom <= 0) return 1;
+    handle->main.setResolution (resolution);
+    handle->main.setOffsetX (offset_x);
+    handle->main.setOffsetY (offset_y);
+    handle->main.setZoom (zoom);
+    return 0;
+}
+
+/**
+ * @brief Set the evaluation limit
+ *
+ * @param handle Rendering environment
+ * @param limit Maximum number of iterations per pixel
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetEvalLimit (HFractalHandle *handle, int limit) {
+    if (handle == NULL || limit <= 0) return 1;
+    handle->main.setEvalLimit (limit);
+    return 0;
+}
+
+/**
+ * @brief Set the number of worker threads used for each render
+ *
+ * @param handle Rendering environment
+ * @param threads Number of threads
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetWorkerThreads (HFractalHandle *handle, int threads) {
+    if (handle == NULL || threads <= 0) return 1;
+    handle->main.setWorkerThreads (threads);
+    return 0;
+}
+
+/**
+ * @brief Set how the pixels of each tile are iterated
+ *
+ * @param handle Rendering environment
+ * @param strategy RENDER_STRATEGY value
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetRenderStrategy (HFractalHandle *handle, int strategy) {
+    if (handle == NULL || strategy < RS_PIXEL || strategy > RS_ADAPTIVE) return 1;
+    handle->main.setRenderStrategy ((RENDER_STRATEGY)strategy);
+    return 0;
+}
+
+/**
+ * @brief Set whether wavefront rendering may use double lanes at low zoom, which are faster but can change a few pixels
+ *
+ * @param handle Rendering environment
+ * @param enabled Nonzero to allow double lanes
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetDoubleLanes (HFractalHandle *handle, int enabled) {
+    if (handle == NULL) return 1;
+    handle->main.setDoubleLanes (enabled != 0);
+    return 0;
+}
+
+/**
+ * @brief Set the accuracy of complex exponentials, logarithms and powers
+ *
+ * @param handle Rendering environment
+ * @param accuracy MATH_ACCURACY value
+ * @return 0 for success, 1 if the arguments are invalid
+ */
+int hfSetAccuracy (HFractalHandle *handle, int accuracy) {
+    if (handle == NULL || accuracy < MA_PRECISE || accuracy > MA_FAST) return 1;
+    handle->main.setAccuracy ((MATH_ACCURACY)accuracy);
+    return 0;
+}
+
+/**
+ * @brief Get the number of bytes each pixel takes up in a pixel format
+ *
+ * @param format HF_* pixel format
+ * @return Number of bytes per pixel, or 0 if the format is unknown
+ */
+int hfBytesPerPixel (int format) {
+    if (format < HF_VALUE16 || format > HF_RGB24) return 0;
+    return HFractalMain::bytesPerPixel ((PIXEL_FORMAT)format);
+}
+
+/**
+ * @brief Render an image with the current parameters into a caller provided buffer, blocking until it is complete
+ *
+ * @param handle Rendering environment
+ * @param buffer Buffer to write into, holding at least `stride` bytes for each row of the image
+ * @param format HF_* pixel format
+ * @param stride Number of bytes between the start of each row
+ * @param colour_preset Colour scheme to use for colour formats
+ * @return 0 for success, otherwise a status code as for HFractalMain::renderToBuffer, or 4 if the arguments are invalid or the render failed unexpectedly
+ */
+int hfRender (HFractalHandle *handle, void *buffer, int format, size_t stride, int colour_preset) {
+    if (handle == NULL || buffer == NULL || hfBytesPerPixel (format) == 0) return 4;
+    try {
+        return handle->main.renderToBuffer (buffer, (PIXEL_FORMAT)format, stride, colour_preset);
+    } catch (...) {
+        return 4;
+    }
+}
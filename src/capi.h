@@ -0,0 +1,46 @@
+/* src/capi.h */
+
+#ifndef CAPI_H
+#define CAPI_H
+
+#include <stddef.h>
+
+/*
+ * Plain C interface to the rendering environment, for embedding HyperFractal in other programs and calling it through FFI.
+ * Every function takes a handle created by hfCreate. Functions returning int give 0 for success.
+ * Renders are always synchronous and write nothing to the terminal
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque handle to a rendering environment */
+typedef struct HFractalHandle HFractalHandle;
+
+/* Pixel formats accepted by hfRender, with the same values as PIXEL_FORMAT */
+#define HF_VALUE16 0 /* Raw 16 bit values, as computed, in native byte order */
+#define HF_GREY8 1 /* 8 bit grey levels */
+#define HF_RGBA32 2 /* 4 bytes per pixel in the order red, green, blue, alpha */
+#define HF_BGRA32 3 /* 4 bytes per pixel in the order blue, green, red, alpha */
+#define HF_RGB24 4 /* 3 bytes per pixel in the order red, green, blue */
+
+HFractalHandle *hfCreate (void); /* Create a rendering environment, or return NULL on failure */
+void hfDestroy (HFractalHandle *); /* Destroy a rendering environment */
+
+int hfSetEquation (HFractalHandle *, const char *); /* Set the equation, failing if it cannot be parsed */
+int hfSetView (HFractalHandle *, int, double, double, double); /* Set the resolution, x offset, y offset and zoom */
+int hfSetEvalLimit (HFractalHandle *, int); /* Set the evaluation limit */
+int hfSetWorkerThreads (HFractalHandle *, int); /* Set the number of worker threads */
+int hfSetRenderStrategy (HFractalHandle *, int); /* Set the render strategy, as a RENDER_STRATEGY value */
+int hfSetDoubleLanes (HFractalHandle *, int); /* Set whether wavefront rendering may use double lanes at low zoom */
+int hfSetAccuracy (HFractalHandle *, int); /* Set the accuracy of complex exponentials, logarithms and powers, as a MATH_ACCURACY value */
+
+int hfBytesPerPixel (int); /* Get the number of bytes each pixel takes up in a pixel format, or 0 if the format is unknown */
+int hfRender (HFractalHandle *, void *, int, size_t, int); /* Render into a buffer with a pixel format, row stride in bytes and colour preset */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+// src/complexmath.hh
+
+#ifndef COMPLEXMATH_H
+#define COMPLEXMATH_H
+
+#include <complex>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Enum describing the accuracy used for complex exponentials, logarithms and powers
+enum MATH_ACCURACY {
+    MA_PRECISE = 0, // Standard library functions at long double precision
+    MA_DOUBLE, // In-project functions accurate to around 1 ulp at double precision
+    MA_FAST // In-project functions accurate to around 1e-7, for previews
+};
+
+/**
+ * Class containing static methods implementing complex exp, log and pow at double precision.
+ * Every function is branch-free and built only from arithmetic, so that loops applying them across arrays of lanes can be vectorised by the compiler.
+ * The accuracy is chosen at compile time, which determines how many polynomial terms are used.
+ */
+class HFractalComplexMath {
+private:
+    static constexpr double LOG2E = 1.44269504088896338700e+00;
+    static constexpr double LN2_HI = 6.93147180369123816490e-01; // ln(2) split into high and low parts, for exact range reduction
+    static constexpr double LN2_LO = 1.90821492927058770002e-10;
+    static constexpr double SQRT2 = 1.41421356237309504880e+00;
+    static constexpr double PI = 3.14159265358979311600e+00;
+    static constexpr double PI_2 = 1.57079632679489655800e+00;
+    static constexpr double PI_4 = 7.85398163397448278999e-01;
+    static constexpr double TAN_PI_8 = 4.14213562373095034e-01;
+    static constexpr double PIO2_HI = 1.57079632673412561417e+00; // pi/2 split into high and low parts, for exact range reduction
+    static constexpr double PIO2_LO = 6.07710050650619224932e-11;
+
+    static constexpr double TWO_52 = 4503599627370496.0; // Adding 2^52 to a small non-negative integer places it in the low mantissa bits
+    static constexpr double ROUNDER = 6755399441055744.0; // Adding and subtracting 1.5*2^52 rounds to the nearest integer, leaving it in the low mantissa bits
+
+    // Reinterpret the bits of a double as an integer, and back
+    static inline uint64_t toBits (double x) {
+        uint64_t bits;
+        memcpy (&bits, &x, sizeof(bits));
+        return bits;
+    }
+    static inline double fromBits (uint64_t bits) {
+        double x;
+        memcpy (&x, &bits, sizeof(x));
+        return x;
+    }
+
+    // Scale a value by 2^k, where k is an integer valued double within the normal exponent range, by building the scale factor's bits directly.
+    // Integer conversions are avoided, since they cannot be vectorised without AVX-512
+    static inline double scaleByPow2 (double x, double k) {
+        return x*fromBits (toBits (k + 1023 + TWO_52) << 52);
+    }
+
+    // Evaluate atan(u) for |u| <= 0.2 by its Taylor series
+    template <MATH_ACCURACY A> static inline double atanSeries (double u) {
+        double u2 = u*u;
+        double p;
+        if (A == MA_FAST) {
+            p = 1 + u2*(-1.0/3 + u2*(1.0/5 + u2*(-1.0/7)));
+        } else {
+            p = 1 + u2*(-1.0/3 + u2*(1.0/5 + u2*(-1.0/7 + u2*(1.0/9 + u2*(-1.0/11 + u2*(1.0/13 + u2*(-1.0/15 + u2*(1.0/17 + u2*(-1.0/19 + u2*(1.0/21))))))))));
+        }
+        return u*p;
+    }
+
+public:
+    /**
+     * @brief Compute e^x. Arguments are clamped to the range where the result is a normal double
+     */
+    template <MATH_ACCURACY A> static inline double exp (double x) {
+        x = x < -708 ? -708 : (x > 709 ? 709 : x);
+        // Reduce to e^r * 2^k with |r| <= ln(2)/2
+        double k = ((x*LOG2E) + ROUNDER) - ROUNDER;
+        double r = (x - (k*LN2_HI)) - (k*LN2_LO);
+        double p;
+        if (A == MA_FAST) {
+            p = 1 + r*(1 + r*(1.0/2 + r*(1.0/6 + r*(1.0/24 + r*(1.0/120 + r*(1.0/720))))));
+        } else {
+            p = 1 + r*(1 + r*(1.0/2 + r*(1.0/6 + r*(1.0/24 + r*(1.0/120 + r*(1.0/720 + r*(1.0/5040
+                + r*(1.0/40320 + r*(1.0/362880 + r*(1.0/3628800 + r*(1.0/39916800 + r*(1.0/479001600 + r*(1.0/6227020800)))))))))))));
+        }
+        return scaleByPow2 (p, k);
+    }
+
+    /**
+     * @brief Compute the natural logarithm of x. Gives -inf for zero, inf for inf, and NaN for negative numbers
+     */
+    template <MATH_ACCURACY A> static inline double log (double x) {
+        // Scale subnormal numbers up so their exponent can be read directly
+        bool tiny = x < 2.2250738585072014e-308;
+        double y = tiny ? x*18014398509481984.0 : x;
+        uint64_t bits = toBits (y);
+        double e = (fromBits ((bits >> 52) | toBits (TWO_52)) - TWO_52) - 1023 - (tiny ? 54 : 0);
+        // Extract the mantissa in [1, 2), then shift it into [sqrt(1/2), sqrt(2)) so the series converges quickly
+        double m = fromBits ((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+        bool big = m > SQRT2;
+        m = big ? m*0.5 : m;
+        e = big ? e+1 : e;
+        // log(m) = 2*atanh(s) where s = (m-1)/(m+1), and |s| <= 0.172
+        double s = (m-1)/(m+1);
+        double s2 = s*s;
+        double p;
+        if (A == MA_FAST) {
+            p = 1 + s2*(1.0/3 + s2*(1.0/5 + s2*(1.0/7)));
+        } else {
+            p = 1 + s2*(1.0/3 + s2*(1.0/5 + s2*(1.0/7 + s2*(1.0/9 + s2*(1.0/11 + s2*(1.0/13 + s2*(1.0/15 + s2*(1.0/17 + s2*(1.0/19 + s2*(1.0/21))))))))));
+        }
+        double result = (e*LN2_HI) + ((2*s*p) + (e*LN2_LO));
+        // Handle zero, negative, infinite and NaN arguments
+        double special = x == 0 ? -HUGE_VAL : (x > 0 ? x : NAN);
+        return (x > 0 && x <= 1.7976931348623157e308) ? result : special;
+    }
+
+    /**
+     * @brief Compute the angle of the point (x, y) from the positive x axis, in the range [-pi, pi]
+     */
+    template <MATH_ACCURACY A> static inline double atan2 (double y, double x) {
+        double ax = fabs (x);
+        double ay = fabs (y);
+        double mx = ax > ay ? ax : ay;
+        double mn = ax > ay ? ay : ax;
+        double t = mx == 0 ? 0 : mn/mx;
+        // Reduce to |t| <= tan(pi/8) using atan(t) = pi/4 + atan((t-1)/(t+1))
+        bool reduce = t > TAN_PI_8;
+        double offset = reduce ? PI_4 : 0;
+        t = reduce ? (t-1)/(t+1) : t;
+        // Halve the angle, reducing to |u| <= 0.2, using atan(t) = 2*atan(t/(1+sqrt(1+t^2)))
+        double u = t/(1 + sqrt (1 + (t*t)));
+        double a = offset + (2*atanSeries<A> (u));
+        // Unfold the octant
+        a = ay > ax ? PI_2 - a : a;
+        a = x < 0 ? PI - a : a;
+        return copysign (a, y);
+    }
+
+    /**
+     * @brief Compute both the sine and cosine of an angle. The angle is reduced by a two part Cody-Waite reduction, which is exact while |theta| < 2^20*pi/2 (about 1.6e6).
+     * Beyond that the reduction loses accuracy in proportion to |theta|, so results for larger angles are only approximate
+     */
+    template <MATH_ACCURACY A> static inline void sincos (double theta, double &s, double &c) {
+        // Reduce to |r| <= pi/4, remembering which quadrant the angle was in
+        double shifted = (theta*(2/PI)) + ROUNDER;
+        double k = shifted - ROUNDER;
+        double r = (theta - (k*PIO2_HI)) - (k*PIO2_LO);
+        double quadrant = fromBits ((toBits (shifted) & 3) | toBits (TWO_52)) - TWO_52;
+        double r2 = r*r;
+        double sr, cr;
+        if (A == MA_FAST) {
+            sr = r*(1 + r2*(-1.0/6 + r2*(1.0/120 + r2*(-1.0/5040))));
+            cr = 1 + r2*(-1.0/2 + r2*(1.0/24 + r2*(-1.0/720 + r2*(1.0/40320))));
+        } else {
+            sr = r*(1 + r2*(-1.0/6 + r2*(1.0/120 + r2*(-1.0/5040 + r2*(1.0/362880 + r2*(-1.0/39916800 + r2*(1.0/6227020800 + r2*(-1.0/1307674368000))))))));
+            cr = 1 + r2*(-1.0/2 + r2*(1.0/24 + r2*(-1.0/720 + r2*(1.0/40320 + r2*(-1.0/3628800 + r2*(1.0/479001600 + r2*(-1.0/87178291200 + r2*(1.0/20922789888000))))))));
+        }
+        s = quadrant == 0 ? sr : (quadrant == 1 ? cr : (quadrant == 2 ? -sr : -cr));
+        c = quadrant == 0 ? cr : (quadrant == 1 ? -sr : (quadrant == 2 ? -cr : sr));
+    }
+
+    /**
+     * @brief Compute the complex exponential of (re + im i)
+     */
+    template <MATH_ACCURACY A> static inline void cexp (double re, double im, double &out_re, double &out_im) {
+        double magnitude = exp<A> (re);
+        double s, c;
+        sincos<A> (im, s, c);
+        out_re = magnitude*c;
+        out_im = magnitude*s;
+    }
+
+    /**
+     * @brief Compute the principal complex logarithm of (re + im i)
+     */
+    template <MATH_ACCURACY A> static inline void clog (double re, double im, double &out_re, double &out_im) {
+        out_re = 0.5*log<A> ((re*re) + (im*im));
+        out_im = atan2<A> (im, re);
+    }
+
+    /**
+     * @brief Compute (z_re + z_im i) to the power of (w_re + w_im i), as exp(w*log(z)). Zero to any power gives zero, matching std::pow
+     */
+    template <MATH_ACCURACY A> static inline void cpow (double z_re, double z_im, double w_re, double w_im, double &out_re, double &out_im) {
+        double l_re, l_im;
+        clog<A> (z_re, z_im, l_re, l_im);
+        cexp<A> ((w_re*l_re) - (w_im*l_im), (w_re*l_im) + (w_im*l_re), out_re, out_im);
+        bool is_zero = z_re == 0 && z_im == 0;
+        out_re = is_zero ? 0 : out_re;
+        out_im = is_zero ? 0 : out_im;
+    }
+
+    /**
+     * @brief Raise a complex number to an integer power by repeated squaring
+     */
+    static inline std::complex<long double> powInt (std::complex<long double> z, int n) {
+        std::complex<long double> result = 1;
+        unsigned int m = n < 0 ? -n : n;
+        while (m != 0) {
+            if (m & 1) result *= z;
+            z *= z;
+            m >>= 1;
+        }
+        return n < 0 ? (long double)1/result : result;
+    }
+
+    // Apply a function to each of n lanes, stored as separate arrays of real and imaginary parts. Outputs must not overlap inputs, so that the loops can be vectorised
+    template <MATH_ACCURACY A> static void cexpLanes (const double *__restrict re, const double *__restrict im, double *__restrict out_re, double *__restrict out_im, int n) {
+        for (int i = 0; i < n; i++) cexp<A> (re[i], im[i], out_re[i], out_im[i]);
+    }
+    template <MATH_ACCURACY A> static void clogLanes (const double *__restrict re, const double *__restrict im, double *__restrict out_re, double *__restrict out_im, int n) {
+        for (int i = 0; i < n; i++) clog<A> (re[i], im[i], out_re[i], out_im[i]);
+    }
+    template <MATH_ACCURACY A> static void cpowLanes (const double *__restrict z_re, const double *__restrict z_im, const double *__restrict w_re, const double *__restrict w_im, double *__restrict out_re, double *__restrict out_im, int n) {
+        // The body of cpow is written out so that the compiler inlines it at every accuracy, which vectorising the loop requires
+        for (int i = 0; i < n; i++) {
+            double l_re, l_im, p_re, p_im;
+            clog<A> (z_re[i], z_im[i], l_re, l_im);
+            cexp<A> ((w_re[i]*l_re) - (w_im[i]*l_im), (w_re[i]*l_im) + (w_im[i]*l_re), p_re, p_im);
+            bool is_zero = z_re[i] == 0 && z_im[i] == 0;
+            out_re[i] = is_zero ? 0 : p_re;
+            out_im[i] = is_zero ? 0 : p_im;
+        }
+    }
+
+    /**
+     * @brief Compute z to the power of w at the requested accuracy, either using the standard library at long double precision, or the in-project functions at double precision
+     */
+    static inline std::complex<long double> pow (std::complex<long double> z, std::complex<long double> w, MATH_ACCURACY accuracy) {
+        double re, im;
+        switch (accuracy) {
+        case MA_DOUBLE:
+            cpow<MA_DOUBLE> (z.real(), z.imag(), w.real(), w.imag(), re, im);
+            return std::complex<long double> (re, im);
+        case MA_FAST:
+            cpow<MA_FAST> (z.real(), z.imag(), w.real(), w.imag(), re, im);
+            return std::complex<long double> (re, im);
+        default:
+            return std::pow (z, w);
+        }
+    }
+
+    /**
+     * @brief Compute e^z at the requested accuracy
+     */
+    static inline std::complex<long double> exp (std::complex<long double> z, MATH_ACCURACY accuracy) {
+        double re, im;
+        switch (accuracy) {
+        case MA_DOUBLE:
+            cexp<MA_DOUBLE> (z.real(), z.imag(), re, im);
+            return std::complex<long double> (re, im);
+        case MA_FAST:
+            cexp<MA_FAST> (z.real(), z.imag(), re, im);
+            return std::complex<long double> (re, im);
+        default:
+            return std::exp (z);
+        }
+    }
+
+    /**
+     * @brief Compute the principal logarithm of z at the requested accuracy
+     */
+    static inline std::complex<long double> log (std::complex<long double> z, MATH_ACCURACY accuracy) {
+        double re, im;
+        switch (accuracy) {
+        case MA_DOUBLE:
+            clog<MA_DOUBLE> (z.real(), z.imag(), re, im);
+            return std::complex<long double> (re, im);
+        case MA_FAST:
+            clog<MA_FAST> (z.real(), z.imag(), re, im);
+            return std::complex<long double> (re, im);
+        default:
+            return std::log (z);
+        }
+    }
+};
+
+#endif
@@ -6,6 +6,19 @@
 
 using namespace std;
 
+// Names of the functions which can be used in equations, paired with their IDs
+static const pair<string, FUNCTION_ID> FUNCTION_NAMES[] = {
+    {"abs", FN_ABS},
+    {"conj", FN_CONJ},
+    {"sqr", FN_SQR},
+    {"re", FN_RE},
+    {"im", FN_IM},
+    {"exp", FN_EXP},
+    {"log", FN_LOG},
+    {"sin", FN_SIN},
+    {"cos", FN_COS}
+};
+
 /**
  * @brief Clean whitespace out of the input string
  * 
@@ -18,6 +31,26 @@ string HFractalEquationParser::epClean (string s) {
     return ret_val;
 }
 
+/**
+ * @brief Check if a function name followed by an opening bracket starts at a given position in the string
+ * 
+ * @param s Input string
+ * @param index Position to check
+ * @param name_length Output for the length of the function name, not including the bracket
+ * @return The FUNCTION_ID of the matched function, or '\0' if there is none
+ */
+char HFractalEquationParser::epMatchFunction (string s, int index, int &name_length) {
+    for (auto function : FUNCTION_NAMES) {
+        int length = function.first.length();
+        if (s.compare (index, length, function.first) == 0 && index+length < s.length() && s[index+length] == '(') {
+            name_length = length;
+            return function.second;
+        }
+    }
+    name_length = 0;
+    return '\0';
+}
+
 /**
  * @brief Check that the input string is valid for the HFractalEquation parser to analyse. Checks for the following and returns an enum value accordingly:
  * 
@@ -28,14 +61,26 @@ string HFractalEquationParser::epClean (string s) {
  * 4 - Floating point error: '.46', '34.'
  * 5 - Unsupported character error: '$', 'd', or any other character not accounted for
  * 
+ * Function names (e.g. 'abs') are accepted when immediately followed by an opening bracket
+ * 
  * @param s Input string
  * @return Either the reference of the first error detected or SUCCESS if no error is found
  */
 EP_CHECK_STATUS HFractalEquationParser::epCheck (string s) {
     int bracket_depth = 0;
     char c_last = '\0';
-    int index = 0;
-    for (char c : s) {
+    for (int index = 0; index < s.length(); index++) {
+        char c = s[index];
+
+        // Skip over function names, leaving their opening bracket to be checked as normal
+        int name_length = 0;
+        if (epMatchFunction (s, index, name_length) != '\0') {
+            if (c_last == '.') return FPOINT_ERROR;
+            index += name_length-1;
+            c_last = s[index];
+            continue;
+        }
+
         switch (c) {
         case '(':
             bracket_depth++;
@@ -89,7 +134,6 @@ EP_CHECK_STATUS HFractalEquationParser::epCheck (string s) {
         }
         
         c_last = c;
-        index++;
         if (bracket_depth < 0) return BRACKET_ERROR;
     }
 
@@ -109,13 +153,17 @@ vector<IntermediateToken> HFractalEquationParser::epTokenise (string s) {
     int current_token_type = -1;
     bool is_last_run = false;
     bool is_singular_token = false; // Informs the program whether the token is a single-char token
+    char current_function = '\0'; // Function ID of the current token, if it is a function call
 
     for (int i = 0; i < s.length(); i++) {
         char current_char = s[i];
         int char_token_type = -1;
+        int name_length = 0;
+        char function_id = epMatchFunction (s, i, name_length);
         
         // Decide the type of the current character
-        switch (current_char) {
+        if (function_id != '\0') char_token_type = 10;
+        else switch (current_char) {
         case '0':
         case '1':
         case '2':
@@ -191,6 +239,12 @@ vector<IntermediateToken> HFractalEquationParser::epTokenise (string s) {
                 case 5:
                     token.type = INT_BRACKET;
                     token.bracket_val = epTokenise (current_token);
+                    break;
+                case 10:
+                    token.type = INT_FUNCTION;
+                    token.op_val = current_function;
+                    token.bracket_val = epTokenise (current_token);
+                    break;
                 default:
                     break;
                 }
@@ -198,12 +252,16 @@ vector<IntermediateToken> HFractalEquationParser::epTokenise (string s) {
             }
             current_token = "";
             current_token_type = char_token_type;
+            current_function = function_id;
 
             if (is_last_run) break;
         }
 
+        // Skip over function names to their opening bracket
+        if (char_token_type == 10) i += name_length;
+
         // Jump automatically to the end of the brackets, recursively processing their contents
-        if (char_token_type == 5) {
+        if (char_token_type == 5 || char_token_type == 10) {
             int bracket_depth = 1;
             int end = -1;
             for (int j = i+1; j < s.length(); j++) {
@@ -218,8 +276,8 @@ vector<IntermediateToken> HFractalEquationParser::epTokenise (string s) {
             current_token += s[i];
         }
 
-        // Mark a, b, c, x, y, z, and i as singular
-        if ((char_token_type >= 1 && char_token_type <= 3) || (char_token_type >= 6 && char_token_type <= 9)) {
+        // Mark a, b, c, x, y, z, i, and function calls as singular
+        if ((char_token_type >= 1 && char_token_type <= 3) || (char_token_type >= 6 && char_token_type <= 10)) {
             is_singular_token = true;
         }
 
@@ -272,8 +330,8 @@ vector<IntermediateToken> HFractalEquationParser::epFixImplicitMul (vector<Inter
         IntermediateToken t1 = result[i];
         IntermediateToken t2 = result[i+1];
 
-        // Fix implicit multiplication within brackets
-        if (t1.type == INT_BRACKET) {
+        // Fix implicit multiplication within brackets and function arguments
+        if (t1.type == INT_BRACKET || t1.type == INT_FUNCTION) {
             result[i].bracket_val = epFixImplicitMul (t1.bracket_val);
             t1 = result[i];
         }
@@ -297,7 +355,7 @@ vector<IntermediateToken> HFractalEquationParser::epFixImplicitMul (vector<Inter
     }
 
     IntermediateToken last = result[result.size()-1];
-    if (last.type == INT_BRACKET) {
+    if (last.type == INT_BRACKET || last.type == INT_FUNCTION) {
         last.bracket_val = epFixImplicitMul (last.bracket_val);
         result[result.size()-1] = last;
     }
@@ -313,9 +371,9 @@ vector<IntermediateToken> HFractalEquationParser::epFixImplicitMul (vector<Inter
  */
 vector<IntermediateToken> HFractalEquationParser::epSimplifyBidmas (vector<IntermediateToken> token_vec, bool first_half) {
     vector<IntermediateToken> result = token_vec;
-    // Recurse down brackets
+    // Recurse down brackets and function arguments
     for (int i = 0; i < result.size(); i++) {
-        if (result[i].type == INT_BRACKET) {
+        if (result[i].type == INT_BRACKET || result[i].type == INT_FUNCTION) {
             result[i].bracket_val = epSimplifyBidmas (result[i].bracket_val, first_half);
         }
     }
@@ -336,8 +394,8 @@ vector<IntermediateToken> HFractalEquationParser::epSimplifyBidmas (vector<Inter
 
     // Search and replace each sequentially
     for (char c : ops) {
-        for (int t_ind = 0; t_ind < result.size()-2; t_ind++) {
-            if (t_ind >= result.size()-2) {
+        for (int t_ind = 0; t_ind < (int)result.size()-2; t_ind++) {
+            if (t_ind >= (int)result.size()-2) {
                 break;
             }
             if (result[t_ind+1].type == INT_OPERATION && result[t_ind+1].op_val == c) {
@@ -384,6 +442,15 @@ vector<Token> HFractalEquationParser::epReversePolishConvert (vector<Intermediat
             if (current_intermediate_token.type == INT_BRACKET) {
                 vector<Token> inner_result = epReversePolishConvert (current_intermediate_token.bracket_val);
                 output.insert (output.end(), inner_result.begin(), inner_result.end());
+            } else if (current_intermediate_token.type == INT_FUNCTION) {
+                // Functions are applied after their argument has been evaluated
+                vector<Token> inner_result = epReversePolishConvert (current_intermediate_token.bracket_val);
+                output.insert (output.end(), inner_result.begin(), inner_result.end());
+                output.push_back ({
+                    .type = FUNCTION,
+                    .num_val = 0,
+                    .other_val = current_intermediate_token.op_val
+                });
             } else {
                 output.push_back ({
                     .type = (TOKEN_TYPE)current_intermediate_token.type,
@@ -428,5 +495,10 @@ HFractalEquation* HFractalEquationParser::extractEquation (string sequ) {
 
     vector<Token> reverse_polish_expression = epReversePolishConvert (expression);
 
-    return new HFractalEquation (reverse_polish_expression);
+    HFractalEquation *equation = new HFractalEquation (reverse_polish_expression);
+    if (!equation->isValid()) {
+        delete equation;
+        return NULL;
+    }
+    return equation;
 }
\ No newline at end of file
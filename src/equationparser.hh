@@ -13,7 +13,8 @@ enum INTERMEDIATE_TOKEN_TYPE {
     INT_NUMBER,
     INT_LETTER,
     INT_OPERATION,
-    INT_BRACKET
+    INT_BRACKET,
+    INT_FUNCTION
 };
 
 // Struct describing the token for the intermediate parser
@@ -21,8 +22,8 @@ struct IntermediateToken {
     INTERMEDIATE_TOKEN_TYPE type;
     double num_val;
     char let_val;
-    char op_val;
-    std::vector<IntermediateToken> bracket_val;
+    char op_val; // Operation character, or FUNCTION_ID for function tokens
+    std::vector<IntermediateToken> bracket_val; // Contents of a bracket, or the argument of a function
 };
 
 // Enum describing the error types from the equation processor checking function
@@ -39,6 +40,7 @@ enum EP_CHECK_STATUS {
 class HFractalEquationParser {
 private:
     static std::string epClean (std::string); // Preprocess the string to remove whitespace
+    static char epMatchFunction (std::string, int, int &); // Check if a function call starts at a position in the string
     static EP_CHECK_STATUS epCheck (std::string); // Check for formatting errors in the equation (such as mismatched brackets)
     static std::vector<IntermediateToken> epTokenise (std::string); // Split the string into intermediate tokens
     static std::vector<IntermediateToken> epFixImplicitMul (std::vector<IntermediateToken>); // Remove implicit multiplication
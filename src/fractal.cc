@@ -2,8 +2,8 @@
 
 #include "fractal.hh"
 
-#include <stack>
 #include <complex>
+#include <cmath>
 
 #include "utils.hh"
 
@@ -31,74 +31,471 @@ void HFractalEquation::setPreset (int i) {
 }
 
 /**
- * @brief Parse the Reverse Polish notation Token vector and evaluate the mathematical expression it represents
+ * @brief Set the accuracy used for complex exponentials, logarithms and powers, recompiling custom equations to use it.
+ * Anything other than MA_PRECISE computes these at double precision with in-project functions, and raises complex values to integer powers by repeated multiplication, both of which are much faster but not bit-identical to the standard library
  * 
- * @param z Current value of the z variable to feed in
- * @param c Current value of the c variable to feed in
- * @return Complex number with the value of the evaluated equation
+ * @param a Accuracy to use
+ */
+void HFractalEquation::setAccuracy (MATH_ACCURACY a) {
+    accuracy = a;
+    if (is_compiled) {
+        compile ();
+        hoistInvariants ();
+    }
+}
+
+/**
+ * @brief Get a string uniquely identifying the computation performed by this equation, so that differently written but identical equations (e.g. with extra whitespace) can be recognised
+ * 
+ * @return The postfix token sequence written out as a string, prefixed with the preset ID if one is in use
+ */
+string HFractalEquation::getCanonicalForm () {
+    string form = is_preset ? "preset" + to_string (preset) + ":" : "";
+    if (accuracy != MA_PRECISE) form += "accuracy" + to_string (accuracy) + ":";
+    if (hasInteriorDetection()) form += "interior:";
+    char buffer[32];
+    for (Token t : reverse_polish_vector) {
+        if (t.type == NUMBER) {
+            // Write numbers in hexadecimal so they are exact
+            snprintf (buffer, sizeof(buffer), "%a", t.num_val);
+            form += buffer;
+        } else {
+            form += t.other_val;
+        }
+        form += ' ';
+    }
+    return form;
+}
+
+/**
+ * @brief Detect a symmetry of the image this equation produces, so that only part of it needs computing.
+ * Custom equations whose coefficients are all real (i.e. which never use i, b, y or im()) commute with complex conjugation, and start from z = c, so the value at conj(c) is always the conjugate of the value at c
+ * 
+ * @return The symmetry of the image, or SYM_NONE if none was found
+ */
+SYMMETRY HFractalEquation::getSymmetry () {
+    if (is_preset) {
+        switch (preset) {
+        case EQ_MANDELBROT:
+        case EQ_RECIPROCAL:
+        case EQ_ZPOWER:
+        case EQ_BARS:
+            return SYM_CONJUGATE;
+        case EQ_JULIA_1:
+        case EQ_JULIA_2:
+            // z^2 gives the same value for z and -z, so after the first iteration both orbits are identical
+            return SYM_POINT;
+        default:
+            return SYM_NONE;
+        }
+    }
+    for (Token t : reverse_polish_vector) {
+        if (t.type == LETTER && (t.other_val == 'i' || t.other_val == 'b' || t.other_val == 'y')) return SYM_NONE;
+        if (t.type == FUNCTION && t.other_val == FN_IM) return SYM_NONE;
+    }
+    return SYM_CONJUGATE;
+}
+
+/**
+ * @brief Check whether this equation is the Mandelbrot preset or one of the Julia presets, all of the form z^2 + k, whose derivative is tracked for distance estimates and whose cycles can be checked for interior detection
+ * 
+ * @return True for the quadratic presets, false otherwise
+ */
+bool HFractalEquation::isQuadraticPreset () {
+    return is_preset && (preset == EQ_MANDELBROT || preset == EQ_JULIA_1 || preset == EQ_JULIA_2);
+}
+
+/**
+ * @brief Check whether interior detection is enabled and applies to this equation. Only the Mandelbrot preset has an interior to detect,
+ * the constants of the Julia presets lie outside the Mandelbrot set, so none of their orbits settle into an attracting cycle
+ * 
+ * @return True if evaluations should check for attracting cycles, false otherwise
  */
-complex<long double> HFractalEquation::compute (complex<long double> z, complex<long double> c) {    
-    stack<complex<long double>> value_stack;
+bool HFractalEquation::hasInteriorDetection () {
+    return interior_detection && is_preset && preset == EQ_MANDELBROT;
+}
+
+/**
+ * @brief Compile the Reverse Polish notation Token vector into a sequence of instructions.
+ * The type of every intermediate value is inferred as it is compiled, so that operations on values which are always real (such as `x`, `b`, or real constants) use real arithmetic rather than complex arithmetic.
+ * Raising a real value to a constant integer power, or a non-negative real value to the power 0.5, is compiled into repeated multiplication or a square root respectively.
+ * If the accuracy is not MA_PRECISE, complex values raised to constant integer powers also use repeated multiplication
+ * 
+ * @return True if the tokens formed a valid expression, false otherwise
+ */
+bool HFractalEquation::compile () {
+    instructions.clear();
+    max_stack = 0;
+
+    // Mirror the runtime value stack, recording the type of each value and the index of the instruction which pushed it if it is a constant (-1 otherwise)
+    vector<VALUE_TYPE> type_stack;
+    vector<int> const_stack;
 
     for (Token t : reverse_polish_vector) {
+        Instruction ins = {.op = INS_CONST, .const_val = 0, .int_val = 0};
+        VALUE_TYPE type = VT_COMPLEX;
+        bool is_const = false;
+
         if (t.type == NUMBER) {
-            // Push number arguments onto the stack
-            value_stack.push (t.num_val);
+            ins.const_val = t.num_val;
+            type = t.num_val >= 0 ? VT_NONNEG_REAL : VT_REAL;
+            is_const = true;
         } else if (t.type == LETTER) {
-            // Select based on letter and swap in the letter's value, before pushing it onto the stack
             switch (t.other_val) {
-            case 'z':
-                value_stack.push (z);
-                break;
-            case 'c':
-                value_stack.push (c);
-                break;
-            case 'a':
-                value_stack.push (c.real());
+            case 'z': ins.op = INS_Z; break;
+            case 'c': ins.op = INS_C; break;
+            case 'a': ins.op = INS_A; type = VT_REAL; break;
+            case 'b': ins.op = INS_B; type = VT_REAL; break;
+            case 'x': ins.op = INS_X; type = VT_REAL; break;
+            case 'y': ins.op = INS_Y; type = VT_REAL; break;
+            case 'i': ins.const_val = complex<long double> (0,1); is_const = true; break;
+            default: return false;
+            }
+        } else if (t.type == OPERATION) {
+            if (type_stack.size() < 2) return false;
+            VALUE_TYPE t2 = type_stack.back(); type_stack.pop_back();
+            VALUE_TYPE t1 = type_stack.back(); type_stack.pop_back();
+            int k2 = const_stack.back(); const_stack.pop_back();
+            const_stack.pop_back();
+            bool r1 = t1 != VT_COMPLEX;
+            bool r2 = t2 != VT_COMPLEX;
+            bool nonneg = t1 == VT_NONNEG_REAL && t2 == VT_NONNEG_REAL;
+            // Offset from the RR variant of an operation to the variant matching the operand types
+            int variant = (r1 ? 0 : 2) + (r2 ? 0 : 1);
+            type = (r1 && r2) ? VT_REAL : VT_COMPLEX;
+
+            switch (t.other_val) {
+            case '+':
+                ins.op = (INSTRUCTION_OP)(INS_ADD_RR + variant);
+                if (nonneg) type = VT_NONNEG_REAL;
                 break;
-            case 'b':
-                value_stack.push (c.imag());
+            case '-':
+                ins.op = (INSTRUCTION_OP)(INS_SUB_RR + variant);
                 break;
-            case 'x':
-                value_stack.push (z.real());
+            case '*':
+                ins.op = (INSTRUCTION_OP)(INS_MUL_RR + variant);
+                if (nonneg) type = VT_NONNEG_REAL;
                 break;
-            case 'y':
-                value_stack.push (z.imag());
+            case '/':
+                ins.op = (INSTRUCTION_OP)(INS_DIV_RR + variant);
+                if (nonneg) type = VT_NONNEG_REAL;
                 break;
-            case 'i':
-                value_stack.push (complex<long double> (0,1));
+            case '^': {
+                // Check for a constant real exponent, which allows cheaper special cases
+                bool const_exponent = k2 != -1 && instructions[k2].const_val.imag() == 0;
+                long double exponent = instructions[k2 != -1 ? k2 : 0].const_val.real();
+                if (r1 && const_exponent && exponent == floorl (exponent) && fabsl (exponent) <= 64) {
+                    // Real to an integer power, the exponent is folded into the instruction
+                    instructions.pop_back();
+                    ins.op = INS_POW_RI;
+                    ins.int_val = (int)exponent;
+                    type = (t1 == VT_NONNEG_REAL || ins.int_val%2 == 0) ? VT_NONNEG_REAL : VT_REAL;
+                } else if (t1 == VT_NONNEG_REAL && const_exponent && exponent == 0.5) {
+                    // Square root of a non-negative real
+                    instructions.pop_back();
+                    ins.op = INS_SQRT_R;
+                    type = VT_NONNEG_REAL;
+                } else if (t1 == VT_NONNEG_REAL && r2) {
+                    ins.op = INS_POW_RR;
+                    type = VT_NONNEG_REAL;
+                } else if (accuracy != MA_PRECISE && const_exponent && exponent == floorl (exponent) && fabsl (exponent) <= 64) {
+                    // Complex to an integer power, which differs from std::pow by rounding error only
+                    instructions.pop_back();
+                    ins.op = INS_POW_CI;
+                    ins.int_val = (int)exponent;
+                    type = VT_COMPLEX;
+                } else {
+                    // Anything else may produce a complex result, e.g. a negative number to the power 0.5
+                    ins.op = INS_POW_CC;
+                    ins.int_val = accuracy;
+                    type = VT_COMPLEX;
+                }
                 break;
+            }
             default:
-                break;
+                return false;
             }
-        } else if (t.type == OPERATION) {
-            // Perform an actual computation based on an operation token
-            complex<long double> v2 = value_stack.top(); value_stack.pop();
-            complex<long double> v1 = value_stack.top(); value_stack.pop();
+        } else if (t.type == FUNCTION) {
+            if (type_stack.size() < 1) return false;
+            VALUE_TYPE t1 = type_stack.back(); type_stack.pop_back();
+            const_stack.pop_back();
+            bool r1 = t1 != VT_COMPLEX;
+
+            // Select the cheapest variant for the operand type, some functions do nothing to certain types
+            bool is_noop = false;
             switch (t.other_val) {
-            case '^':
-                value_stack.push (pow (v1, v2));
+            case FN_ABS:
+                is_noop = t1 == VT_NONNEG_REAL;
+                ins.op = r1 ? INS_ABS_R : INS_ABS_C;
+                type = VT_NONNEG_REAL;
                 break;
-            case '/':
-                value_stack.push (v1/v2);
+            case FN_CONJ:
+                is_noop = r1;
+                ins.op = INS_CONJ;
+                type = t1;
                 break;
-            case '*':
-                value_stack.push (v1*v2);
+            case FN_SQR:
+                ins.op = r1 ? INS_SQR_R : INS_SQR_C;
+                type = r1 ? VT_NONNEG_REAL : VT_COMPLEX;
                 break;
-            case '+':
-                value_stack.push (v1+v2);
+            case FN_RE:
+                is_noop = r1;
+                ins.op = INS_RE;
+                type = r1 ? t1 : VT_REAL;
                 break;
-            case '-':
-                value_stack.push (v1-v2);
+            case FN_IM:
+                ins.op = INS_IM;
+                type = r1 ? VT_NONNEG_REAL : VT_REAL;
+                break;
+            case FN_EXP:
+                ins.op = r1 ? INS_EXP_R : INS_EXP_C;
+                ins.int_val = accuracy;
+                type = r1 ? VT_NONNEG_REAL : VT_COMPLEX;
+                break;
+            case FN_LOG:
+                // Only the logarithm of a non-negative real is real
+                ins.op = t1 == VT_NONNEG_REAL ? INS_LOG_R : INS_LOG_C;
+                ins.int_val = accuracy;
+                type = t1 == VT_NONNEG_REAL ? VT_REAL : VT_COMPLEX;
+                break;
+            case FN_SIN:
+                ins.op = r1 ? INS_SIN_R : INS_SIN_C;
+                type = r1 ? VT_REAL : VT_COMPLEX;
+                break;
+            case FN_COS:
+                ins.op = r1 ? INS_COS_R : INS_COS_C;
+                type = r1 ? VT_REAL : VT_COMPLEX;
                 break;
             default:
+                return false;
+            }
+
+            if (is_noop) {
+                type_stack.push_back (type);
+                const_stack.push_back (-1);
+                continue;
+            }
+        } else {
+            return false;
+        }
+
+        instructions.push_back (ins);
+        type_stack.push_back (type);
+        const_stack.push_back (is_const ? (int)instructions.size()-1 : -1);
+        if ((int)type_stack.size() > max_stack) max_stack = type_stack.size();
+    }
+
+    // A valid expression leaves exactly one value on the stack
+    return type_stack.size() == 1;
+}
+
+/**
+ * @brief Get the number of values an instruction pops from the stack before pushing its result
+ * 
+ * @param op Instruction operation
+ * @return Number of operands
+ */
+int HFractalEquation::operandCount (INSTRUCTION_OP op) {
+    if (op >= INS_ADD_RR && op <= INS_POW_CC) return 2;
+    if (op >= INS_POW_RI && op <= INS_COS_C) return 1;
+    return 0;
+}
+
+/**
+ * @brief Split the compiled instructions into a prologue, run once per pixel, and a body, run on every iteration.
+ * Any subexpression which does not depend on z (i.e. only uses c, a, b and constants) gives the same value on every iteration, so the largest such subexpressions are computed by the prologue and stored in slots which the body loads from
+ * 
+ */
+void HFractalEquation::hoistInvariants () {
+    prologue.clear();
+    num_slots = 0;
+    if (instructions.empty()) return;
+
+    // For each instruction, find the index of the first instruction of the subexpression it completes, and whether that subexpression is invariant
+    vector<int> start (instructions.size());
+    vector<bool> invariant (instructions.size());
+    for (int i = 0; i < (int)instructions.size(); i++) {
+        INSTRUCTION_OP op = instructions[i].op;
+        int first = i;
+        bool is_invariant = !(op == INS_Z || op == INS_X || op == INS_Y);
+        // Walk back over each operand's subexpression
+        for (int operand = 0; operand < operandCount (op); operand++) {
+            is_invariant = is_invariant && invariant[first-1];
+            first = start[first-1];
+        }
+        start[i] = first;
+        invariant[i] = is_invariant;
+    }
+
+    vector<Instruction> body;
+    emitHoisted (instructions.size()-1, start, invariant, body);
+    instructions = body;
+}
+
+/**
+ * @brief Recursively emit the subexpression ending at an instruction into the body. If the subexpression is invariant and more than a single instruction, it is emitted into the prologue instead and replaced with a load
+ * 
+ * @param end Index of the last instruction of the subexpression
+ * @param start Index of the first instruction of the subexpression ending at each instruction
+ * @param invariant Whether the subexpression ending at each instruction is invariant
+ * @param body Instruction sequence to append to
+ */
+void HFractalEquation::emitHoisted (int end, const vector<int> &start, const vector<bool> &invariant, vector<Instruction> &body) {
+    if (invariant[end] && start[end] != end) {
+        // Compute the whole subexpression once in the prologue
+        prologue.insert (prologue.end(), instructions.begin()+start[end], instructions.begin()+end+1);
+        prologue.push_back ({.op = INS_STORE, .const_val = 0, .int_val = num_slots});
+        body.push_back ({.op = INS_LOAD, .const_val = 0, .int_val = num_slots});
+        num_slots++;
+        return;
+    }
+
+    // Emit each operand's subexpression in order, followed by the instruction itself
+    vector<int> operand_ends;
+    int operand_end = end-1;
+    for (int operand = 0; operand < operandCount (instructions[end].op); operand++) {
+        operand_ends.insert (operand_ends.begin(), operand_end);
+        operand_end = start[operand_end]-1;
+    }
+    for (int e : operand_ends) emitHoisted (e, start, invariant, body);
+    body.push_back (instructions[end]);
+}
+
+/**
+ * @brief Raise a real number to an integer power using repeated squaring, which is exact for small powers such as squaring
+ * 
+ * @param x Base
+ * @param n Integer exponent
+ * @return x to the power of n
+ */
+long double HFractalEquation::realPowInt (long double x, int n) {
+    long double result = 1;
+    unsigned int m = n < 0 ? -n : n;
+    while (m != 0) {
+        if (m & 1) result *= x;
+        x *= x;
+        m >>= 1;
+    }
+    return n < 0 ? 1/result : result;
+}
+
+/**
+ * @brief Run a sequence of compiled instructions. Real values are held on the stack with a zero imaginary part
+ * 
+ * @param program Instructions to run
+ * @param z Current value of the z variable to feed in
+ * @param c Current value of the c variable to feed in
+ * @param value_stack Buffer to use as the value stack, which must hold at least max_stack values
+ * @param slots Buffer holding values computed once per pixel, which must hold at least num_slots values
+ * @return Complex number left on top of the stack, if any
+ */
+complex<long double> HFractalEquation::execute (const vector<Instruction> &program, complex<long double> z, complex<long double> c, complex<long double> *value_stack, complex<long double> *slots) {
+    int top = -1;
+    for (const Instruction &ins : program) {
+        switch (ins.op) {
+        // Instructions pushing values onto the stack
+        case INS_CONST: value_stack[++top] = ins.const_val; break;
+        case INS_Z: value_stack[++top] = z; break;
+        case INS_C: value_stack[++top] = c; break;
+        case INS_X: value_stack[++top] = z.real(); break;
+        case INS_Y: value_stack[++top] = z.imag(); break;
+        case INS_A: value_stack[++top] = c.real(); break;
+        case INS_B: value_stack[++top] = c.imag(); break;
+        // Instructions combining the top two values on the stack
+        case INS_ADD_RR: top--; value_stack[top] = value_stack[top].real() + value_stack[top+1].real(); break;
+        case INS_ADD_RC: top--; value_stack[top] = value_stack[top].real() + value_stack[top+1]; break;
+        case INS_ADD_CR: top--; value_stack[top] = value_stack[top] + value_stack[top+1].real(); break;
+        case INS_ADD_CC: top--; value_stack[top] = value_stack[top] + value_stack[top+1]; break;
+        case INS_SUB_RR: top--; value_stack[top] = value_stack[top].real() - value_stack[top+1].real(); break;
+        case INS_SUB_RC: top--; value_stack[top] = value_stack[top].real() - value_stack[top+1]; break;
+        case INS_SUB_CR: top--; value_stack[top] = value_stack[top] - value_stack[top+1].real(); break;
+        case INS_SUB_CC: top--; value_stack[top] = value_stack[top] - value_stack[top+1]; break;
+        case INS_MUL_RR: top--; value_stack[top] = value_stack[top].real() * value_stack[top+1].real(); break;
+        case INS_MUL_RC: top--; value_stack[top] = value_stack[top].real() * value_stack[top+1]; break;
+        case INS_MUL_CR: top--; value_stack[top] = value_stack[top] * value_stack[top+1].real(); break;
+        case INS_MUL_CC: top--; value_stack[top] = value_stack[top] * value_stack[top+1]; break;
+        case INS_DIV_RR: top--; value_stack[top] = value_stack[top].real() / value_stack[top+1].real(); break;
+        case INS_DIV_RC: top--; value_stack[top] = value_stack[top].real() / value_stack[top+1]; break;
+        case INS_DIV_CR: top--; value_stack[top] = value_stack[top] / value_stack[top+1].real(); break;
+        case INS_DIV_CC: top--; value_stack[top] = value_stack[top] / value_stack[top+1]; break;
+        case INS_POW_RR: top--; value_stack[top] = pow (value_stack[top].real(), value_stack[top+1].real()); break;
+        case INS_POW_CC: top--; value_stack[top] = HFractalComplexMath::pow (value_stack[top], value_stack[top+1], (MATH_ACCURACY)ins.int_val); break;
+        // Instructions with the exponent folded in, modifying only the top value on the stack
+        case INS_POW_RI: value_stack[top] = realPowInt (value_stack[top].real(), ins.int_val); break;
+        case INS_POW_CI: value_stack[top] = HFractalComplexMath::powInt (value_stack[top], ins.int_val); break;
+        case INS_SQRT_R: value_stack[top] = sqrt (value_stack[top].real()); break;
+        // Instructions applying a function to the top value on the stack
+        case INS_ABS_R: value_stack[top] = fabsl (value_stack[top].real()); break;
+        case INS_ABS_C: {
+            complex<long double> v = value_stack[top];
+            value_stack[top] = sqrtl ((v.real()*v.real()) + (v.imag()*v.imag()));
+            break;
+        }
+        case INS_CONJ: value_stack[top] = complex<long double> (value_stack[top].real(), -value_stack[top].imag()); break;
+        case INS_SQR_R: value_stack[top] = value_stack[top].real() * value_stack[top].real(); break;
+        case INS_SQR_C: {
+            complex<long double> v = value_stack[top];
+            value_stack[top] = complex<long double> ((v.real()*v.real()) - (v.imag()*v.imag()), 2*v.real()*v.imag());
+            break;
+        }
+        case INS_RE: value_stack[top] = value_stack[top].real(); break;
+        case INS_IM: value_stack[top] = value_stack[top].imag(); break;
+        case INS_EXP_R: value_stack[top] = expl (value_stack[top].real()); break;
+        case INS_EXP_C: {
+            complex<long double> v = value_stack[top];
+            if (ins.int_val != MA_PRECISE) {
+                value_stack[top] = HFractalComplexMath::exp (v, (MATH_ACCURACY)ins.int_val);
                 break;
             }
+            long double magnitude = expl (v.real());
+            value_stack[top] = complex<long double> (magnitude*cosl (v.imag()), magnitude*sinl (v.imag()));
+            break;
+        }
+        case INS_LOG_R: value_stack[top] = logl (value_stack[top].real()); break;
+        case INS_LOG_C: {
+            complex<long double> v = value_stack[top];
+            if (ins.int_val != MA_PRECISE) {
+                value_stack[top] = HFractalComplexMath::log (v, (MATH_ACCURACY)ins.int_val);
+                break;
+            }
+            value_stack[top] = complex<long double> (0.5*logl ((v.real()*v.real()) + (v.imag()*v.imag())), atan2l (v.imag(), v.real()));
+            break;
+        }
+        case INS_SIN_R: value_stack[top] = sinl (value_stack[top].real()); break;
+        case INS_SIN_C: {
+            complex<long double> v = value_stack[top];
+            value_stack[top] = complex<long double> (sinl (v.real())*coshl (v.imag()), cosl (v.real())*sinhl (v.imag()));
+            break;
+        }
+        case INS_COS_R: value_stack[top] = cosl (value_stack[top].real()); break;
+        case INS_COS_C: {
+            complex<long double> v = value_stack[top];
+            value_stack[top] = complex<long double> (cosl (v.real())*coshl (v.imag()), -sinl (v.real())*sinhl (v.imag()));
+            break;
+        }
+        // Instructions moving values between the stack and per pixel slots
+        case INS_STORE: slots[ins.int_val] = value_stack[top--]; break;
+        case INS_LOAD: value_stack[++top] = slots[ins.int_val]; break;
+        default: break;
         }
     }
 
     // Return the final value
-    return value_stack.top();
+    return top >= 0 ? value_stack[top] : 0;
+}
+
+/**
+ * @brief Evaluate the compiled expression for a single set of z and c values
+ * 
+ * @param z Current value of the z variable to feed in
+ * @param c Current value of the c variable to feed in
+ * @return Complex number with the value of the evaluated equation
+ */
+complex<long double> HFractalEquation::compute (complex<long double> z, complex<long double> c) {
+    vector<complex<long double>> value_stack (max_stack);
+    vector<complex<long double>> slots (num_slots);
+    execute (prologue, z, c, value_stack.data(), slots.data());
+    return execute (instructions, z, c, value_stack.data(), slots.data());
 }
 
 /**
@@ -109,49 +506,298 @@ complex<long double> HFractalEquation::compute (complex<long double> z, complex<
  * @return Integer representing the number of iterations performed before the number tended to infinity, or the limit if this was reached first
  */
 int HFractalEquation::evaluate (complex<long double> c, int limit) {
-    complex<long double> last = c;
+    complex<long double> last = initialValue (c);
+    return evaluate (c, last, 0, limit);
+}
+
+/**
+ * @brief Get the value z should take before the first iteration for a given coordinate
+ * 
+ * @param c Coordinate in the complex plane being evaluated
+ * @return The initial value of z
+ */
+complex<long double> HFractalEquation::initialValue (complex<long double> c) {
     if (is_preset && preset == EQ_BURNINGSHIP_MODIFIED) {
-        last = complex<long double> (0, 0);
+        return complex<long double> (0, 0);
     }
+    return c;
+}
 
-    int depth = 0;
+/**
+ * @brief Perform a single iteration of a preset equation. The preset is a template parameter so that loops over several iterations contain no switch
+ * 
+ * @param last Value of z from the previous iteration
+ * @param c Coordinate in the complex plane being evaluated
+ * @param c_squared Precomputed value of c*c
+ * @param accuracy Accuracy of complex powers
+ * @return The next value of z
+ */
+template <int PRESET> static inline complex<long double> iteratePreset (complex<long double> last, complex<long double> c, complex<long double> c_squared, MATH_ACCURACY accuracy) {
+    switch (PRESET) {
+    case EQ_MANDELBROT:
+        return (last*last)+c;
+    case EQ_JULIA_1:
+        return (last*last)+complex<long double>(0.285, 0.01);
+    case EQ_JULIA_2:
+        return (last*last)-complex<long double>(0.70176, 0.3842);
+    case EQ_RECIPROCAL:
+        return complex<long double>(1,0)/((last*last)+c);
+    case EQ_ZPOWER:
+        return HFractalComplexMath::pow(last,last,accuracy)+c-complex<long double>(0.5, 0);
+    case EQ_BARS:
+        return HFractalComplexMath::pow(last, c_squared, accuracy);
+    case EQ_BURNINGSHIP_MODIFIED:
+        if (accuracy != MA_PRECISE) {
+            // Square by multiplication rather than std::pow
+            return complex<long double>((last.real()*last.real()) - (last.imag()*last.imag()), -2*abs(last.real())*abs(last.imag()))+c;
+        }
+        return pow ((complex<long double>(abs(last.real()),0) - complex<long double>(0, abs(last.imag()))),2)+c;
+    default:
+        return last;
+    }
+}
+
+/**
+ * @brief Check whether a value may have escaped. Unlike isInfinity, NaN counts as escaped, since a value which escaped part way through a block may become NaN by the end of it
+ * 
+ * @param comp Complex number to check
+ * @return False if the value is certainly bounded
+ */
+static inline bool mayHaveEscaped (complex<long double> comp) {
+    return !((comp.real()*comp.real()) + (comp.imag()*comp.imag()) <= (long double)4);
+}
+
+/**
+ * @brief Repeatedly apply a single iteration step until the value escapes or the limit is reached.
+ * The step is a template parameter so that each preset gets its own loop, with nothing but the equation inside it.
+ * If PERMANENT_ESCAPE is true, the equation is known to never return to |z| <= 2 once it has left (as for z^2+c), so unrolled blocks only check the value at the end of the block.
+ * Otherwise every iteration is checked, but the results are combined without branching
+ * 
+ * @param step Function performing one iteration, mapping the last value of z to the next
+ * @param z Value of z reached so far, updated in place with the last value computed
+ * @param depth Number of iterations already performed to reach `z`
+ * @param limit Limit for the number of iterations
+ * @param unrolled Whether to run blocks of ITERATION_BLOCK iterations between escape checks
+ * @return Number of iterations performed before escaping, or the limit
+ */
+template <bool PERMANENT_ESCAPE, typename STEP> static inline int iterateUntilEscape (STEP step, complex<long double> &z, int depth, int limit, bool unrolled) {
+    complex<long double> last = z;
     while (depth < limit) {
-        // Switch between custom parsing mode and preset mode for more efficient computing of presets
-        if (!is_preset) {
-            last = compute (last, c); // Slow custom compute
-        } else {
-            // Much faster hard coded computation
-            switch (preset) {
-            case EQ_MANDELBROT:
-                last = (last*last)+c;
-                break;
-            case EQ_JULIA_1:
-                last = (last*last)+complex<long double>(0.285, 0.01);
-                break;
-            case EQ_JULIA_2:
-                last = (last*last)-complex<long double>(0.70176, 0.3842);
-                break;
-            case EQ_RECIPROCAL:
-                last = complex<long double>(1,0)/((last*last)+c);
-                break;
-            case EQ_ZPOWER:
-                last = pow(last,last)+c-complex<long double>(0.5, 0);
-                break;
-            case EQ_BARS:
-                last = pow(last, c*c);
-                break;
-            case EQ_BURNINGSHIP_MODIFIED:
-                last = pow ((complex<long double>(abs(last.real()),0) - complex<long double>(0, abs(last.imag()))),2)+c;
-                break;
-            default:
-                break;
+        if (unrolled && limit-depth >= ITERATION_BLOCK) {
+            // Run a whole block without branching on escape
+            complex<long double> block_start = last;
+            bool escaped = false;
+            for (int i = 0; i < ITERATION_BLOCK; i++) {
+                last = step (last);
+                if (!PERMANENT_ESCAPE) escaped |= mayHaveEscaped (last);
+            }
+            if (PERMANENT_ESCAPE) escaped = mayHaveEscaped (last);
+            if (!escaped) {
+                depth += ITERATION_BLOCK;
+                continue;
+            }
+            // Roll back and replay the block one iteration at a time to find exactly where it escaped
+            last = block_start;
+            bool b = false;
+            for (int i = 0; i < ITERATION_BLOCK && !b; i++) {
+                last = step (last);
+                depth++;
+                b = HFractalEquation::isInfinity (last);
             }
+            if (b) break;
+            continue;
         }
+        last = step (last);
         depth++;
         // Check if the value has tended to infinity, and escape the loop if so
-        bool b = isInfinity (last);
+        bool b = HFractalEquation::isInfinity (last);
         if (b) break;
     }
+    z = last;
+    return depth;
+}
+
+/**
+ * @brief Continue evaluating a complex coordinate from a known state, i.e. a z value which was reached after a number of iterations.
+ * Produces exactly the same result as if the evaluation had not been interrupted.
+ * In unrolled mode, iterations are run in blocks of ITERATION_BLOCK with a single escape check per block, and a block which escaped is rolled back and replayed one iteration at a time, so the result is identical
+ * With interior detection enabled, the quadratic presets are evaluated by evaluateInterior instead
+ * 
+ * @param c Coordinate in the complex plane being evaluated
+ * @param z Value of z reached so far, updated in place with the last value computed
+ * @param depth Number of iterations already performed to reach `z`
+ * @param limit Limit for the number of iterations to compute before giving up, if the number does not tend to infinity
+ * @return Integer representing the number of iterations performed before the number tended to infinity, or the limit if this was reached first
+ */
+int HFractalEquation::evaluate (complex<long double> c, complex<long double> &z, int depth, int limit) {
+    // Switch between custom parsing mode and preset mode for more efficient computing of presets
+    if (!is_preset) {
+        // Allocate the value stack once, rather than on every iteration, and compute the values which are the same on every iteration
+        vector<complex<long double>> value_stack (max_stack);
+        vector<complex<long double>> slots (num_slots);
+        execute (prologue, z, c, value_stack.data(), slots.data());
+        auto step = [&](complex<long double> last) { return execute (instructions, last, c, value_stack.data(), slots.data()); }; // Slow custom compute
+        return iterateUntilEscape<false> (step, z, depth, limit, unrolled);
+    }
+    // Much faster hard coded computation
+    if (hasInteriorDetection()) return evaluateInterior (c, z, depth, limit);
+    complex<long double> c_squared = c*c;
+    MATH_ACCURACY a = accuracy;
+    switch (preset) {
+    case EQ_MANDELBROT: return iterateUntilEscape<true> ([&](complex<long double> last) { return iteratePreset<EQ_MANDELBROT> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_JULIA_1: return iterateUntilEscape<true> ([&](complex<long double> last) { return iteratePreset<EQ_JULIA_1> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_JULIA_2: return iterateUntilEscape<true> ([&](complex<long double> last) { return iteratePreset<EQ_JULIA_2> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_RECIPROCAL: return iterateUntilEscape<false> ([&](complex<long double> last) { return iteratePreset<EQ_RECIPROCAL> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_ZPOWER: return iterateUntilEscape<false> ([&](complex<long double> last) { return iteratePreset<EQ_ZPOWER> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_BARS: return iterateUntilEscape<false> ([&](complex<long double> last) { return iteratePreset<EQ_BARS> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    case EQ_BURNINGSHIP_MODIFIED: return iterateUntilEscape<true> ([&](complex<long double> last) { return iteratePreset<EQ_BURNINGSHIP_MODIFIED> (last, c, c_squared, a); }, z, depth, limit, unrolled);
+    default: return iterateUntilEscape<false> ([&](complex<long double> last) { return last; }, z, depth, limit, unrolled);
+    }
+}
+
+/**
+ * @brief Find the constant k added on each iteration of a quadratic preset, z^2 + k
+ * 
+ * @param preset Preset in use
+ * @param c Coordinate in the complex plane being evaluated
+ * @param k_re Output for the real part of k
+ * @param k_im Output for the imaginary part of k
+ */
+static inline void quadraticConstant (int preset, complex<long double> c, long double &k_re, long double &k_im) {
+    complex<long double> k = c;
+    if (preset == EQ_JULIA_1) k = complex<long double> (0.285, 0.01);
+    if (preset == EQ_JULIA_2) k = -complex<long double> (0.70176, 0.3842);
+    k_re = k.real();
+    k_im = k.imag();
+}
+
+/**
+ * @brief Perform one iteration of z^2 + k. Components are kept separately, as std::complex multiplication checks for infinities on every product,
+ * but z is computed exactly as std::complex squares it, so iteration counts match evaluate
+ * 
+ * @param z_re Real part of z, updated in place
+ * @param z_im Imaginary part of z, updated in place
+ * @param k_re Real part of k
+ * @param k_im Imaginary part of k
+ */
+static inline void quadraticStep (long double &z_re, long double &z_im, long double k_re, long double k_im) {
+    long double next_re = (z_re*z_re) - (z_im*z_im) + k_re;
+    z_im = (z_re*z_im) + (z_im*z_re) + k_im;
+    z_re = next_re;
+}
+
+/**
+ * @brief Perform one iteration of z^2 + k along with its derivative, dz' = 2z dz + dk, computing z exactly as the version without the derivative does
+ * 
+ * @param z_re Real part of z, updated in place
+ * @param z_im Imaginary part of z, updated in place
+ * @param dz_re Real part of the derivative, updated in place
+ * @param dz_im Imaginary part of the derivative, updated in place
+ * @param k_re Real part of k
+ * @param k_im Imaginary part of k
+ * @param dk Derivative of k, 1 for dz/dc of the Mandelbrot set, 0 for dz/dz0 of Julia sets
+ */
+static inline void quadraticStep (long double &z_re, long double &z_im, long double &dz_re, long double &dz_im, long double k_re, long double k_im, long double dk) {
+    long double next_dz_re = (2*((z_re*dz_re) - (z_im*dz_im))) + dk;
+    dz_im = 2*((z_re*dz_im) + (z_im*dz_re));
+    dz_re = next_dz_re;
+    quadraticStep (z_re, z_im, k_re, k_im);
+}
+
+/**
+ * @brief Evaluate a complex coordinate as in evaluate, while tracking the derivative of z with respect to the starting value, dz/dc for the Mandelbrot set and dz/dz0 for Julia sets.
+ * Once the value escapes, a lower bound for the distance from the coordinate to the boundary of the set is estimated from |z| and the derivative, after running a few extra iterations so that |z| is large enough for the estimate to be accurate.
+ * The iteration count returned is identical to evaluate
+ * 
+ * @param c Coordinate in the complex plane to initialise with
+ * @param limit Limit for the number of iterations to compute before giving up
+ * @param distance Output for the estimated distance to the boundary in the complex plane, or -1 if there is no estimate because the coordinate did not escape or the equation is not supported
+ * @return Integer representing the number of iterations performed before the number tended to infinity, or the limit if this was reached first
+ */
+int HFractalEquation::evaluateDistance (complex<long double> c, int limit, long double &distance) {
+    distance = -1;
+    if (!hasDistanceEstimate()) return evaluate (c, limit);
+    // Julia sets add a constant rather than c, and their derivative has no +1 term
+    long double k_re, k_im;
+    quadraticConstant (preset, c, k_re, k_im);
+    long double dk = preset == EQ_MANDELBROT ? 1 : 0;
+    complex<long double> z = initialValue (c);
+    long double z_re = z.real(), z_im = z.imag();
+    long double dz_re = 1, dz_im = 0;
+    int depth = 0;
+    bool escaped = false;
+    while (depth < limit && !escaped) {
+        quadraticStep (z_re, z_im, dz_re, dz_im, k_re, k_im, dk);
+        depth++;
+        escaped = (z_re*z_re) + (z_im*z_im) > (long double)4;
+    }
+    if (!escaped) return depth;
+    for (int i = 0; i < DISTANCE_EXTRA_ITERATIONS && (z_re*z_re) + (z_im*z_im) < (long double)DISTANCE_BAILOUT*DISTANCE_BAILOUT; i++) quadraticStep (z_re, z_im, dz_re, dz_im, k_re, k_im, dk);
+    // The estimate |z| ln |z| / |dz| is within a factor of two of the true distance either way, so halve it for a lower bound
+    long double mod_z = sqrtl ((z_re*z_re) + (z_im*z_im));
+    distance = 0.5*mod_z*logl (mod_z)/sqrtl ((dz_re*dz_re) + (dz_im*dz_im));
+    return depth;
+}
+
+/**
+ * @brief Check whether z lies on a cycle of z^2 + k which attracts nearby orbits, by following the cycle for one period from z and requiring its multiplier, the product of 2z over the cycle, to have a magnitude below 1.
+ * The magnitude is accumulated as a sum of logarithms, as the product of a long cycle can overflow or underflow part way round
+ * 
+ * @param z_re Real part of a value on the cycle
+ * @param z_im Imaginary part of a value on the cycle
+ * @param k_re Real part of k
+ * @param k_im Imaginary part of k
+ * @param period Number of iterations after which the orbit returns to z
+ * @return True if the cycle is attracting, false otherwise
+ */
+bool HFractalEquation::isAttractingCycle (long double z_re, long double z_im, long double k_re, long double k_im, int period) {
+    long double log_multiplier = 0;
+    for (int i = 0; i < period; i++) {
+        log_multiplier += logl (4*((z_re*z_re) + (z_im*z_im)));
+        quadraticStep (z_re, z_im, k_re, k_im);
+    }
+    return log_multiplier < 0;
+}
+
+/**
+ * @brief Continue evaluating a complex coordinate of a quadratic preset as in evaluate, checking whether the orbit has settled into an attracting cycle, in which case the point is reported as bounded straight away.
+ * Each value is compared against a reference value taken from earlier in the orbit, which is replaced after INTERIOR_CHECK_WINDOW iterations, then twice as many, and so on. Once the orbit returns to within INTERIOR_PERIOD_TOLERANCE of the reference,
+ * the number of iterations since the reference was taken is a candidate period, and the cycle through the current value is accepted only if isAttractingCycle finds its multiplier below 1.
+ * This catches points which converge slowly, which would otherwise run all the way to the limit. Points which escape give identical results to evaluate. When continuing from a stored state, the reference starts again from the stored z
+ * 
+ * @param c Coordinate in the complex plane being evaluated
+ * @param z Value of z reached so far, updated in place with the last value computed
+ * @param depth Number of iterations already performed to reach `z`
+ * @param limit Limit for the number of iterations
+ * @return Integer representing the number of iterations performed before the number tended to infinity, or the limit if this was reached first or the point was detected as interior
+ */
+int HFractalEquation::evaluateInterior (complex<long double> c, complex<long double> &z, int depth, int limit) {
+    long double k_re, k_im;
+    quadraticConstant (preset, c, k_re, k_im);
+    long double z_re = z.real(), z_im = z.imag();
+    long double ref_re = z_re, ref_im = z_im;
+    int ref_depth = depth;
+    int window = INTERIOR_CHECK_WINDOW;
+    long double tolerance = (long double)INTERIOR_PERIOD_TOLERANCE*INTERIOR_PERIOD_TOLERANCE;
+    while (depth < limit) {
+        quadraticStep (z_re, z_im, k_re, k_im);
+        depth++;
+        if ((z_re*z_re) + (z_im*z_im) > (long double)4) break;
+        long double d_re = z_re - ref_re, d_im = z_im - ref_im;
+        if (depth < limit && (d_re*d_re) + (d_im*d_im) < tolerance && isAttractingCycle (z_re, z_im, k_re, k_im, depth - ref_depth)) {
+            interior_exits++;
+            depth = limit;
+            break;
+        }
+        // Replace the reference once the window has passed, doubling the window so longer periods can be found
+        if (depth - ref_depth >= window) {
+            ref_re = z_re;
+            ref_im = z_im;
+            ref_depth = depth;
+            window *= 2;
+        }
+    }
+    z = complex<long double> (z_re, z_im);
     return depth;
 }
 
@@ -162,6 +808,8 @@ int HFractalEquation::evaluate (complex<long double> c, int limit) {
  */
 HFractalEquation::HFractalEquation (vector<Token> rp_vec) {
     reverse_polish_vector = rp_vec;
+    is_compiled = compile ();
+    if (is_compiled) hoistInvariants ();
 }
 
 /**
@@ -5,12 +5,41 @@
 
 #include <complex>
 #include <vector>
+#include <string>
+#include <atomic>
+
+#include "complexmath.hh"
+
+// Number of iterations run between escape checks when evaluating in unrolled mode
+#define ITERATION_BLOCK 8
+// Radius z must pass before a distance estimate is taken, since estimates taken just past the escape radius of 2 are inaccurate
+#define DISTANCE_BAILOUT 1000
+// Largest number of extra iterations run after escaping to reach DISTANCE_BAILOUT
+#define DISTANCE_EXTRA_ITERATIONS 16
+// When interior detection is enabled, an orbit which returns to within this distance of an earlier value is checked for an attracting cycle
+#define INTERIOR_PERIOD_TOLERANCE 1e-12
+// Number of iterations an orbit is compared against the same earlier value before that value is replaced, doubling each time so cycles of any period are found
+#define INTERIOR_CHECK_WINDOW 8
 
 // Enum describing the token type
 enum TOKEN_TYPE {
     NUMBER,
     LETTER,
-    OPERATION
+    OPERATION,
+    FUNCTION
+};
+
+// Enum describing the functions which can be applied to a value in an equation, stored in a function token's other_val
+enum FUNCTION_ID {
+    FN_ABS = 'A',
+    FN_CONJ = 'J',
+    FN_SQR = 'S',
+    FN_RE = 'R',
+    FN_IM = 'I',
+    FN_EXP = 'E',
+    FN_LOG = 'L',
+    FN_SIN = 'N',
+    FN_COS = 'O'
 };
 
 // Struct describing the token
@@ -20,20 +49,119 @@ struct Token {
     char other_val;
 };
 
+// Enum describing the type of value produced by part of an equation, inferred when the equation is compiled
+enum VALUE_TYPE {
+    VT_COMPLEX,
+    VT_REAL,
+    VT_NONNEG_REAL // Real, and known never to be negative
+};
+
+// Enum describing the operations making up a compiled equation. Suffixes give the operand types, R for real and C for complex
+enum INSTRUCTION_OP {
+    INS_CONST,
+    INS_Z,
+    INS_C,
+    INS_X,
+    INS_Y,
+    INS_A,
+    INS_B,
+    INS_ADD_RR, INS_ADD_RC, INS_ADD_CR, INS_ADD_CC,
+    INS_SUB_RR, INS_SUB_RC, INS_SUB_CR, INS_SUB_CC,
+    INS_MUL_RR, INS_MUL_RC, INS_MUL_CR, INS_MUL_CC,
+    INS_DIV_RR, INS_DIV_RC, INS_DIV_CR, INS_DIV_CC,
+    INS_POW_RR, // Non-negative real raised to a real power
+    INS_POW_CC,
+    INS_POW_RI, // Real raised to a constant integer power
+    INS_POW_CI, // Complex raised to a constant integer power, only used when approximate results are allowed
+    INS_SQRT_R, // Non-negative real raised to the power of 0.5
+    INS_ABS_R, INS_ABS_C,
+    INS_CONJ,
+    INS_SQR_R, INS_SQR_C,
+    INS_RE,
+    INS_IM,
+    INS_EXP_R, INS_EXP_C,
+    INS_LOG_R, INS_LOG_C, // Real variant requires a non-negative operand
+    INS_SIN_R, INS_SIN_C,
+    INS_COS_R, INS_COS_C,
+    INS_STORE, // Pop the top value into a slot holding a value computed once per pixel
+    INS_LOAD // Push the value held in a slot
+};
+
+// Enum describing a symmetry of the image produced by an equation
+enum SYMMETRY {
+    SYM_NONE,
+    SYM_CONJUGATE, // Symmetric about the real axis, as the equation commutes with complex conjugation
+    SYM_POINT // Symmetric under c -> -c, as with Julia sets of z^2+k
+};
+
+// Struct describing a single instruction of a compiled equation
+struct Instruction {
+    INSTRUCTION_OP op;
+    std::complex<long double> const_val; // Value pushed by INS_CONST
+    int int_val; // Exponent used by INS_POW_RI and INS_POW_CI, slot used by INS_STORE and INS_LOAD, or accuracy used by INS_POW_CC, INS_EXP_C and INS_LOG_C
+};
+
 // Class holding the equation and providing functions to evaluate it
 class HFractalEquation {
 private:
-    static bool isInfinity (std::complex<long double> comp); // Check if a complex number has exceeded the 'infinity' threshold
     std::vector<Token> reverse_polish_vector; // Sequence of equation tokens in postfix form
+    std::vector<Instruction> instructions; // Sequence of instructions compiled from the postfix tokens, operating on a value stack, run on every iteration
+    std::vector<Instruction> prologue; // Sequence of instructions computing values which do not depend on z, run once per pixel
+    int max_stack = 0; // Largest number of values the instructions ever hold on the stack
+    int num_slots = 0; // Number of values computed by the prologue
+    bool is_compiled = false; // Records whether the tokens were successfully compiled
+    MATH_ACCURACY accuracy = MA_PRECISE; // Accuracy of complex exponentials, logarithms and powers
+    bool unrolled = false; // Whether iterations are run in blocks, checking for escape once per block
+    bool interior_detection = false; // Whether points whose orbit settles into an attracting cycle are treated as bounded without iterating to the limit
+    std::atomic<long> interior_exits {0}; // Number of evaluations ended early by interior detection
+
+    bool compile (); // Compile the postfix tokens into instructions, inferring which values are real to use cheaper arithmetic
+    void hoistInvariants (); // Move parts of the compiled instructions which do not depend on z into the prologue
+    void emitHoisted (int, const std::vector<int> &, const std::vector<bool> &, std::vector<Instruction> &); // Emit part of the instructions, moving invariant parts into the prologue
+    static std::complex<long double> execute (const std::vector<Instruction> &, std::complex<long double>, std::complex<long double>, std::complex<long double> *, std::complex<long double> *); // Run a sequence of compiled instructions using preallocated stack and slot buffers
+    static long double realPowInt (long double, int); // Raise a real number to an integer power by repeated multiplication
 
     bool is_preset = false; // Records whether this equation is using an equation preset
     int preset = -1; // Records the equation preset being used, if none, set to -1
 
 public:
+    static bool isInfinity (std::complex<long double> comp); // Check if a complex number has exceeded the 'infinity' threshold
+    static int operandCount (INSTRUCTION_OP); // Get the number of values an instruction pops from the stack
+
+    bool isValid () { return is_compiled; } // Check if the equation was compiled successfully
+
+    bool getIsPreset () { return is_preset; } // Inline methods to get the preset in use, and the compiled instructions, for evaluators outside this class
+    int getPreset () { return preset; }
+    const std::vector<Instruction> &getInstructions () { return instructions; }
+    const std::vector<Instruction> &getPrologue () { return prologue; }
+    int getMaxStack () { return max_stack; }
+    int getNumSlots () { return num_slots; }
+
     void setPreset (int); // Set this equation to be a preset, identified numerically
 
+    MATH_ACCURACY getAccuracy () { return accuracy; } // Get the accuracy of complex exponentials, logarithms and powers
+    void setAccuracy (MATH_ACCURACY); // Set the accuracy of complex exponentials, logarithms and powers
+
+    bool getUnrolled () { return unrolled; } // Inline methods to get/set whether iterations are run in blocks between escape checks
+    void setUnrolled (bool u_) { unrolled = u_; }
+    bool getInteriorDetection () { return interior_detection; } // Inline methods to get/set whether evaluations end early for points detected as interior
+    void setInteriorDetection (bool id_) { interior_detection = id_; }
+    bool hasInteriorDetection (); // Check if interior detection is enabled and applies to this equation
+    long getInteriorExits () { return interior_exits; } // Inline methods to get/reset the number of evaluations ended early by interior detection
+    void resetInteriorExits () { interior_exits = 0; }
+    void addInteriorExits (long n) { interior_exits += n; }
+    std::string getCanonicalForm (); // Get a string which uniquely identifies the computation this equation performs
+    SYMMETRY getSymmetry (); // Detect a symmetry of the image this equation produces
+    bool isQuadraticPreset (); // Check if this equation is one of the z^2 + k presets, whose derivative and cycles can be tracked
+    bool hasDistanceEstimate () { return isQuadraticPreset(); } // Check if evaluateDistance can estimate distances for this equation
+    static bool isAttractingCycle (long double, long double, long double, long double, int); // Check whether z lies on a cycle of z^2 + k of a given period which attracts nearby orbits
+
     std::complex<long double> compute (std::complex<long double>, std::complex<long double>); // Perform a single calculation using the equation and the specified z and c values
+    std::complex<long double> initialValue (std::complex<long double>); // Get the starting value of z for a given c value
     int evaluate (std::complex<long double>, int); // Perform the fractal calculation 
+    int evaluate (std::complex<long double>, std::complex<long double> &, int, int); // Continue the fractal calculation from a previously reached z value and depth
+    int evaluateDistance (std::complex<long double>, int, long double &); // Perform the fractal calculation, also estimating the distance to the boundary of the set
+    int evaluateInterior (std::complex<long double>, std::complex<long double> &, int, int); // Continue the fractal calculation, ending early if the point is detected as interior
 
     HFractalEquation (std::vector<Token>); // Initialise with a sequence of equation tokens
     HFractalEquation (); // Base initialiser
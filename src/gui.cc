@@ -117,6 +117,7 @@ void HFractalGui::configureGUI(char* path) {
     // Initialise rendering environment
     lowres_hm = new HFractalMain();
     hm = new HFractalMain();
+    tile_cache = new HFractalTileCache(TILE_CACHE_DEFAULT_BUDGET);
 
     // Configure full resolution renderer
     hm->setResolution (image_dimension);
@@ -126,6 +127,8 @@ void HFractalGui::configureGUI(char* path) {
     hm->setZoom (start_zoom);
     hm->setOffsetX (start_x_offset);
     hm->setOffsetY (start_y_offset);
+    hm->setKeepState (true);
+    hm->setTileCache (tile_cache);
 
     // Configure preivew renderer
     lowres_hm->setResolution (128);
@@ -135,6 +138,11 @@ void HFractalGui::configureGUI(char* path) {
     lowres_hm->setZoom (start_zoom);
     lowres_hm->setOffsetX (start_x_offset);
     lowres_hm->setOffsetY (start_y_offset);
+    lowres_hm->setKeepState (true);
+    lowres_hm->setTileCache (tile_cache);
+    lowres_hm->setRenderStrategy (RS_WAVEFRONT);
+    lowres_hm->setAccuracy (MA_FAST);
+    lowres_hm->setDoubleLanes (true);
 }
 
 /**
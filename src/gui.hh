@@ -90,6 +90,7 @@ private:
 
     HFractalMain* hm; // Pointer to main rendering environment
     HFractalMain* lowres_hm; // Pointer to an identical rendering environment, but with a lower resolution for preview renders
+    HFractalTileCache* tile_cache; // Pointer to the cache of rendered tiles shared by both rendering environments
 
     std::string dialog_text; // Text to show in the text dialog widget
     std::string console_text; // Text to show in the application console
@@ -6,6 +6,8 @@
 #include <iomanip>
 #include <chrono>
 #include <thread>
+#include <cstring>
+#include <algorithm>
 
 #include "utils.hh"
 
@@ -17,26 +19,11 @@ using namespace std::chrono;
  * 
  */
 void HFractalMain::threadMain () {
-    // Pre-compute constants to increase performance
-    long double p = 2/(zoom*resolution);
-    long double q = (1/zoom)-offset_x;
-    long double r = (1/zoom)+offset_y;
-
-    // Get the next unrendered pixel
-    int next = img->getUncompleted();
+    // Get the next unrendered tile
+    int next = img->getUncompletedTile();
     while (next != -1) {
-        // Find the x and y coordinates based on the pixel index
-        int x = next%resolution;
-        int y = next/resolution;
-        // Apply the mathematical transformation of offsets and zoom to find a and b, which form a coordinate pair representing this pixel in the complex plane
-        long double a = (p*x) - q;
-        long double b = r - (p*y);
-        // Construct the initial coordinate value, and perform the evaluation on the main equation
-        complex<long double> c = complex<long double> (a,b);
-        int res = (main_equation->evaluate (c, eval_limit));
-        // Set the result back into the image class, and get the next available unrendered pixel
-        img->set (x, y, res);
-        next = img->getUncompleted();
+        renderTile (next);
+        next = img->getUncompletedTile();
     }
     
     // When there appear to be no more pixels to compute, mark this thread as completed
@@ -49,32 +36,773 @@ void HFractalMain::threadMain () {
 }
 
 /**
- * @brief Generate a fractal image based on all the environment parameters
+ * @brief Render every pixel in a tile of the image. If a tile cache is in use, the tile is copied from there when available, and stored there once computed
+ * 
+ * @param tile Index of the tile to render
+ */
+void HFractalMain::renderTile (int tile) {
+    // Pre-compute constants to increase performance. When rendering in bands, rows of the image are offset from rows of the full view
+    long double p = 2/(zoom*resolution);
+    long double q = (1/zoom)-offset_x;
+    long double r = (1/zoom)+offset_y-(p*band_y);
+
+    int tile_x, tile_y, tile_w, tile_h;
+    img->getTileBounds (tile, tile_x, tile_y, tile_w, tile_h);
+
+    // Check the cache for a tile rendered with identical parameters. Double lanes and boundary tracing give slightly different results, so are cached separately
+    bool use_double = useDoubleLanes ();
+    string prefix = use_double ? "double:" : "";
+    if (useBoundaryTrace()) prefix = "trace:";
+    if (useAdaptive()) prefix = "adaptive:";
+    string key;
+    vector<uint16_t> values (tile_w*tile_h);
+    int64_t lattice_x, lattice_y;
+    long double phase_x, phase_y;
+    if (tile_cache != NULL && getLatticeOrigin (p, q, r, lattice_x, lattice_y, phase_x, phase_y)) {
+        key = HFractalTileCache::makeKey (prefix + main_equation->getCanonicalForm(), eval_limit, p, phase_x, phase_y, lattice_x+tile_x, lattice_y+tile_y, tile_w, tile_h);
+        if (tile_cache->fetch (key, values.data(), tile_w*tile_h)) {
+            // Pixels mirroring another are filled in when their mirror is set, which may be from another tile, so writing them here would race with that copy
+            for (int y = 0; y < tile_h; y++) {
+                for (int x = 0; x < tile_w; x++) {
+                    if (isMirrored (tile_x+x, tile_y+y)) continue;
+                    img->set (tile_x+x, tile_y+y, values[(y*tile_w)+x]);
+                    copyToMirror (tile_x+x, tile_y+y);
+                }
+            }
+            return;
+        }
+    }
+
+    if (use_intervals) {
+        HFractalIntervalEvaluator evaluator (main_equation);
+        renderRegionByInterval (tile_x, tile_y, tile_w, tile_h, p, q, r, use_double, evaluator);
+    } else {
+        renderRegion (tile_x, tile_y, tile_w, tile_h, p, q, r, use_double);
+    }
+
+    // Store the finished tile for later reuse, unless some of its pixels are still waiting to be mirrored from another tile
+    if (!key.empty()) {
+        bool has_mirrored = false;
+        for (int y = tile_y; y < tile_y+tile_h && !has_mirrored; y++) {
+            for (int x = tile_x; x < tile_x+tile_w && !has_mirrored; x++) has_mirrored = isMirrored (x, y);
+        }
+        if (has_mirrored) return;
+        img->getTile (tile_x, tile_y, tile_w, tile_h, values.data());
+        tile_cache->store (key, values.data(), tile_w*tile_h);
+    }
+}
+
+/**
+ * @brief Find where the top-left pixel of the image lies on the global lattice of pixels at the image's spacing, counted from the origin of the complex plane. Views panned by whole pixels place the same points at the same lattice indices
+ * 
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ * @param lattice_x Output for the global column of the top-left pixel
+ * @param lattice_y Output for the global row of the top-left pixel
+ * @param phase_x Output for the horizontal offset of the pixels from the lattice, as a fraction of a pixel
+ * @param phase_y Output for the vertical offset of the pixels from the lattice, as a fraction of a pixel
+ * @return True for success, false if the view is too far from the origin for its lattice indices to be represented
+ */
+bool HFractalMain::getLatticeOrigin (long double p, long double q, long double r, int64_t &lattice_x, int64_t &lattice_y, long double &phase_x, long double &phase_y) {
+    long double origin_x = -q/p;
+    long double origin_y = -r/p;
+    if (!(fabsl (origin_x) < 1e18L) || !(fabsl (origin_y) < 1e18L)) return false;
+    lattice_x = llroundl (origin_x);
+    lattice_y = llroundl (origin_y);
+    phase_x = origin_x - lattice_x;
+    phase_y = origin_y - lattice_y;
+    return true;
+}
+
+/**
+ * @brief Shift the grid of tiles in the image so that tiles start at multiples of TILE_SIZE on the global pixel lattice, so that views panned by any whole number of pixels fetch the same tiles from the cache. Only done when a tile cache is in use, so that other renders keep their usual grid
+ * 
+ */
+void HFractalMain::alignTiles () {
+    long double p = 2/(zoom*resolution);
+    long double q = (1/zoom)-offset_x;
+    long double r = (1/zoom)+offset_y-(p*band_y);
+    int64_t lattice_x, lattice_y;
+    long double phase_x, phase_y;
+    if (tile_cache == NULL || !getLatticeOrigin (p, q, r, lattice_x, lattice_y, phase_x, phase_y)) return;
+    img->setTileOrigin ((int)(-(lattice_x%TILE_SIZE)), (int)(-(lattice_y%TILE_SIZE)));
+}
+
+/**
+ * @brief Render every pixel in a rectangular region of the image, which may be a whole tile or part of one, using the current render strategy
+ * 
+ * @param tile_x Horizontal coordinate of the region's top left pixel
+ * @param tile_y Vertical coordinate of the region's top left pixel
+ * @param tile_w Width of the region
+ * @param tile_h Height of the region
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ * @param use_double Whether wavefront rendering should use double lanes
+ */
+void HFractalMain::renderRegion (int tile_x, int tile_y, int tile_w, int tile_h, long double p, long double q, long double r, bool use_double) {
+    if (render_strategy == RS_WAVEFRONT) {
+        if (use_double) renderTileWavefront<double> (tile_x, tile_y, tile_w, tile_h, p, q, r);
+        else renderTileWavefront<long double> (tile_x, tile_y, tile_w, tile_h, p, q, r);
+    } else if (useBoundaryTrace()) {
+        renderTileBoundaryTrace (tile_x, tile_y, tile_w, tile_h, p, q, r);
+    } else if (useAdaptive()) {
+        renderTileAdaptive (tile_x, tile_y, tile_w, tile_h, p, q, r);
+    } else {
+        for (int y = tile_y; y < tile_y+tile_h; y++) {
+            for (int x = tile_x; x < tile_x+tile_w; x++) {
+                // Pixels mirroring another are filled in when their mirror is computed
+                if (isMirrored (x, y)) continue;
+                // Pixels lying exactly on a pixel of the reference render take its value
+                if (copyFromReference (x, y)) {
+                    copyToMirror (x, y);
+                    continue;
+                }
+                // Apply the mathematical transformation of offsets and zoom to find a and b, which form a coordinate pair representing this pixel in the complex plane
+                long double a = (p*x) - q;
+                long double b = r - (p*y);
+                // Construct the initial coordinate value, and perform the evaluation on the main equation
+                complex<long double> c = complex<long double> (a,b);
+                int res;
+                if (img->hasState()) res = evaluateWithState (x, y, c);
+                else res = (main_equation->evaluate (c, eval_limit));
+                // Set the result back into the image class
+                img->set (x, y, res);
+                copyToMirror (x, y);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Render every pixel in a tile by iterating them all together with HFractalWavefront. Pixels whose stored state already gives their result are not iterated
+ * 
+ * @param tile_x Horizontal coordinate of the tile's top left pixel
+ * @param tile_y Vertical coordinate of the tile's top left pixel
+ * @param tile_w Width of the tile
+ * @param tile_h Height of the tile
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ */
+template <typename T> void HFractalMain::renderTileWavefront (int tile_x, int tile_y, int tile_w, int tile_h, long double p, long double q, long double r) {
+    HFractalWavefront<T> wavefront (main_equation, tile_w*tile_h);
+    vector<bool> iterated (tile_w*tile_h, false);
+    for (int y = tile_y; y < tile_y+tile_h; y++) {
+        for (int x = tile_x; x < tile_x+tile_w; x++) {
+            if (isMirrored (x, y)) continue;
+            complex<long double> c = complex<long double> ((p*x) - q, r - (p*y));
+            complex<long double> z;
+            int depth = 0;
+            if (img->hasState()) img->getState (x, y, z, depth);
+            if (depth == 0) {
+                z = main_equation->initialValue (c);
+            } else if (HFractalEquation::isInfinity (z) || depth >= eval_limit) {
+                // Already finished, as in evaluateWithState
+                img->set (x, y, min (depth, eval_limit));
+                copyToMirror (x, y);
+                continue;
+            }
+            int index = ((y-tile_y)*tile_w) + (x-tile_x);
+            wavefront.addPixel (index, c, z, depth);
+            iterated[index] = true;
+        }
+    }
+
+    wavefront.run (eval_limit);
+
+    for (int y = tile_y; y < tile_y+tile_h; y++) {
+        for (int x = tile_x; x < tile_x+tile_w; x++) {
+            int index = ((y-tile_y)*tile_w) + (x-tile_x);
+            if (!iterated[index]) continue;
+            int depth = wavefront.getDepth (index);
+            img->set (x, y, depth);
+            if (img->hasState()) img->setState (x, y, wavefront.getZ (index), depth);
+            copyToMirror (x, y);
+        }
+    }
+}
+
+/**
+ * @brief Render every pixel in a tile by boundary tracing. Starting from the edges of the tile, a queue of pixels is processed, and whenever a pixel differs from one of its neighbours, the neighbours are computed and queued in turn.
+ * This follows the boundaries between regions of equal value, leaving the interior of each region uncomputed. The interiors are then filled from the left, row by row.
+ * Regions of equal value are assumed not to contain islands of different values which do not touch their boundary, which holds for escape time fractals away from noise
+ * 
+ * @param tile_x Horizontal coordinate of the tile's top left pixel
+ * @param tile_y Vertical coordinate of the tile's top left pixel
+ * @param tile_w Width of the tile
+ * @param tile_h Height of the tile
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ */
+void HFractalMain::renderTileBoundaryTrace (int tile_x, int tile_y, int tile_w, int tile_h, long double p, long double q, long double r) {
+    // Tiles made up entirely of mirrored pixels are filled in by their mirrors
+    if (isTileMirrored (tile_x, tile_y, tile_w, tile_h)) return;
+
+    vector<int> values (tile_w*tile_h);
+    vector<bool> loaded (tile_w*tile_h, false);
+    vector<bool> queued (tile_w*tile_h, false);
+    vector<int> queue;
+
+    // Compute a pixel of the tile if it has not been already, and return its value
+    auto load = [&](int i) {
+        if (!loaded[i]) {
+            int x = tile_x + (i%tile_w);
+            int y = tile_y + (i/tile_w);
+            complex<long double> c = complex<long double> ((p*x) - q, r - (p*y));
+            values[i] = main_equation->evaluate (c, eval_limit);
+            loaded[i] = true;
+        }
+        return values[i];
+    };
+    auto enqueue = [&](int i) {
+        if (queued[i]) return;
+        queued[i] = true;
+        queue.push_back (i);
+    };
+
+    // Seed the queue with the edges of the tile
+    for (int x = 0; x < tile_w; x++) {
+        enqueue (x);
+        enqueue (((tile_h-1)*tile_w) + x);
+    }
+    for (int y = 0; y < tile_h; y++) {
+        enqueue (y*tile_w);
+        enqueue ((y*tile_w) + tile_w-1);
+    }
+
+    for (size_t head = 0; head < queue.size(); head++) {
+        int i = queue[head];
+        int x = i%tile_w;
+        int y = i/tile_w;
+        int centre = load (i);
+        bool has_l = x > 0, has_r = x < tile_w-1, has_u = y > 0, has_d = y < tile_h-1;
+        // Find which neighbours lie across a boundary, and follow the boundary into them
+        bool l = has_l && load (i-1) != centre;
+        bool r = has_r && load (i+1) != centre;
+        bool u = has_u && load (i-tile_w) != centre;
+        bool d = has_d && load (i+tile_w) != centre;
+        if (l) enqueue (i-1);
+        if (r) enqueue (i+1);
+        if (u) enqueue (i-tile_w);
+        if (d) enqueue (i+tile_w);
+        // Diagonal neighbours are checked too when an adjacent side is a boundary, so that boundaries can turn corners
+        if (has_u && has_l && (u || l)) enqueue (i-tile_w-1);
+        if (has_u && has_r && (u || r)) enqueue (i-tile_w+1);
+        if (has_d && has_l && (d || l)) enqueue (i+tile_w-1);
+        if (has_d && has_r && (d || r)) enqueue (i+tile_w+1);
+    }
+
+    // Fill each region's interior from the pixel to its left, which is always computed or filled already since the left edge is computed
+    for (int y = 0; y < tile_h; y++) {
+        for (int x = 0; x < tile_w; x++) {
+            int i = (y*tile_w) + x;
+            if (!loaded[i]) values[i] = values[i-1];
+            // Pixels mirroring another are filled in when their mirror is set, which may be from another tile
+            if (isMirrored (tile_x+x, tile_y+y)) continue;
+            img->set (tile_x+x, tile_y+y, values[i]);
+            copyToMirror (tile_x+x, tile_y+y);
+        }
+    }
+}
+
+/**
+ * @brief Render a rectangular region of the image, first trying to prove its result with interval arithmetic. The box of coordinates the region covers is iterated as a whole, and if every pixel provably escapes after the same number of iterations, or provably stays bounded, the region is filled with that value without computing any pixel.
+ * Otherwise the region is split into quarters which are tried in turn, down to INTERVAL_MIN_SIZE pixels, below which regions are rendered normally.
+ * Escaped pixels are given a state which has escaped, so that the limit can still be changed incrementally. Bounded pixels are left without state, so they are computed from the start if the limit is raised
+ * 
+ * @param tile_x Horizontal coordinate of the region's top left pixel
+ * @param tile_y Vertical coordinate of the region's top left pixel
+ * @param tile_w Width of the region
+ * @param tile_h Height of the region
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ * @param use_double Whether wavefront rendering should use double lanes
+ * @param evaluator Interval evaluator for the current equation
+ */
+void HFractalMain::renderRegionByInterval (int tile_x, int tile_y, int tile_w, int tile_h, long double p, long double q, long double r, bool use_double, HFractalIntervalEvaluator &evaluator) {
+    if (!evaluator.isSupported()) {
+        renderRegion (tile_x, tile_y, tile_w, tile_h, p, q, r, use_double);
+        return;
+    }
+    if (isTileMirrored (tile_x, tile_y, tile_w, tile_h)) return;
+    // The bottom left and top right pixels have the smallest and largest coordinates
+    complex<long double> c_lo = complex<long double> ((p*tile_x) - q, r - (p*(tile_y+tile_h-1)));
+    complex<long double> c_hi = complex<long double> ((p*(tile_x+tile_w-1)) - q, r - (p*tile_y));
+    int depth;
+    complex<long double> z;
+    BOX_CLASS result = evaluator.classify (c_lo, c_hi, eval_limit, depth, z);
+
+    if (result != BOX_UNKNOWN) {
+        for (int y = tile_y; y < tile_y+tile_h; y++) {
+            for (int x = tile_x; x < tile_x+tile_w; x++) {
+                // Pixels mirroring another are filled in when their mirror is set, which may be from another tile
+                if (isMirrored (x, y)) continue;
+                img->set (x, y, depth);
+                if (img->hasState()) img->setState (x, y, result == BOX_ESCAPES ? z : complex<long double> (0, 0), result == BOX_ESCAPES ? depth : 0);
+                copyToMirror (x, y);
+            }
+        }
+        return;
+    }
+
+    if (tile_w <= INTERVAL_MIN_SIZE || tile_h <= INTERVAL_MIN_SIZE) {
+        renderRegion (tile_x, tile_y, tile_w, tile_h, p, q, r, use_double);
+        return;
+    }
+    int left_w = tile_w/2;
+    int top_h = tile_h/2;
+    renderRegionByInterval (tile_x, tile_y, left_w, top_h, p, q, r, use_double, evaluator);
+    renderRegionByInterval (tile_x+left_w, tile_y, tile_w-left_w, top_h, p, q, r, use_double, evaluator);
+    renderRegionByInterval (tile_x, tile_y+top_h, left_w, tile_h-top_h, p, q, r, use_double, evaluator);
+    renderRegionByInterval (tile_x+left_w, tile_y+top_h, tile_w-left_w, tile_h-top_h, p, q, r, use_double, evaluator);
+}
+
+/**
+ * @brief Render every pixel in a tile, using distance estimates to decide how densely to sample. The tile is split into blocks of ADAPTIVE_BLOCK pixels, and the corners of each block are evaluated first.
+ * If every corner is further from the boundary of the set than the length of the block's diagonal, no part of the set lies in the block, so its interior is interpolated from the corners. Otherwise every pixel in the block is evaluated.
+ * Once the whole tile is evaluated, pixels within ADAPTIVE_SUPERSAMPLE_DISTANCE pixels of the boundary take the average of ADAPTIVE_SUPERSAMPLE squared samples spread across the pixel. Pixels inside the set have no distance estimate,
+ * so they are supersampled when a neighbour in the tile is close enough to the boundary that it may pass through them
+ * 
+ * @param tile_x Horizontal coordinate of the tile's top left pixel
+ * @param tile_y Vertical coordinate of the tile's top left pixel
+ * @param tile_w Width of the tile
+ * @param tile_h Height of the tile
+ * @param p Spacing between pixels in the complex plane
+ * @param q Offset subtracted from the real part of each coordinate
+ * @param r Offset from which the imaginary part of each coordinate is subtracted
+ */
+void HFractalMain::renderTileAdaptive (int tile_x, int tile_y, int tile_w, int tile_h, long double p, long double q, long double r) {
+    // Tiles made up entirely of mirrored pixels are filled in by their mirrors
+    if (isTileMirrored (tile_x, tile_y, tile_w, tile_h)) return;
+
+    vector<int> values (tile_w*tile_h);
+    vector<long double> distances (tile_w*tile_h);
+    vector<bool> exact (tile_w*tile_h, false);
+    long double near = ADAPTIVE_SUPERSAMPLE_DISTANCE*p;
+
+    // Evaluate a pixel of the tile at its centre
+    auto sample = [&](int i) {
+        if (exact[i]) return;
+        int x = tile_x + (i%tile_w);
+        int y = tile_y + (i/tile_w);
+        complex<long double> c = complex<long double> ((p*x) - q, r - (p*y));
+        values[i] = main_equation->evaluateDistance (c, eval_limit, distances[i]);
+        exact[i] = true;
+    };
+
+    for (int block_y = 0; block_y < tile_h; block_y += ADAPTIVE_BLOCK) {
+        for (int block_x = 0; block_x < tile_w; block_x += ADAPTIVE_BLOCK) {
+            int x1 = min (block_x+ADAPTIVE_BLOCK, tile_w)-1;
+            int y1 = min (block_y+ADAPTIVE_BLOCK, tile_h)-1;
+
+            // Evaluate the corners, in the order top left, top right, bottom left, bottom right
+            int corners[4] = { (block_y*tile_w)+block_x, (block_y*tile_w)+x1, (y1*tile_w)+block_x, (y1*tile_w)+x1 };
+            long double diagonal = p*sqrtl ((long double)((x1-block_x)*(x1-block_x)) + ((y1-block_y)*(y1-block_y)));
+            bool far = true;
+            for (int i = 0; i < 4; i++) {
+                sample (corners[i]);
+                far &= distances[corners[i]] > diagonal;
+            }
+
+            for (int y = block_y; y <= y1; y++) {
+                for (int x = block_x; x <= x1; x++) {
+                    int i = (y*tile_w)+x;
+                    if (!far) {
+                        if (!isMirrored (tile_x+x, tile_y+y)) sample (i);
+                        continue;
+                    }
+                    if (exact[i]) continue;
+                    // Bilinear interpolation between the corners. Every pixel lies within half a diagonal of its nearest corner, so is at least half a diagonal from the boundary and never needs supersampling
+                    long double u = x1 > block_x ? (long double)(x-block_x)/(x1-block_x) : 0;
+                    long double v = y1 > block_y ? (long double)(y-block_y)/(y1-block_y) : 0;
+                    long double top = ((1-u)*values[corners[0]]) + (u*values[corners[1]]);
+                    long double bottom = ((1-u)*values[corners[2]]) + (u*values[corners[3]]);
+                    values[i] = (int)llroundl (((1-v)*top) + (v*bottom));
+                }
+            }
+        }
+    }
+
+    // Check whether the boundary may pass through a pixel, from its own distance estimate if it escaped, otherwise from those of its neighbours
+    auto isNear = [&](int x, int y) {
+        int i = (y*tile_w)+x;
+        if (distances[i] >= 0) return distances[i] < near;
+        const int offsets[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+        for (int n = 0; n < 4; n++) {
+            int nx = x+offsets[n][0];
+            int ny = y+offsets[n][1];
+            if (nx < 0 || ny < 0 || nx >= tile_w || ny >= tile_h) continue;
+            int j = (ny*tile_w)+nx;
+            if (exact[j] && distances[j] >= 0 && distances[j] < near+p) return true;
+        }
+        return false;
+    };
+
+    for (int y = 0; y < tile_h; y++) {
+        for (int x = 0; x < tile_w; x++) {
+            // Pixels mirroring another are filled in when their mirror is set, which may be from another tile
+            if (isMirrored (tile_x+x, tile_y+y)) continue;
+            int i = (y*tile_w)+x;
+            int value = values[i];
+            if (exact[i] && isNear (x, y)) {
+                complex<long double> c = complex<long double> ((p*(tile_x+x)) - q, r - (p*(tile_y+y)));
+                long double total = 0;
+                for (int j = 0; j < ADAPTIVE_SUPERSAMPLE; j++) {
+                    for (int k = 0; k < ADAPTIVE_SUPERSAMPLE; k++) {
+                        long double dx = (((k+0.5L)/ADAPTIVE_SUPERSAMPLE) - 0.5L)*p;
+                        long double dy = (((j+0.5L)/ADAPTIVE_SUPERSAMPLE) - 0.5L)*p;
+                        total += main_equation->evaluate (c + complex<long double> (dx, -dy), eval_limit);
+                    }
+                }
+                value = (int)llroundl (total/(ADAPTIVE_SUPERSAMPLE*ADAPTIVE_SUPERSAMPLE));
+            }
+            img->set (tile_x+x, tile_y+y, value);
+            copyToMirror (tile_x+x, tile_y+y);
+        }
+    }
+}
+
+/**
+ * @brief Check whether boundary tracing should be used. Filled pixels are never evaluated, so have no per-pixel evaluation state, and images keeping state are rendered exactly instead
+ * 
+ * @return True if boundary tracing should be used
+ */
+bool HFractalMain::useBoundaryTrace () {
+    return render_strategy == RS_BOUNDARY_TRACE && !img->hasState();
+}
+
+/**
+ * @brief Check whether adaptive rendering should be used. It needs distance estimates from the equation, and does not keep per-pixel evaluation state, so images keeping state are rendered exactly instead
+ * 
+ * @return True if adaptive rendering should be used
+ */
+bool HFractalMain::useAdaptive () {
+    return render_strategy == RS_ADAPTIVE && main_equation->hasDistanceEstimate() && !img->hasState();
+}
+
+/**
+ * @brief Check whether wavefront rendering should use double lanes, which can be vectorised, rather than long double lanes. Double lanes are only used when they have been enabled, as they can change the result of a few pixels, and when pixels are far enough apart for double precision coordinates to represent them accurately
+ * 
+ * @return True if double lanes should be used
+ */
+bool HFractalMain::useDoubleLanes () {
+    return render_strategy == RS_WAVEFRONT && double_lanes && 2/(zoom*resolution) >= WAVEFRONT_DOUBLE_SPACING;
+}
+
+/**
+ * @brief Find whether the view lines up with a symmetry of the equation, i.e. whether the axis or centre of symmetry falls exactly on a pixel or exactly between two pixels, and if so, how pixels map onto their mirrors
+ * 
+ */
+void HFractalMain::setupSymmetry () {
+    symmetry = use_symmetry ? main_equation->getSymmetry() : SYM_NONE;
+    if (symmetry == SYM_NONE) return;
+    // The pixel coordinates of the point 0 are q/p and r/p, so pixel y mirrors pixel 2r/p - y
+    long double p = 2/(zoom*resolution);
+    long double q = (1/zoom)-offset_x;
+    long double r = (1/zoom)+offset_y;
+    long double exact_x = 2*q/p;
+    long double exact_y = 2*r/p;
+    mirror_x = (int)llroundl (exact_x);
+    mirror_y = (int)llroundl (exact_y);
+    bool aligned_x = fabsl (exact_x - mirror_x) < SYMMETRY_TOLERANCE;
+    bool aligned_y = fabsl (exact_y - mirror_y) < SYMMETRY_TOLERANCE;
+    // Only worth using if the axis passes through the image
+    bool inside_y = mirror_y > 0 && mirror_y < 2*resolution-2;
+    bool inside_x = mirror_x > 0 && mirror_x < 2*resolution-2;
+    if (symmetry == SYM_CONJUGATE && !(aligned_y && inside_y)) symmetry = SYM_NONE;
+    if (symmetry == SYM_POINT && !(aligned_x && aligned_y && inside_x && inside_y)) symmetry = SYM_NONE;
+}
+
+/**
+ * @brief Find the pixel which a pixel is mirrored onto by the symmetry in use
+ * 
+ * @param x Horizontal coordinate of the pixel
+ * @param y Vertical coordinate of the pixel
+ * @param mx Output for the horizontal coordinate of the mirror
+ * @param my Output for the vertical coordinate of the mirror
+ * @return True if the mirror lies within the image, false otherwise
+ */
+bool HFractalMain::getMirror (int x, int y, int &mx, int &my) {
+    if (symmetry == SYM_NONE) return false;
+    mx = symmetry == SYM_POINT ? mirror_x-x : x;
+    my = mirror_y-y;
+    return mx >= 0 && mx < resolution && my >= 0 && my < resolution;
+}
+
+/**
+ * @brief Check whether a pixel is filled in by copying from its mirror, rather than being computed. Of each pair of mirrored pixels, the one which comes later in the image is copied
+ * 
+ * @param x Horizontal coordinate of the pixel
+ * @param y Vertical coordinate of the pixel
+ * @return True if the pixel is copied from its mirror
+ */
+bool HFractalMain::isMirrored (int x, int y) {
+    int mx, my;
+    if (!getMirror (x, y, mx, my)) return false;
+    return my < y || (my == y && mx < x);
+}
+
+/**
+ * @brief Check whether every pixel in a tile is filled in by copying from its mirror, in which case the tile needs no computation
+ * 
+ * @param tile_x Horizontal coordinate of the tile's top left pixel
+ * @param tile_y Vertical coordinate of the tile's top left pixel
+ * @param tile_w Width of the tile
+ * @param tile_h Height of the tile
+ * @return True if every pixel is copied from its mirror
+ */
+bool HFractalMain::isTileMirrored (int tile_x, int tile_y, int tile_w, int tile_h) {
+    for (int y = tile_y; y < tile_y+tile_h; y++) {
+        for (int x = tile_x; x < tile_x+tile_w; x++) {
+            if (!isMirrored (x, y)) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Copy the value of a computed pixel, and its evaluation state, into its mirror if the mirror is not computed itself
+ * 
+ * @param x Horizontal coordinate of the computed pixel
+ * @param y Vertical coordinate of the computed pixel
+ */
+void HFractalMain::copyToMirror (int x, int y) {
+    int mx, my;
+    if (!getMirror (x, y, mx, my) || !isMirrored (mx, my)) return;
+    img->set (mx, my, img->get (x, y));
+    if (img->hasState()) {
+        complex<long double> z;
+        int depth;
+        img->getState (x, y, z, depth);
+        // Orbits of conjugate points are conjugate, and orbits of opposite points under point symmetry coincide after the first iteration
+        img->setState (mx, my, symmetry == SYM_CONJUGATE ? conj (z) : z, depth);
+    }
+}
+
+/**
+ * @brief Find how pixels rendered with the current parameters map onto pixels of a finished render. Its values can only be reused if it was rendered per pixel with the same equation, evaluation limit and accuracy, without keeping state
+ * 
+ * @param other The finished render
+ * @param scale Set to the distance in reference pixels between adjacent pixels of the current parameters
+ * @param shift_x Set to the horizontal position in the reference of pixel (0, 0)
+ * @param shift_y Set to the vertical position in the reference of pixel (0, 0)
+ * @return True if the reference's values can be reused
+ */
+bool HFractalMain::getReferenceMapping (HFractalMain *other, long double &scale, long double &shift_x, long double &shift_y) {
+    if (other == NULL || other == this || keep_state || render_strategy != RS_PIXEL) return false;
+    if (other->getIsRendering() || other->img == NULL || other->img_resampled || !other->img->isDone() || other->img->hasState()) return false;
+    if (other->img_eq != eq || other->img_eval_limit != eval_limit || other->img_accuracy != accuracy || other->img_render_strategy != RS_PIXEL || other->img_interior_detection != interior_detection) return false;
+
+    long double p = 2/(zoom*resolution);
+    long double q = (1/zoom)-offset_x;
+    long double r = (1/zoom)+offset_y;
+    long double other_p = 2/(other->img_zoom*other->img_resolution);
+    long double other_q = (1/other->img_zoom)-other->img_offset_x;
+    long double other_r = (1/other->img_zoom)+other->img_offset_y;
+    scale = p/other_p;
+    shift_x = (other_q-q)/other_p;
+    shift_y = (other_r-r)/other_p;
+    return true;
+}
+
+/**
+ * @brief Find the reference pixel a pixel coordinate maps to, along one axis
+ * 
+ * @param v Pixel coordinate in the current render
+ * @param scale Distance in reference pixels between adjacent pixels
+ * @param shift Position in the reference of coordinate 0
+ * @param size Size of the reference along this axis
+ * @param reference_v Set to the reference pixel coordinate
+ * @return True if the coordinate lands within REFERENCE_TOLERANCE of a reference pixel inside the reference
+ */
+bool HFractalMain::alignedPixel (int v, long double scale, long double shift, int size, int &reference_v) {
+    long double mapped = (v*scale) + shift;
+    long double nearest = roundl (mapped);
+    if (fabsl (mapped-nearest) > REFERENCE_TOLERANCE || nearest < 0 || nearest >= size) return false;
+    reference_v = (int)nearest;
+    return true;
+}
+
+/**
+ * @brief Copy a pixel's value from the reference render, if the reference has a pixel at exactly the same point
+ * 
+ * @param x Horizontal coordinate of the pixel
+ * @param y Vertical coordinate of the pixel
+ * @return True if the value was copied
+ */
+bool HFractalMain::copyFromReference (int x, int y) {
+    if (!use_reference) return false;
+    int rx, ry;
+    if (!alignedPixel (x, reference_scale, reference_shift_x, reference->img_resolution, rx)) return false;
+    if (!alignedPixel (y, reference_scale, reference_shift_y, reference->img_resolution, ry)) return false;
+    img->set (x, y, reference->img->get (rx, ry));
+    return true;
+}
+
+/**
+ * @brief Count the pixels a render with the current parameters could copy from a finished render. Pixels line up when the views are panned by whole pixels or zoomed by whole factors about a shared pixel
+ * 
+ * @param other The finished render
+ * @return Number of pixels which could be copied, 0 if its values cannot be reused
+ */
+long HFractalMain::countReferencePixels (HFractalMain *other) {
+    long double scale, shift_x, shift_y;
+    if (!getReferenceMapping (other, scale, shift_x, shift_y)) return 0;
+    // The mapping is separable, so pixels line up exactly where aligned columns cross aligned rows
+    long columns = 0, rows = 0;
+    int unused;
+    for (int v = 0; v < resolution; v++) {
+        if (alignedPixel (v, scale, shift_x, other->img_resolution, unused)) columns++;
+        if (alignedPixel (v, scale, shift_y, other->img_resolution, unused)) rows++;
+    }
+    return columns*rows;
+}
+
+/**
+ * @brief Evaluate a pixel using the evaluation state stored in the image, so that only the iterations which have not already been performed are computed
+ * 
+ * @param x Horizontal coordinate of the pixel
+ * @param y Vertical coordinate of the pixel
+ * @param c Coordinate in the complex plane represented by the pixel
+ * @return Integer representing the number of iterations performed before the number tended to infinity, or the limit if this was reached first
+ */
+int HFractalMain::evaluateWithState (int x, int y, complex<long double> c) {
+    complex<long double> z;
+    int depth;
+    img->getState (x, y, z, depth);
+    if (depth == 0) {
+        // Never evaluated, so start from the beginning
+        z = main_equation->initialValue (c);
+    } else if (HFractalEquation::isInfinity (z)) {
+        // Already escaped, so the result is known for any limit
+        return min (depth, eval_limit);
+    } else if (depth >= eval_limit) {
+        // Already iterated past the limit without escaping
+        return eval_limit;
+    }
+    depth = main_equation->evaluate (c, z, depth, eval_limit);
+    img->setState (x, y, z, depth);
+    return depth;
+}
+
+/**
+ * @brief Check whether the current image was rendered with exactly the requested parameters other than the evaluation limit, and kept its evaluation state
+ * 
+ * @return True if the image can be updated incrementally, false if it must be rendered from scratch
+ */
+bool HFractalMain::canRenderIncrementally () {
+    if (img == NULL || !img->hasState() || !img->isDone()) return false;
+    return img_resolution == resolution
+        && img_offset_x == offset_x
+        && img_offset_y == offset_y
+        && img_zoom == zoom
+        && img_eq == eq
+        && img_accuracy == accuracy
+        && img_render_strategy == render_strategy
+        && img_double_lanes == double_lanes
+        && img_interior_detection == interior_detection;
+}
+
+/**
+ * @brief Apply an evaluation limit lower than the one the current image was rendered with. No pixel needs computing as every pixel's state has already reached the new limit
+ * 
+ */
+void HFractalMain::clampToEvalLimit () {
+    for (int y = 0; y < resolution; y++) {
+        for (int x = 0; x < resolution; x++) {
+            complex<long double> z;
+            int depth;
+            img->getState (x, y, z, depth);
+            if (depth == 0) {
+                // Pixels without state (e.g. copied from the tile cache) hold their value for the old limit, which is still correct when clamped
+                img->set (x, y, min ((int)img->get (x, y), eval_limit));
+            } else {
+                img->set (x, y, HFractalEquation::isInfinity (z) ? min (depth, eval_limit) : eval_limit);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Prepare the image for rendering with the current parameters, without starting any threads. Tiles are then fetched with fetchTile and rendered with renderTile by any number of the caller's threads, and endRender is called once all are done.
+ * If a lowered evaluation limit can be applied without computation, this finishes the render immediately and leaves nothing to fetch
  * 
- * @param wait Whether to wait and block the current thread until the image has been fully computed, useful if you want to avoid concurrency somewhere else (functionality hiding)
  * @return Integer representing status code, 0 for success, else for failure
  */
-int HFractalMain::generateImage (bool wait=true) {
-    if (getIsRendering()) { std::cout << "Aborting!" << std::endl; return 2; } // Prevent overlapping renders from starting
-    // Output a summary of the rendering parameters
-    std::setprecision (100);
-    std::cout << "Rendering with parameters: " << std::endl;
-    std::cout << "Resolution=" << resolution << std::endl;
-    std::cout << "EvaluationLimit=" << eval_limit << std::endl;
-    std::cout << "Threads=" << worker_threads << std::endl;
-    std::cout << "Zoom="; printf ("%Le", zoom); std::cout << std::endl;
-    std::cout << "OffsetX="; printf ("%.70Lf", offset_x); std::cout << std::endl;
-    std::cout << "OffsetY="; printf ("%.70Lf", offset_y); std::cout << std::endl;
+int HFractalMain::beginRender () {
+    if (getIsRendering()) return 2;
 
     // Abort rendering if the equation is invalid
-    if (!isValidEquation()) { std::cout << "Aborting!" << std::endl; return 1; }
+    if (!isValidEquation()) return 1;
     
     // Mark the environment as now rendering, locking resources/parameters
     is_rendering = true;
 
-    // Clear and reinitialise the image class with the requested resolution
-    if (img != NULL) img->~HFractalImage();
-    img = new HFractalImage (resolution, resolution);
+    if (canRenderIncrementally()) {
+        if (eval_limit <= img_eval_limit) {
+            // A lower limit can be applied without any computation
+            clampToEvalLimit ();
+            img_eval_limit = eval_limit;
+            is_rendering = false;
+            return 0;
+        }
+        // A higher limit only needs the pixels which reached the old limit continuing, so keep the existing image and its state
+        img->restart ();
+    } else {
+        // Clear and reinitialise the image class with the requested resolution
+        if (img != NULL) img->~HFractalImage();
+        img = new HFractalImage (resolution, resolution, keep_state);
+        alignTiles ();
+    }
+
+    // Record the parameters this image is being rendered with
+    img_resolution = resolution;
+    img_offset_x = offset_x;
+    img_offset_y = offset_y;
+    img_zoom = zoom;
+    img_eq = eq;
+    img_eval_limit = eval_limit;
+    img_accuracy = accuracy;
+    img_render_strategy = render_strategy;
+    img_double_lanes = double_lanes;
+    img_interior_detection = interior_detection;
+    img_resampled = false;
+    setupSymmetry ();
+    use_reference = getReferenceMapping (reference, reference_scale, reference_shift_x, reference_shift_y);
+    if (owns_equation) main_equation->resetInteriorExits ();
+    return 0;
+}
+
+/**
+ * @brief Generate a fractal image based on all the environment parameters
+ * 
+ * @param wait Whether to wait and block the current thread until the image has been fully computed, useful if you want to avoid concurrency somewhere else (functionality hiding)
+ * @return Integer representing status code, 0 for success, else for failure
+ */
+int HFractalMain::generateImage (bool wait=true) {
+    if (getIsRendering()) { if (verbose) std::cout << "Aborting!" << std::endl; return 2; } // Prevent overlapping renders from starting
+    // Output a summary of the rendering parameters
+    if (verbose) {
+        std::setprecision (100);
+        std::cout << "Rendering with parameters: " << std::endl;
+        std::cout << "Resolution=" << resolution << std::endl;
+        std::cout << "EvaluationLimit=" << eval_limit << std::endl;
+        std::cout << "Threads=" << worker_threads << std::endl;
+        std::cout << "Zoom="; printf ("%Le", zoom); std::cout << std::endl;
+        std::cout << "OffsetX="; printf ("%.70Lf", offset_x); std::cout << std::endl;
+        std::cout << "OffsetY="; printf ("%.70Lf", offset_y); std::cout << std::endl;
+    }
+
+    // Prepare the image, finishing immediately if no tiles need rendering
+    int status = beginRender ();
+    if (status != 0 || !getIsRendering()) {
+        if (verbose) std::cout << (status != 0 ? "Aborting!" : "Rendering done.") << std::endl;
+        return status;
+    }
 
     // Clear the thread pool, and populate it with fresh worker threads
     thread_pool.clear();
@@ -87,28 +815,333 @@ int HFractalMain::generateImage (bool wait=true) {
 
     // Optionally, wait for the render to complete before returning
     if (wait) {
-        while (true) {
-            // If enabled at compile time, show a progress bar in the terminal 
-            #ifdef TERMINAL_UPDATES
+        // If enabled at compile time, show a progress bar in the terminal until the image has been fully completed (all pixels computed)
+        #ifdef TERMINAL_UPDATES
+        while (verbose) {
             float percent = getImageCompletionPercentage();
             std::cout << "\r";
             std::cout << "Working: ";
             for (int k = 2; k <= 100; k+=2) { if (k <= percent) std::cout << "█"; else std::cout << "_"; }
             std::cout << " | ";
             std::cout << round(percent) << "%";
-            #endif
-            // Break out when the image has been fully completed (all pixels computed)
             if (img->isDone()) break;
             crossPlatformDelay (10);
         }
-        // Wait for all the threads to join, then finish up
+        #endif
+        // Wait for all the threads to join, which they do once every tile is complete, then finish up
         for (auto th : thread_pool) th->join();
         is_rendering = false;
     }
+    if (!verbose) return 0;
     std::cout << std::endl << "Rendering done." << std::endl;
+    if (main_equation->hasInteriorDetection()) std::cout << "InteriorDetection=" << main_equation->getInteriorExits() << " pixels ended early" << std::endl;
+    if (tile_cache != NULL) std::cout << "TileCache=" << tile_cache->getHits() << " hits, " << tile_cache->getMisses() << " misses, " << tile_cache->getMemoryUsed() << " bytes" << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Render the image in horizontal bands of rows, writing each band to a PGM file as soon as it is complete while the next band renders, so that memory use is bounded by two bands however large the image is.
+ * Symmetry and reference renders are not used, as their pixels may lie in other bands, and no image is kept once the render is done
+ * 
+ * @param path Path of the PGM file to write, including extension
+ * @param band_height Number of rows in each band, rounded up to a whole number of tiles
+ * @return Integer representing status code, 0 for success, 3 if the file could not be written, else for failure as for generateImage
+ */
+int HFractalMain::generateImageStreamed (string path, int band_height) {
+    if (getIsRendering()) { if (verbose) std::cout << "Aborting!" << std::endl; return 2; }
+    if (!isValidEquation() || band_height <= 0) { if (verbose) std::cout << "Aborting!" << std::endl; return 1; }
+    FILE *img_file = fopen (path.c_str(), "wb");
+    if (img_file == NULL || !HFractalImage::writePGMHeader (img_file, resolution, resolution)) {
+        if (img_file != NULL) fclose (img_file);
+        return 3;
+    }
+    is_rendering = true;
+    band_height = ((band_height+TILE_SIZE-1)/TILE_SIZE)*TILE_SIZE;
+
+    if (img != NULL) delete img;
+    img = NULL;
+    img_resolution = resolution;
+    img_offset_x = offset_x;
+    img_offset_y = offset_y;
+    img_zoom = zoom;
+    img_eq = eq;
+    img_eval_limit = eval_limit;
+    img_accuracy = accuracy;
+    img_render_strategy = render_strategy;
+    img_double_lanes = double_lanes;
+    img_interior_detection = interior_detection;
+    img_resampled = false;
+    symmetry = SYM_NONE;
+    use_reference = false;
+    if (owns_equation) main_equation->resetInteriorExits ();
+
+    bool written = true;
+    std::thread *writer = NULL;
+    HFractalImage *previous = NULL;
+    for (band_y = 0; band_y < resolution; band_y += band_height) {
+        // Band images never keep state, so an image too large for memory is never held at once
+        img = new HFractalImage (resolution, min (band_height, resolution-band_y));
+        alignTiles ();
+        thread_pool.clear();
+        for (int i = 0; i < worker_threads; i++) thread_pool.push_back (new std::thread (&HFractalMain::bandThreadMain, this));
+        for (auto th : thread_pool) {
+            th->join();
+            delete th;
+        }
+        thread_pool.clear();
+
+        // Wait for the band above to be written, then write this band while the next renders
+        if (writer != NULL) {
+            writer->join();
+            delete writer;
+            delete previous;
+        }
+        written &= ferror (img_file) == 0;
+        previous = img;
+        writer = new std::thread (&HFractalImage::writePGMRows, previous, img_file);
+        img = NULL;
+        if (verbose) std::cout << "\rWorking: " << min (band_y+band_height, resolution) << "/" << resolution << " rows" << std::flush;
+    }
+    if (writer != NULL) {
+        writer->join();
+        delete writer;
+        delete previous;
+    }
+    band_y = 0;
+    written &= ferror (img_file) == 0;
+    written &= fclose (img_file) == 0;
+    is_rendering = false;
+    if (verbose) std::cout << std::endl << "Rendering done." << std::endl;
+    return written ? 0 : 3;
+}
+
+/**
+ * @brief Main function called on each worker thread rendering a band of the image
+ * 
+ */
+void HFractalMain::bandThreadMain () {
+    int next = img->getUncompletedTile();
+    while (next != -1) {
+        renderTile (next);
+        next = img->getUncompletedTile();
+    }
+}
+
+/**
+ * @brief Render the image and write it to a colour PNG file. Each band of the file is filtered and compressed by the worker thread which renders the last tile it waits for, so encoding overlaps rendering rather than following it
+ * 
+ * @param path Path of the PNG file to write, including extension
+ * @param colour_preset Colour palette preset to use
+ * @return Integer representing status code, 0 for success, 3 if the file could not be written, else for failure as for generateImage
+ */
+int HFractalMain::generateImagePNG (string path, int colour_preset) {
+    if (getIsRendering()) { if (verbose) std::cout << "Aborting!" << std::endl; return 2; }
+    int status = beginRender ();
+    if (status != 0) { if (verbose) std::cout << "Aborting!" << std::endl; return status; }
+    // A lowered evaluation limit needs no tiles, so the finished image is simply written
+    if (!getIsRendering()) return img->writePNG (path, colour_preset, img_eval_limit) ? 0 : 3;
+
+    png_writer = new HFractalPNGWriter ();
+    bool written = png_writer->open (path, resolution, resolution, colour_preset, eval_limit);
+    if (written) {
+        // Count the tiles each band waits for, which include tiles mirrored into it from other bands
+        png_tiles_left.assign (png_writer->getBandCount(), 0);
+        vector<int> bands;
+        for (int tile = 0; tile < img->getTileCount(); tile++) {
+            getTileBands (tile, bands);
+            for (int band : bands) png_tiles_left[band]++;
+        }
+
+        thread_pool.clear();
+        for (int i = 0; i < worker_threads; i++) thread_pool.push_back (new std::thread (&HFractalMain::pngThreadMain, this));
+        for (auto th : thread_pool) {
+            th->join();
+            delete th;
+        }
+        thread_pool.clear();
+    }
+    written &= png_writer->close ();
+    delete png_writer;
+    png_writer = NULL;
+    is_rendering = false;
+    if (verbose) std::cout << "Rendering done." << std::endl;
+    return written ? 0 : 3;
+}
+
+/**
+ * @brief Main function called on each worker thread rendering an image straight to a PNG file. After each tile, any band which no longer waits for a tile is encoded on this thread
+ * 
+ */
+void HFractalMain::pngThreadMain () {
+    vector<int> bands;
+    int next = img->getUncompletedTile();
+    while (next != -1) {
+        renderTile (next);
+        getTileBands (next, bands);
+        for (int band : bands) {
+            png_mut.lock();
+            bool complete = --png_tiles_left[band] == 0;
+            png_mut.unlock();
+            if (complete) png_writer->encodeBand (band, img);
+        }
+        next = img->getUncompletedTile();
+    }
+}
+
+/**
+ * @brief Find the bands of a PNG file which a tile fills pixels of, i.e. those containing its own rows, and those containing the mirrors of its rows if symmetry is in use
+ * 
+ * @param tile Index of the tile
+ * @param bands Output for the indices of the bands, without repeats
+ */
+void HFractalMain::getTileBands (int tile, vector<int> &bands) {
+    int tile_x, tile_y, tile_w, tile_h;
+    img->getTileBounds (tile, tile_x, tile_y, tile_w, tile_h);
+    bands.clear();
+    for (int y = tile_y; y < tile_y+tile_h; y++) {
+        int band = HFractalPNGWriter::getBand (y);
+        if (find (bands.begin(), bands.end(), band) == bands.end()) bands.push_back (band);
+        // Mirrored rows do not depend on the column under either symmetry
+        int my = mirror_y-y;
+        if (symmetry == SYM_NONE || my < 0 || my >= resolution) continue;
+        band = HFractalPNGWriter::getBand (my);
+        if (find (bands.begin(), bands.end(), band) == bands.end()) bands.push_back (band);
+    }
+}
+
+/**
+ * @brief Render an exponential map strip centred on the current offsets. Column j samples the angle j*step and row k the radius max_radius*e^(-k*step), so samples are evenly spaced in log radius and every depth of a zoom toward the centre is evaluated once.
+ * The strip covers every view between the two zooms, each of which can then be synthesised with resampleExpStrip instead of being rendered
+ * 
+ * @param min_zoom Smallest zoom to cover, whose corners set the outermost radius
+ * @param max_zoom Largest zoom to cover, whose pixel spacing sets the innermost radius
+ * @return Integer representing status code, 0 for success, else for failure
+ */
+int HFractalMain::generateExpStrip (long double min_zoom, long double max_zoom) {
+    if (getIsRendering()) { if (verbose) std::cout << "Aborting!" << std::endl; return 2; }
+    if (!isValidEquation() || min_zoom <= 0 || max_zoom < min_zoom) { if (verbose) std::cout << "Aborting!" << std::endl; return 1; }
+    is_rendering = true;
+
+    // Columns are spaced finely enough for the corners of every frame, and rows run from the corners of the widest view to half a pixel of the narrowest
+    int columns = (int)ceill (EXP_STRIP_DENSITY*resolution);
+    strip_step = 2*M_PIl/columns;
+    strip_max_radius = sqrtl (2)/min_zoom;
+    long double min_radius = 1/(max_zoom*resolution);
+    int rows = (int)ceill (logl (strip_max_radius/min_radius)/strip_step)+1;
+    strip_centre_x = offset_x;
+    strip_centre_y = offset_y;
+    strip_min_zoom = min_zoom;
+    strip_max_zoom = max_zoom;
+    strip_eval_limit = eval_limit;
+    strip_eq = eq;
+    if (strip != NULL) delete strip;
+    strip = new HFractalImage (columns, rows);
+    if (verbose) std::cout << "Rendering exponential map strip of " << columns << "x" << rows << " samples" << std::endl;
+
+    thread_pool.clear();
+    for (int i = 0; i < worker_threads; i++) thread_pool.push_back (new std::thread (&HFractalMain::stripThreadMain, this));
+    for (auto th : thread_pool) {
+        th->join();
+        delete th;
+    }
+    thread_pool.clear();
+    is_rendering = false;
+    if (verbose) std::cout << "Rendering done." << std::endl;
     return 0;
 }
 
+/**
+ * @brief Main function called on each worker thread rendering the exponential map strip
+ * 
+ */
+void HFractalMain::stripThreadMain () {
+    int next = strip->getUncompletedTile();
+    while (next != -1) {
+        renderStripTile (next);
+        next = strip->getUncompletedTile();
+    }
+}
+
+/**
+ * @brief Render every sample in a tile of the exponential map strip
+ * 
+ * @param tile Index of the tile to render
+ */
+void HFractalMain::renderStripTile (int tile) {
+    int tile_x, tile_y, tile_w, tile_h;
+    strip->getTileBounds (tile, tile_x, tile_y, tile_w, tile_h);
+    for (int k = tile_y; k < tile_y+tile_h; k++) {
+        long double radius = strip_max_radius*expl (-k*strip_step);
+        for (int j = tile_x; j < tile_x+tile_w; j++) {
+            long double angle = j*strip_step;
+            complex<long double> c = complex<long double> (strip_centre_x + (radius*cosl (angle)), strip_centre_y + (radius*sinl (angle)));
+            strip->set (j, k, main_equation->evaluate (c, strip_eval_limit));
+        }
+    }
+}
+
+/**
+ * @brief Synthesise the image at a zoom toward the centre of the exponential map strip, taking each pixel from the nearest strip sample, split across the worker threads. The result replaces the current image, and can be written or copied as a rendered one
+ * 
+ * @param frame_zoom Zoom of the image, between the two zooms the strip was rendered for
+ * @return Integer representing status code, 0 for success, else for failure
+ */
+int HFractalMain::resampleExpStrip (long double frame_zoom) {
+    if (getIsRendering() || strip == NULL) return 2;
+    if (frame_zoom < strip_min_zoom*(1-1e-9) || frame_zoom > strip_max_zoom*(1+1e-9)) return 1;
+    is_rendering = true;
+
+    if (img != NULL) delete img;
+    img = new HFractalImage (resolution, resolution);
+    img_resolution = resolution;
+    img_offset_x = strip_centre_x;
+    img_offset_y = strip_centre_y;
+    img_zoom = frame_zoom;
+    img_eq = strip_eq;
+    img_eval_limit = strip_eval_limit;
+    img_accuracy = accuracy;
+    img_render_strategy = render_strategy;
+    img_double_lanes = double_lanes;
+    img_interior_detection = interior_detection;
+    img_resampled = true;
+
+    vector<std::thread> threads;
+    int rows_per_thread = (resolution+worker_threads-1)/worker_threads;
+    for (int start = 0; start < resolution; start += rows_per_thread) {
+        threads.push_back (std::thread (&HFractalMain::resampleRows, this, start, min (start+rows_per_thread, resolution), frame_zoom));
+    }
+    for (auto &th : threads) th.join();
+    is_rendering = false;
+    return 0;
+}
+
+/**
+ * @brief Fill a range of rows of the image from the exponential map strip
+ * 
+ * @param start_y First row to fill
+ * @param end_y Row after the last row to fill
+ * @param frame_zoom Zoom of the image
+ */
+void HFractalMain::resampleRows (int start_y, int end_y, long double frame_zoom) {
+    long double p = 2/(frame_zoom*resolution);
+    int columns = strip->getWidth();
+    int rows = strip->getHeight();
+    for (int y = start_y; y < end_y; y++) {
+        long double dy = (1/frame_zoom) - (p*y);
+        for (int x = 0; x < resolution; x++) {
+            long double dx = (p*x) - (1/frame_zoom);
+            // Positions relative to the centre only need relative precision, so double maths is enough to pick the sample
+            double radius = hypot ((double)dx, (double)dy);
+            // The centre itself lies inside the innermost row
+            long k = (radius > 0) ? lround (log ((double)strip_max_radius/radius)/(double)strip_step) : rows-1;
+            long j = lround (atan2 ((double)dy, (double)dx)/(double)strip_step);
+            k = max (0L, min ((long)rows-1, k));
+            j = ((j % columns) + columns) % columns;
+            img->set (x, y, strip->get (j, k));
+        }
+    }
+}
+
 /**
  * @brief Construct a new rendering environment, with blank parameters
  * 
@@ -119,6 +1152,60 @@ HFractalMain::HFractalMain () {
     offset_y = 0;
     zoom = 1;
     img = NULL;
+    main_equation = NULL;
+}
+
+/**
+ * @brief Destroy the rendering environment, waiting for any render still in progress to finish, as its threads use this environment
+ * 
+ */
+HFractalMain::~HFractalMain () {
+    for (auto th : thread_pool) {
+        if (th->joinable()) th->join();
+        delete th;
+    }
+    if (img != NULL) delete img;
+    if (strip != NULL) delete strip;
+    if (owns_equation && main_equation != NULL) delete main_equation;
+}
+
+/**
+ * @brief Parse an equation string, detecting whether it matches the blueprint of a preset so that the preset's optimised evaluation can be used
+ * 
+ * @param equation The equation string
+ * @return Pointer to the new equation, owned by the caller, or NULL if the string could not be parsed
+ */
+HFractalEquation* HFractalMain::parseEquation (string equation) {
+    HFractalEquation *parsed = HFractalEquationParser::extractEquation (equation);
+    if (parsed == NULL) return NULL;
+    int preset = -1;
+    for (int i = 0; i < NUM_EQUATION_PRESETS; i++) {
+        if (equation == equationPreset ((EQ_PRESETS)i, false)) {
+            preset = i;
+            break;
+        }
+    }
+    parsed->setPreset (preset);
+    return parsed;
+}
+
+/**
+ * @brief Use an equation which has already been parsed, e.g. by parseEquation, instead of parsing the string again. The equation is not freed by this environment, so the caller must keep it alive until the environment is destroyed or given another equation.
+ * The equation is never modified, since other environments may be rendering with it, so its accuracy, unrolling and interior detection settings should be set once by the caller when it is created, and are taken on by this environment
+ * 
+ * @param eq_ The equation string the equation was parsed from
+ * @param equation_ The parsed equation, or NULL if it was invalid
+ */
+void HFractalMain::setSharedEquation (string eq_, HFractalEquation *equation_) {
+    if (getIsRendering()) return;
+    eq = eq_;
+    if (owns_equation && main_equation != NULL) delete main_equation;
+    main_equation = equation_;
+    owns_equation = false;
+    if (main_equation == NULL) return;
+    accuracy = main_equation->getAccuracy();
+    unrolled = main_equation->getUnrolled();
+    interior_detection = main_equation->getInteriorDetection();
 }
 
 /**
@@ -138,14 +1225,15 @@ uint32_t* HFractalMain::getRGBAImage (int colour_preset) {
     int limit = eval_limit;
     
     // Construct a pixel buffer with RGBA channels
-    uint32_t *pixels = (uint32_t *)malloc(size*size*sizeof(uint32_t));
+    uint32_t *pixels = (uint32_t *)malloc((size_t)size*size*sizeof(uint32_t));
     for (int x = 0; x < size; x++) {
         for (int y = 0; y < size; y++) {
             int v = img->get(x,y);
-            pixels[(y*size)+x] = (v == limit) ? 0x000000ff : HFractalImage::colourFromValue(v, colour_preset);
+            int64_t offset = ((int64_t)y*size)+x;
+            pixels[offset] = (v == limit) ? 0x000000ff : HFractalImage::colourFromValue(v, colour_preset);
             
             // If the pixel has not been computed, make it transparent
-            if (img->completed[(y*size)+x] != 2) pixels[(y*size)+x] = 0;
+            if (img->completed[offset] != 2) pixels[offset] = 0;
         }
     }
 
@@ -153,6 +1241,80 @@ uint32_t* HFractalMain::getRGBAImage (int colour_preset) {
     return pixels;
 }
 
+/**
+ * @brief Get the number of bytes each pixel takes up in a pixel format
+ * 
+ * @param format Pixel format
+ * @return Number of bytes per pixel
+ */
+int HFractalMain::bytesPerPixel (PIXEL_FORMAT format) {
+    switch (format) {
+    case PF_VALUE16: return 2;
+    case PF_GREY8: return 1;
+    case PF_RGB24: return 3;
+    default: return 4;
+    }
+}
+
+/**
+ * @brief Copy the generated image into a buffer provided by the caller, converting it to a pixel format. Rows may be padded, so each starts `stride` bytes after the previous one.
+ * Colour formats use a colour scheme preset, with pixels which reached the evaluation limit in black, as in getRGBAImage. PF_GREY8 uses the low byte of each value, also with black for the limit
+ * 
+ * @param buffer Buffer to write into, which must hold at least `stride` bytes for each row of the image
+ * @param format Pixel format to convert to
+ * @param stride Number of bytes between the start of each row, at least the width of the image times the bytes per pixel
+ * @param colour_preset The colour scheme to use for colour formats
+ * @return True for success, false if there is no complete image or the stride is too small
+ */
+bool HFractalMain::copyImage (void *buffer, PIXEL_FORMAT format, size_t stride, int colour_preset) {
+    if (img == NULL || getIsRendering() || !img->isDone()) return false;
+    int size = img_resolution;
+    int bytes = bytesPerPixel (format);
+    if (stride < (size_t)size*bytes) return false;
+
+    for (int y = 0; y < size; y++) {
+        uint8_t *row = (uint8_t *)buffer + (y*stride);
+        for (int x = 0; x < size; x++) {
+            uint16_t v = img->get (x, y);
+            uint8_t *pixel = row + (x*bytes);
+            if (format == PF_VALUE16) {
+                memcpy (pixel, &v, sizeof (v));
+                continue;
+            }
+            if (format == PF_GREY8) {
+                pixel[0] = (v == img_eval_limit) ? 0 : (uint8_t)(v % 256);
+                continue;
+            }
+            // Colours are packed as 0xRRGGBBAA
+            uint32_t col = (v == img_eval_limit) ? 0x000000ff : HFractalImage::colourFromValue (v, colour_preset);
+            uint8_t red = col >> 24, green = (col >> 16) & 0xff, blue = (col >> 8) & 0xff, alpha = col & 0xff;
+            if (format == PF_BGRA32) {
+                pixel[0] = blue; pixel[1] = green; pixel[2] = red; pixel[3] = alpha;
+            } else {
+                pixel[0] = red; pixel[1] = green; pixel[2] = blue;
+                if (format == PF_RGBA32) pixel[3] = alpha;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Render an image with the current parameters and copy it into a buffer provided by the caller, so that embedding applications need no files or GUI
+ * 
+ * @param buffer Buffer to write into, which must hold at least `stride` bytes for each row of the image
+ * @param format Pixel format to convert to
+ * @param stride Number of bytes between the start of each row
+ * @param colour_preset The colour scheme to use for colour formats
+ * @return Integer representing status code as for generateImage, or 3 if the image could not be copied into the buffer
+ */
+int HFractalMain::renderToBuffer (void *buffer, PIXEL_FORMAT format, size_t stride, int colour_preset) {
+    if (stride < (size_t)resolution*bytesPerPixel (format)) return 3;
+    int status = generateImage (true);
+    if (status != 0) return status;
+    return copyImage (buffer, format, stride, colour_preset) ? 0 : 3;
+}
+
 /**
  * @brief Get the percentage of pixels in the image which have been computed
  * 
@@ -160,7 +1322,7 @@ uint32_t* HFractalMain::getRGBAImage (int colour_preset) {
  */
 float HFractalMain::getImageCompletionPercentage () {
     if (img == NULL) return 100;
-    return ((float)(img->getInd())/(float)(resolution*resolution))*100;
+    return ((float)(img->getInd())/(float)(img->getPixelCount()))*100;
 }
 
 /**
@@ -205,17 +1367,52 @@ bool HFractalMain::autoWriteImage (IMAGE_TYPE type) {
 
     cout << image_name << endl;
 
-    string image_path = "";
+    return writeImage (type, getDesktopPath() + image_name);
+}
 
-    image_path += getDesktopPath();
-    image_path += image_name;
+/**
+ * @brief Write the image to a given path, adding the extension for the image type
+ * 
+ * @param type Image format to write image out to
+ * @param path Path to write to, without extension
+ * @param colour_preset Colour scheme to use for colour image types
+ * @return True for success, false for failure
+ */
+bool HFractalMain::writeImage (IMAGE_TYPE type, string path, int colour_preset) {
+    if (img == NULL) return false;
 
     // Call into the image's writer to write out data
+    HFractalRawSpec spec;
     switch (type) {
     case PGM:
-        image_path += ".pgm";
-        return img->writePGM (image_path);
+        return img->writePGM (path + imageTypeExtension (type));
+    case PPM:
+        return img->writePPM (path + imageTypeExtension (type), colour_preset, img_eval_limit);
+    case PNG:
+        return img->writePNG (path + imageTypeExtension (type), colour_preset, img_eval_limit);
+    case RAW:
+    case RAW_RLE:
+        spec.offset_x = img_offset_x;
+        spec.offset_y = img_offset_y;
+        spec.zoom = img_zoom;
+        spec.eval_limit = img_eval_limit;
+        spec.accuracy = img_accuracy;
+        spec.render_strategy = img_render_strategy;
+        spec.equation = img_eq;
+        return img->writeRaw (path + imageTypeExtension (type), spec, type == RAW_RLE);
     default:
         return false;
     }
 }
+
+/**
+ * @brief Encode the generated image as a colour PNG image in memory, on the calling thread
+ * 
+ * @param buffer Buffer to append the encoded image to
+ * @param colour_preset Colour scheme preset to use
+ * @return True for success, false if there is no finished image
+ */
+bool HFractalMain::encodePNG (vector<uint8_t> &buffer, int colour_preset) {
+    if (img == NULL || getIsRendering()) return false;
+    return img->encodePNG (buffer, colour_preset, img_eval_limit);
+}
@@ -7,15 +7,58 @@
 #include <thread>
 #include <vector>
 #include <map>
+#include <mutex>
 
 #include "image.hh"
 #include "fractal.hh"
 #include "utils.hh"
 #include "equationparser.hh"
+#include "tilecache.hh"
+#include "wavefront.hh"
+#include "interval.hh"
+
+// Largest distance, in pixels, between an axis of symmetry and the nearest pixel centre or midpoint between pixels for the symmetry to be used
+#define SYMMETRY_TOLERANCE 1e-6
+
+// Side length in pixels of the blocks which adaptive rendering may interpolate from their corners
+#define ADAPTIVE_BLOCK 8
+// Number of samples taken along each axis of pixels which adaptive rendering supersamples
+#define ADAPTIVE_SUPERSAMPLE 2
+// Pixels closer to the boundary of the set than this many pixel spacings are supersampled by adaptive rendering
+#define ADAPTIVE_SUPERSAMPLE_DISTANCE 1
+
+// Largest distance, in pixels, between a pixel of a reference render and the point a pixel of the current render maps to for its value to be copied
+#define REFERENCE_TOLERANCE 1e-6
+
+// Default number of rows in each band of an image rendered by generateImageStreamed
+#define STREAM_DEFAULT_BAND_HEIGHT 256
+
+// Number of exponential map strip columns, i.e. angle samples, per pixel of the image width, enough that samples around the corners of every frame are no further apart than its pixels (pi times root 2)
+#define EXP_STRIP_DENSITY 4.443
+
+// Smallest side length in pixels of the regions interval arithmetic tries to prove the result of
+#define INTERVAL_MIN_SIZE 8
 
 // When defined, progress updates will be written to terminal.
 #define TERMINAL_UPDATES
 
+// Enum describing how the pixels of each tile are iterated
+enum RENDER_STRATEGY {
+    RS_PIXEL = 0, // Each pixel is iterated to completion in turn
+    RS_WAVEFRONT, // All pixels of a tile advance together in rounds, with finished pixels compacted out between rounds
+    RS_BOUNDARY_TRACE, // Only the boundaries of regions with equal values are computed in each tile, and their interiors are filled
+    RS_ADAPTIVE // Distance estimates decide where to sample, interpolating blocks far from the boundary of the set and supersampling pixels on it
+};
+
+// Enum describing the layout of pixels in buffers filled by HFractalMain::copyImage
+enum PIXEL_FORMAT {
+    PF_VALUE16 = 0, // Raw 16 bit values, as computed, in native byte order
+    PF_GREY8, // 8 bit grey levels
+    PF_RGBA32, // 4 bytes per pixel in the order red, green, blue, alpha
+    PF_BGRA32, // 4 bytes per pixel in the order blue, green, red, alpha
+    PF_RGB24 // 3 bytes per pixel in the order red, green, blue
+};
+
 // Class defining a fractal rendering environment, fully encapsulated
 class HFractalMain {
 private:
@@ -26,22 +69,111 @@ private:
 
     std::string eq; // String equation being used
     HFractalEquation *main_equation; // Actual pointer to the equation manager class being used for computation
+    bool owns_equation = true; // Whether main_equation was parsed by this environment and should be freed by it
 
     int worker_threads; // Number of worker threads to be used for computation
     int eval_limit; // Evaluation limit for the rendering environment
+    MATH_ACCURACY accuracy = MA_PRECISE; // Accuracy of complex exponentials, logarithms and powers used by the equation
+    bool unrolled = false; // Whether the equation runs iterations in blocks between escape checks, which gives identical results
+    bool interior_detection = false; // Whether the Mandelbrot preset ends iteration early for points whose orbit settles into an attracting cycle
+    RENDER_STRATEGY render_strategy = RS_PIXEL; // How the pixels of each tile are iterated
+    bool double_lanes = false; // Whether wavefront rendering may use double lanes at low zoom, which are faster but can change a few pixels
+    bool use_symmetry = true; // Whether to compute only one half of images which are symmetric, mirroring results into the other half
+    bool use_intervals = true; // Whether to try proving the result of tiles of custom equations with interval arithmetic before computing their pixels
 
     HFractalImage *img = new HFractalImage(0,0); // Pointer to the image class containing data for the rendered image
+    HFractalTileCache *tile_cache = NULL; // Pointer to a cache of previously rendered tiles, or NULL if tiles should not be cached
+    bool verbose = true; // Whether render parameters, progress and statistics are written to the terminal
+    bool keep_state = false; // Whether images should keep per-pixel evaluation state, allowing eval limit changes to be applied incrementally
+
+    int img_resolution; // Resolution the current image was rendered with
+    long double img_offset_x; // Horizontal offset the current image was rendered with
+    long double img_offset_y; // Vertical offset the current image was rendered with
+    long double img_zoom; // Zoom the current image was rendered with
+    std::string img_eq; // Equation the current image was rendered with
+    int img_eval_limit; // Evaluation limit the current image was rendered with
+    MATH_ACCURACY img_accuracy; // Accuracy the current image was rendered with
+    RENDER_STRATEGY img_render_strategy; // Render strategy the current image was rendered with
+    bool img_double_lanes; // Whether double lanes were allowed for the current image
+    bool img_interior_detection; // Whether interior detection was enabled for the current image
+    bool img_resampled = false; // Whether the current image was synthesised from the exponential map strip rather than evaluated
+
+    SYMMETRY symmetry = SYM_NONE; // Symmetry being exploited by the current render
+    int mirror_x; // Pixel (x, y) mirrors pixel (mirror_x-x, mirror_y-y) under point symmetry, or (x, mirror_y-y) under conjugate symmetry
+    int mirror_y;
+    int band_y = 0; // Row of the full view the image starts at, when rendering in bands
+
+    HFractalPNGWriter *png_writer = NULL; // Writer encoding bands of the image as soon as their tiles are rendered, when rendering straight to a PNG file, or NULL
+    std::vector<int> png_tiles_left; // Number of tiles each band of the PNG file is still waiting for
+    std::mutex png_mut; // Mutex object used to lock the counts of tiles left between worker threads
+
+    HFractalMain *reference = NULL; // Finished render whose pixels are copied where they line up exactly with pixels of this render, or NULL
+    bool use_reference = false; // Whether the reference can be used by the current render
+    long double reference_scale; // Pixel (x, y) of the current render lies at (x*reference_scale+reference_shift_x, y*reference_scale+reference_shift_y) in the reference
+    long double reference_shift_x;
+    long double reference_shift_y;
+
+    HFractalImage *strip = NULL; // Exponential map strip rendered by generateExpStrip, with angle across and log radius down, or NULL
+    long double strip_centre_x; // Real part of the point the strip is centred on
+    long double strip_centre_y; // Imaginary part of the point the strip is centred on
+    long double strip_max_radius; // Distance from the centre of the points in the first row of the strip
+    long double strip_step; // Angle between adjacent columns, which is also the natural log of the ratio between the radii of adjacent rows
+    long double strip_min_zoom; // Range of zooms whose views the strip covers
+    long double strip_max_zoom;
+    int strip_eval_limit; // Evaluation limit the strip was rendered with
+    std::string strip_eq; // Equation the strip was rendered with
 
     std::vector<std::thread*> thread_pool; // Thread pool containing currently active threads
     std::map<std::thread::id, bool> thread_completion; // Map of which threads have finished computing pixels
     bool is_rendering = false; // Marks whether there is currently a render ongoing (locking resources to prevent concurrent modification e.g. changing resolution mid-render)
 
     void threadMain (); // Method called on each thread when it starts, contains the worker/rendering code
+    void bandThreadMain (); // Method called on each worker thread rendering a band of a streamed image
+    void pngThreadMain (); // Method called on each worker thread rendering an image straight to a PNG file
+    void getTileBands (int, std::vector<int> &); // Find the bands of a PNG file which a tile fills pixels of, including through symmetry
+    void stripThreadMain (); // Method called on each worker thread rendering the exponential map strip
+    void renderStripTile (int); // Render every sample in a tile of the exponential map strip
+    void resampleRows (int, int, long double); // Fill rows of the image from the exponential map strip
+    template <typename T> void renderTileWavefront (int, int, int, int, long double, long double, long double); // Render every pixel in a tile using wavefront iteration with a given lane type
+    void renderTileBoundaryTrace (int, int, int, int, long double, long double, long double); // Render a tile by tracing the boundaries of regions with equal values, then filling their interiors
+    void renderRegion (int, int, int, int, long double, long double, long double, bool); // Render every pixel in part of a tile using the current render strategy
+    void renderRegionByInterval (int, int, int, int, long double, long double, long double, bool, HFractalIntervalEvaluator &); // Render part of a tile, filling it without per pixel computation where interval arithmetic proves every pixel gives the same result
+    void renderTileAdaptive (int, int, int, int, long double, long double, long double); // Render a tile with sampling density guided by distance estimates
+    bool useDoubleLanes (); // Check if wavefront rendering should use double lanes at the current zoom
+    static bool getLatticeOrigin (long double, long double, long double, int64_t &, int64_t &, long double &, long double &); // Find where the top-left pixel of the image lies on the global pixel lattice used to key cached tiles
+    void alignTiles (); // Line the image's tiles up with the global pixel lattice, so that panned views share cached tiles
+    void setupSymmetry (); // Find whether the current view lines up with a symmetry of the equation
+    bool getMirror (int, int, int &, int &); // Find the pixel which mirrors a pixel, if any
+    bool useBoundaryTrace (); // Check if boundary tracing can be used for the current image
+    bool useAdaptive (); // Check if adaptive rendering can be used for the current equation and image
+    bool isMirrored (int, int); // Check whether a pixel's value is copied from its mirror rather than computed
+    bool isTileMirrored (int, int, int, int); // Check whether every pixel in a tile is copied from its mirror
+    void copyToMirror (int, int); // Copy a computed pixel's value and state into its mirror, if the mirror is not computed itself
+    bool getReferenceMapping (HFractalMain *, long double &, long double &, long double &); // Find how pixels of the current parameters map onto pixels of a finished render, if its values can be reused
+    static bool alignedPixel (int, long double, long double, int, int &); // Find the reference pixel a coordinate maps to, if it lands on one
+    bool copyFromReference (int, int); // Copy a pixel's value from the reference render, if a reference pixel lies exactly on it
+    int evaluateWithState (int, int, std::complex<long double>); // Evaluate a pixel, continuing from and updating its stored state in the image
+    bool canRenderIncrementally (); // Check if the current image only differs from the requested render by its evaluation limit
+    void clampToEvalLimit (); // Apply a lowered evaluation limit to the current image without any computation
 
 public:
     int generateImage (bool); // Perform the render, and optionally block the current thread until it is done
 
+    int generateImageStreamed (std::string, int); // Render the image in bands, writing each to a PGM file as it completes, blocking until it is done
+    int generateImagePNG (std::string, int); // Render the image, encoding each band of a PNG file as soon as its tiles are complete, blocking until it is done
+    int generateExpStrip (long double, long double); // Render an exponential map strip about the current offsets, covering every view between two zooms, blocking until it is done
+    int resampleExpStrip (long double); // Synthesise the image at a zoom from the exponential map strip, without evaluating the equation
+    bool hasExpStrip () { return strip != NULL; } // Check if an exponential map strip has been rendered
+
+    int beginRender (); // Prepare the image for a render whose tiles are rendered by the caller's threads rather than the environment's own
+    int fetchTile () { return img->getUncompletedTile(); } // Get the index of the next tile to render in a render started by beginRender, or -1 if none are left
+    void renderTile (int); // Render every pixel in a tile of the image, using the tile cache where possible
+    void endRender () { is_rendering = false; } // Mark a render started by beginRender as finished, once every fetched tile has been rendered
+
+    static HFractalEquation *parseEquation (std::string); // Parse an equation string, detecting whether it is one of the presets, or return NULL if it is invalid
+
     HFractalMain (); // Base initialiser
+    ~HFractalMain (); // Destructor, waits for any render in progress and frees the image and equation
 
     int getResolution () { return resolution; } // Inline methods to get/set the resolution
     void setResolution (int resolution_) { if (!getIsRendering()) resolution = resolution_; }
@@ -59,20 +191,16 @@ public:
     void setEquation (std::string eq_) { 
         if (!getIsRendering()) { 
             eq = eq_;
-            main_equation = HFractalEquationParser::extractEquation (eq);
+            if (owns_equation && main_equation != NULL) delete main_equation;
+            main_equation = parseEquation (eq);
+            owns_equation = true;
             if (main_equation == NULL) return;
-            // Detect if the equation matches the blueprint of a preset
-            int preset = -1;
-            for (int i = 0; i < NUM_EQUATION_PRESETS; i++) {
-                if (eq == equationPreset ((EQ_PRESETS)i, false)) {
-                    preset = i;
-                    break;
-            main_equation->setPreset (preset);
-        }
-    }
-    main_equation->setPreset (preset);
+            main_equation->setAccuracy (accuracy);
+            main_equation->setUnrolled (unrolled);
+            main_equation->setInteriorDetection (interior_detection);
         }
     }
+    void setSharedEquation (std::string, HFractalEquation *); // Use an equation parsed elsewhere, which stays owned and configured by the caller, so that environments rendering the same formula parse it once
 
     int getWorkerThreads () { return worker_threads; } // Inline methods to get/set the number of worker threads
     void setWorkerThreads (int wt_) { if (!getIsRendering()) worker_threads = wt_; }
@@ -80,14 +208,70 @@ public:
     int getEvalLimit () { return eval_limit; } // Inline methods to get/set the evaluation limit
     void setEvalLimit (int el_) { if (!getIsRendering()) eval_limit = el_; }
 
+    MATH_ACCURACY getAccuracy () { return accuracy; } // Inline methods to get/set the accuracy of complex exponentials, logarithms and powers
+    void setAccuracy (MATH_ACCURACY a_) { 
+        if (!getIsRendering() && owns_equation) {
+            accuracy = a_;
+            if (main_equation != NULL) main_equation->setAccuracy (accuracy);
+        }
+    }
+
+    bool getUnrolled () { return unrolled; } // Inline methods to get/set whether the equation runs iterations in blocks between escape checks
+    void setUnrolled (bool u_) { 
+        if (!getIsRendering() && owns_equation) {
+            unrolled = u_;
+            if (main_equation != NULL) main_equation->setUnrolled (unrolled);
+        }
+    }
+
+    bool getInteriorDetection () { return interior_detection; } // Inline methods to get/set whether points detected as interior end iteration early
+    void setInteriorDetection (bool id_) { 
+        if (!getIsRendering() && owns_equation) {
+            interior_detection = id_;
+            if (main_equation != NULL) main_equation->setInteriorDetection (interior_detection);
+        }
+    }
+    long getInteriorExits () { return main_equation == NULL ? 0 : main_equation->getInteriorExits(); } // Get the number of pixels the last render ended early by interior detection, or every render using a shared equation
+
+    RENDER_STRATEGY getRenderStrategy () { return render_strategy; } // Inline methods to get/set how the pixels of each tile are iterated
+    void setRenderStrategy (RENDER_STRATEGY rs_) { if (!getIsRendering()) render_strategy = rs_; }
+
+    bool getDoubleLanes () { return double_lanes; } // Inline methods to get/set whether wavefront rendering may use double lanes
+    void setDoubleLanes (bool dl_) { if (!getIsRendering()) double_lanes = dl_; }
+
+    bool getUseSymmetry () { return use_symmetry; } // Inline methods to get/set whether symmetric images are only half computed
+    void setUseSymmetry (bool us_) { if (!getIsRendering()) use_symmetry = us_; }
+
+    bool getUseIntervals () { return use_intervals; } // Inline methods to get/set whether tiles are classified with interval arithmetic
+    void setUseIntervals (bool ui_) { if (!getIsRendering()) use_intervals = ui_; }
+
+    bool getVerbose () { return verbose; } // Inline methods to get/set whether render output is written to the terminal
+    void setVerbose (bool v_) { verbose = v_; }
+
+    bool getKeepState () { return keep_state; } // Inline methods to get/set whether per-pixel evaluation state is kept
+    void setKeepState (bool ks_) { if (!getIsRendering()) keep_state = ks_; }
+
+    HFractalMain* getReference () { return reference; } // Inline methods to get/set the finished render whose pixels may be reused, which must stay alive and unchanged while this environment renders
+    void setReference (HFractalMain *r_) { if (!getIsRendering() && r_ != this) reference = r_; }
+    long countReferencePixels (HFractalMain *); // Count the pixels a render with the current parameters could copy from a finished render
+
+    HFractalTileCache* getTileCache () { return tile_cache; } // Inline methods to get/set the tile cache, which may be shared between rendering environments
+    void setTileCache (HFractalTileCache *tc_) { if (!getIsRendering()) tile_cache = tc_; }
+
     bool isValidEquation () { return main_equation != NULL; } // Check if the equation the user entered was parsed correctly last time it was set
 
     bool getIsRendering() { return is_rendering; } // Get if there is currently a render happening in this environment
 
+    static int bytesPerPixel (PIXEL_FORMAT); // Get the number of bytes each pixel takes up in a pixel format
+    bool copyImage (void *, PIXEL_FORMAT, size_t, int); // Copy the generated image into a caller provided buffer with a given pixel format and row stride
+    int renderToBuffer (void *, PIXEL_FORMAT, size_t, int); // Render an image and copy it into a caller provided buffer
+
     uint32_t* getRGBAImage (int); // Return a pointer to a 32 bit RGBA formatted image, produced using a particular colour scheme preset, from the generated image
 
     float getImageCompletionPercentage (); // Get the current percentage of pixels that have been actually computed
 
     bool autoWriteImage (IMAGE_TYPE); // Automatically write out the render to desktop using a particular image type
+    bool writeImage (IMAGE_TYPE, std::string, int = 0); // Write out the render to a given path, without extension, using a particular image type and colour scheme
+    bool encodePNG (std::vector<uint8_t> &, int); // Encode the render as a colour PNG image in memory, using a particular colour scheme
 };
 #endif
\ No newline at end of file
@@ -3,8 +3,28 @@
 #include "image.hh"
 
 #include <ostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cfloat>
+#include <thread>
+#include <queue>
+#include <cstdlib>
 #include <math.h>
 
+/**
+ * @brief Colour every possible pixel value with a palette, so that images are coloured by table lookup rather than per pixel
+ * 
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit whose pixels are coloured black
+ * @return The colour of each value, packed as 0xRRGGBBAA
+ */
+static std::vector<uint32_t> makePalette (int colour_preset, int eval_limit) {
+    std::vector<uint32_t> palette (0x10000);
+    for (int v = 0; v < 0x10000; v++) palette[v] = (v == eval_limit) ? 0x000000ff : HFractalImage::colourFromValue (v, colour_preset);
+    return palette;
+}
+
 /**
  * @brief Set the value of a pixel, and automatically mark it as complete
  * 
@@ -13,7 +33,7 @@
  * @param p Value of the pixel to assign
  */
 void HFractalImage::set(int x, int y, uint16_t p) {
-    int offset = ((y*width)+x);
+    int64_t offset = ((int64_t)y*width)+x;
     data_image[offset] = p;
     completed[offset] = 2;
 }
@@ -26,7 +46,35 @@ void HFractalImage::set(int x, int y, uint16_t p) {
  * @return The value of the pixel at the coordinates
  */
 uint16_t HFractalImage::get(int x, int y) {
-    return data_image[(y*width)+x];
+    return data_image[((int64_t)y*width)+x];
+}
+
+/**
+ * @brief Set the evaluation state of a pixel, i.e. the last z value reached and the number of iterations it took to get there
+ * 
+ * @param x Horizontal coordinate
+ * @param y Vertical coordinate
+ * @param z Last z value of the pixel
+ * @param depth Number of iterations performed
+ */
+void HFractalImage::setState (int x, int y, std::complex<long double> z, int depth) {
+    int64_t offset = ((int64_t)y*width)+x;
+    state_z[offset] = z;
+    state_depth[offset] = depth;
+}
+
+/**
+ * @brief Get the evaluation state of a pixel. A depth of zero means the pixel has never been evaluated
+ * 
+ * @param x Horizontal coordinate
+ * @param y Vertical coordinate
+ * @param z Output for the last z value of the pixel
+ * @param depth Output for the number of iterations performed
+ */
+void HFractalImage::getState (int x, int y, std::complex<long double> &z, int &depth) {
+    int64_t offset = ((int64_t)y*width)+x;
+    z = state_z[offset];
+    depth = state_depth[offset];
 }
 
 /**
@@ -34,15 +82,23 @@ uint16_t HFractalImage::get(int x, int y) {
  * 
  * @param w Horizontal size
  * @param h Vertical size
+ * @param keep_state Whether to also store the evaluation state of each pixel, allowing the evaluation limit to be changed later without recomputing from scratch
  */
-HFractalImage::HFractalImage(int w, int h) {
+HFractalImage::HFractalImage(int w, int h, bool keep_state) {
     width = w;
     height = h;
     c_ind = 0; 
-    data_image = new uint16_t[width*height];
-    completed = new uint8_t[width*height];
+    data_image = new uint16_t[getPixelCount()];
+    completed = new uint8_t[getPixelCount()];
     // Clear both buffers
-    for (int i = 0; i < width*height; i++) { data_image[i] = 0xffff; completed[i] = 0; }
+    for (int64_t i = 0; i < getPixelCount(); i++) { data_image[i] = 0xffff; completed[i] = 0; }
+
+    // Allocate and clear the state buffers if requested
+    if (keep_state) {
+        state_z = new std::complex<long double>[getPixelCount()];
+        state_depth = new int[getPixelCount()];
+        for (int64_t i = 0; i < getPixelCount(); i++) state_depth[i] = 0;
+    }
 }
 
 /**
@@ -56,27 +112,255 @@ bool HFractalImage::writePGM (std::string path) {
     if (!isDone()) return false;
     FILE *img_file;
     img_file = fopen(path.c_str(),"wb");
+    if (img_file == NULL) return false;
+
+    // Write the header, then each pixel
+    bool success = writePGMHeader (img_file, width, height) && writePGMRows (img_file);
+
+    // Close and return success
+    success &= fclose(img_file) == 0;
+    return success;
+}
+
+/**
+ * @brief Write the header of a 16 bit PGM file
+ * 
+ * @param img_file Open file to write to
+ * @param w Width of the image
+ * @param h Height of the image
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writePGMHeader (FILE *img_file, int w, int h) {
+    return fprintf(img_file,"P5\n%d %d\n65535\n",w,h) > 0;
+}
 
-    // Write the header
-    fprintf(img_file,"P5\n");
-    fprintf(img_file,"%d %d\n",width,height);
-    fprintf(img_file,"65535\n");
+/**
+ * @brief Write the pixel data of every row of the image to an open PGM file, after its header or after the rows of the band above. Values are written most significant byte first, as the format requires
+ * 
+ * @param img_file Open file to write to
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writePGMRows (FILE *img_file) {
+    return writeRows (img_file, false, 0, 0);
+}
 
-    // Write each pixel
-    for(int y = 0; y < height; y++){
-        for(int x = 0; x < width; x++){
-            uint16_t p = data_image[(y*width)+x];
-           
-            fputc (p & 0x00ff, img_file);
-            fputc ((p & 0xff00) >> 8, img_file);
+/**
+ * @brief Write the contents of the image buffer out to a binary PPM file, colouring each value with a palette as the GUI does
+ * 
+ * @param path Path to the output file
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writePPM (std::string path, int colour_preset, int eval_limit) {
+    if (!isDone()) return false;
+    FILE *img_file = fopen (path.c_str(), "wb");
+    if (img_file == NULL) return false;
+    bool success = fprintf (img_file, "P6\n%d %d\n255\n", width, height) > 0;
+    success &= writeRows (img_file, true, colour_preset, eval_limit);
+    success &= fclose (img_file) == 0;
+    return success;
+}
+
+/**
+ * @brief Convert a range of rows to the byte layout of PGM or PPM pixel data
+ * 
+ * @param start_y First row to convert
+ * @param end_y Row after the last row to convert
+ * @param out Buffer for the converted rows, holding 2 bytes per pixel for grey or 3 for colour
+ * @param palette Colour of every possible value, packed as 0xRRGGBBAA, or NULL to convert to 16 bit grey values
+ */
+void HFractalImage::convertRows (int start_y, int end_y, uint8_t *out, const uint32_t *palette) {
+    for (int y = start_y; y < end_y; y++) {
+        const uint16_t *row = data_image + ((int64_t)y*width);
+        for (int x = 0; x < width; x++) {
+            uint16_t p = row[x];
+            if (palette == NULL) {
+                *out++ = p >> 8;
+                *out++ = p & 0xff;
+                continue;
+            }
+            uint32_t col = palette[p];
+            *out++ = col >> 24;
+            *out++ = (col >> 16) & 0xff;
+            *out++ = (col >> 8) & 0xff;
         }
     }
+}
 
-    // Close and return success
-    fclose(img_file);
+/**
+ * @brief Convert every row of the image and write it to an open file. Rows are converted in blocks of about WRITE_BLOCK_BYTES, with each block split across threads and then written with a single call
+ * 
+ * @param img_file Open file to write to
+ * @param colour Whether to write 8 bit RGB colours rather than 16 bit grey values
+ * @param colour_preset Colour palette preset to use for colours
+ * @param eval_limit Evaluation limit whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writeRows (FILE *img_file, bool colour, int colour_preset, int eval_limit) {
+    size_t row_bytes = (size_t)width*(colour ? 3 : 2);
+    if (row_bytes == 0) return true;
+    int block_rows = std::max (1, std::min (height, (int)(WRITE_BLOCK_BYTES/row_bytes)));
+    std::vector<uint8_t> buffer (block_rows*row_bytes);
+    int max_threads = std::max (1, (int)std::thread::hardware_concurrency());
+
+    std::vector<uint32_t> palette;
+    if (colour) palette = makePalette (colour_preset, eval_limit);
+
+    for (int block_y = 0; block_y < height; block_y += block_rows) {
+        int rows = std::min (block_rows, height-block_y);
+        int threads = std::max (1, std::min (max_threads, (int)(((int64_t)rows*width)/WRITE_MIN_THREAD_PIXELS)));
+        int rows_per_thread = (rows+threads-1)/threads;
+        std::vector<std::thread> converters;
+        for (int start = 0; start < rows; start += rows_per_thread) {
+            int end = std::min (start+rows_per_thread, rows);
+            uint8_t *out = buffer.data() + (start*row_bytes);
+            const uint32_t *colours = colour ? palette.data() : NULL;
+            if (end == rows) convertRows (block_y+start, block_y+end, out, colours);
+            else converters.push_back (std::thread (&HFractalImage::convertRows, this, block_y+start, block_y+end, out, colours));
+        }
+        for (auto &th : converters) th.join();
+        if (fwrite (buffer.data(), row_bytes, rows, img_file) != (size_t)rows) return false;
+    }
     return true;
 }
 
+/**
+ * @brief Write the contents of the image buffer out to a colour PNG file, colouring each value with a palette as the GUI does. Bands of rows are encoded in parallel
+ * 
+ * @param path Path to the output file
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writePNG (std::string path, int colour_preset, int eval_limit) {
+    if (!isDone()) return false;
+    HFractalPNGWriter writer;
+    if (!writer.open (path, width, height, colour_preset, eval_limit)) return false;
+    int threads = std::max (1, std::min ((int)std::thread::hardware_concurrency(), writer.getBandCount()));
+    std::vector<std::thread> encoders;
+    for (int i = 1; i < threads; i++) encoders.push_back (std::thread (&HFractalPNGWriter::encodeRemaining, &writer, this));
+    writer.encodeRemaining (this);
+    for (auto &th : encoders) th.join();
+    return writer.close();
+}
+
+/**
+ * @brief Encode the contents of the image buffer as a colour PNG image in memory. Unlike writePNG, every band is encoded on the calling thread, for callers which already keep every core busy
+ * 
+ * @param buffer Buffer to append the encoded image to
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalImage::encodePNG (std::vector<uint8_t> &buffer, int colour_preset, int eval_limit) {
+    if (!isDone()) return false;
+    HFractalPNGWriter writer;
+    if (!writer.open (&buffer, width, height, colour_preset, eval_limit)) return false;
+    writer.encodeRemaining (this);
+    return writer.close();
+}
+
+/**
+ * @brief Write the image to a tiled iteration buffer file, which records the render parameters in its header and stores each tile separately, so that readers can map the file and use any tile without reading the rest.
+ * Tiles are stored as plain values, or when compression is requested and it makes them smaller, as runs of equal values
+ * 
+ * @param path Path to the output file
+ * @param spec Parameters of the render, recorded in the header
+ * @param compress Whether tiles may be run length encoded
+ * @return True for success, false for failure
+ */
+bool HFractalImage::writeRaw (std::string path, const HFractalRawSpec &spec, bool compress) {
+    if (!isDone()) return false;
+    FILE *raw_file = fopen (path.c_str(), "wb");
+    if (raw_file == NULL) return false;
+
+    // Fill the header, with the exact parameters written as decimal strings
+    HFractalRawHeader header;
+    memset (&header, 0, sizeof (header));
+    strncpy (header.magic, RAW_MAGIC, sizeof (header.magic));
+    header.version = RAW_VERSION;
+    header.header_size = sizeof (HFractalRawHeader);
+    header.width = width;
+    header.height = height;
+    header.tile_size = TILE_SIZE;
+    header.compressed = compress;
+    header.eval_limit = spec.eval_limit;
+    header.accuracy = spec.accuracy;
+    header.render_strategy = spec.render_strategy;
+    header.equation_length = spec.equation.length();
+    header.precision_bits = LDBL_MANT_DIG;
+    header.offset_x_approx = spec.offset_x;
+    header.offset_y_approx = spec.offset_y;
+    header.zoom_approx = spec.zoom;
+    snprintf (header.offset_x, sizeof (header.offset_x), "%.*Le", LDBL_DECIMAL_DIG, spec.offset_x);
+    snprintf (header.offset_y, sizeof (header.offset_y), "%.*Le", LDBL_DECIMAL_DIG, spec.offset_y);
+    snprintf (header.zoom, sizeof (header.zoom), "%.*Le", LDBL_DECIMAL_DIG, spec.zoom);
+    uint64_t position = sizeof (header) + header.equation_length;
+    position = ((position+RAW_ALIGNMENT-1)/RAW_ALIGNMENT)*RAW_ALIGNMENT;
+    header.index_offset = position;
+
+    int tiles_x = (width+TILE_SIZE-1)/TILE_SIZE;
+    int tiles_y = (height+TILE_SIZE-1)/TILE_SIZE;
+    std::vector<HFractalRawTileEntry> index (tiles_x*tiles_y);
+    position += index.size()*sizeof (HFractalRawTileEntry);
+
+    // The index is written once every tile's size is known, so leave space for it
+    bool success = fwrite (&header, sizeof (header), 1, raw_file) == 1;
+    success &= fwrite (spec.equation.data(), 1, header.equation_length, raw_file) == header.equation_length;
+    // The padding buffer is also used to align each tile, so it holds at least RAW_ALIGNMENT bytes
+    size_t gap = position - sizeof (header) - header.equation_length;
+    std::vector<uint8_t> padding (std::max (gap, (size_t)RAW_ALIGNMENT), 0);
+    success &= fwrite (padding.data(), 1, gap, raw_file) == gap;
+
+    std::vector<uint16_t> values;
+    std::vector<uint16_t> runs;
+    for (int tile = 0; tile < tiles_x*tiles_y && success; tile++) {
+        // Files always start their grid at the top-left pixel, whatever grid the image was rendered with
+        int tile_x = (tile%tiles_x)*TILE_SIZE;
+        int tile_y = (tile/tiles_x)*TILE_SIZE;
+        int tile_w = std::min (TILE_SIZE, width-tile_x);
+        int tile_h = std::min (TILE_SIZE, height-tile_y);
+        values.resize (tile_w*tile_h);
+        getTile (tile_x, tile_y, tile_w, tile_h, values.data());
+
+        // Encode runs of equal values, giving up as soon as the runs are no smaller than the plain values
+        runs.clear();
+        if (compress) {
+            for (size_t i = 0; i < values.size() && runs.size() < values.size(); ) {
+                size_t run = 1;
+                while (i+run < values.size() && values[i+run] == values[i] && run < 0xffff) run++;
+                runs.push_back (run);
+                runs.push_back (values[i]);
+                i += run;
+            }
+        }
+        bool use_runs = compress && runs.size() < values.size();
+        const std::vector<uint16_t> &data = use_runs ? runs : values;
+
+        index[tile].offset = position;
+        index[tile].size = data.size()*sizeof (uint16_t);
+        index[tile].encoding = use_runs ? RE_RLE : RE_PLAIN;
+        success &= fwrite (data.data(), sizeof (uint16_t), data.size(), raw_file) == data.size();
+        position += index[tile].size;
+
+        // Keep the next tile aligned
+        size_t pad = (RAW_ALIGNMENT - (position % RAW_ALIGNMENT)) % RAW_ALIGNMENT;
+        success &= fwrite (padding.data(), 1, pad, raw_file) == pad;
+        position += pad;
+    }
+
+    // long is 32 bits on Windows, so seek with a 64 bit offset
+    #ifdef _WIN32
+    success &= _fseeki64 (raw_file, (int64_t)header.index_offset, SEEK_SET) == 0;
+    #else
+    success &= fseeko (raw_file, (off_t)header.index_offset, SEEK_SET) == 0;
+    #endif
+    success &= fwrite (index.data(), sizeof (HFractalRawTileEntry), index.size(), raw_file) == index.size();
+    success &= fclose (raw_file) == 0;
+    return success;
+}
+
 /**
  * @brief Create an RGBA 32 bit colour from hue, saturation, value components
  * 
@@ -162,8 +446,10 @@ uint32_t HFractalImage::colourFromValue (uint16_t value, int colour_preset) {
  * @brief Destroy the image class, freeing the buffers
  */
 HFractalImage::~HFractalImage () {
-    free (data_image);
-    free (completed);
+    delete[] data_image;
+    delete[] completed;
+    if (state_z != NULL) delete[] state_z;
+    if (state_depth != NULL) delete[] state_depth;
 }
 
 /**
@@ -171,12 +457,12 @@ HFractalImage::~HFractalImage () {
  * 
  * @return The index of the next pixel to compute, -1 if there is no available pixel
  */
-int HFractalImage::getUncompleted () {
+int64_t HFractalImage::getUncompleted () {
     // Lock resources to prevent collisions
     mut.lock();
-    int i = -1;
+    int64_t i = -1;
     // Find the next available pixel index and increment c_ind
-    if (c_ind < height*width) {
+    if (c_ind < getPixelCount()) {
         i = c_ind;
         c_ind++;
     }
@@ -185,6 +471,74 @@ int HFractalImage::getUncompleted () {
     return i;
 }
 
+/**
+ * @brief Fetch the index of the next tile which needs to be computed. Tiles are numbered row by row, and are TILE_SIZE square except where they are clipped by the edges of the image
+ * 
+ * @return The index of the next tile to compute, -1 if there is no available tile
+ */
+int HFractalImage::getUncompletedTile () {
+    // Lock resources to prevent collisions
+    mut.lock();
+    int i = -1;
+    // Find the next available tile index, and advance both t_ind and c_ind so that progress is still measured in pixels
+    if (t_ind < getTileCount()) {
+        i = t_ind;
+        t_ind++;
+        int x, y, w, h;
+        getTileBounds (i, x, y, w, h);
+        c_ind += w*h;
+    }
+    // Unlock before returning
+    mut.unlock();
+    return i;
+}
+
+/**
+ * @brief Get the position and size of a tile
+ * 
+ * @param tile Index of the tile
+ * @param x Output for the horizontal coordinate of the top-left pixel
+ * @param y Output for the vertical coordinate of the top-left pixel
+ * @param w Output for the width of the tile
+ * @param h Output for the height of the tile
+ */
+void HFractalImage::getTileBounds (int tile, int &x, int &y, int &w, int &h) {
+    int tiles_x = getTileColumns();
+    // When the grid is shifted, the first column and row hold the clipped tiles before the origin
+    int start_x = tile_origin_x + ((tile%tiles_x) - (tile_origin_x > 0))*TILE_SIZE;
+    int start_y = tile_origin_y + ((tile/tiles_x) - (tile_origin_y > 0))*TILE_SIZE;
+    x = std::max (start_x, 0);
+    y = std::max (start_y, 0);
+    w = std::min (start_x+TILE_SIZE, width) - x;
+    h = std::min (start_y+TILE_SIZE, height) - y;
+}
+
+/**
+ * @brief Shift the grid of tiles so that a tile starts at the given pixel, with tiles crossing the edges of the image clipped. Must be called before any tiles are fetched
+ * 
+ * @param x Horizontal coordinate of a pixel at the top-left of a tile, which may lie outside the image
+ * @param y Vertical coordinate of a pixel at the top-left of a tile, which may lie outside the image
+ */
+void HFractalImage::setTileOrigin (int x, int y) {
+    tile_origin_x = ((x%TILE_SIZE)+TILE_SIZE)%TILE_SIZE;
+    tile_origin_y = ((y%TILE_SIZE)+TILE_SIZE)%TILE_SIZE;
+}
+
+/**
+ * @brief Copy the values of a rectangular block of pixels into a buffer
+ * 
+ * @param x Horizontal coordinate of the top-left pixel
+ * @param y Vertical coordinate of the top-left pixel
+ * @param w Width of the block
+ * @param h Height of the block
+ * @param values Buffer to copy pixel values into, row by row, which must hold at least w*h values
+ */
+void HFractalImage::getTile (int x, int y, int w, int h, uint16_t *values) {
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++) values[(j*w)+i] = get (x+i, y+j);
+    }
+}
+
 /**
  * @brief Check every pixel to see if the image is fully computed. Use with caution, especially with large images
  * 
@@ -192,7 +546,7 @@ int HFractalImage::getUncompleted () {
  */
 bool HFractalImage::isDone () {
     // Iterate over every pixel to check its status
-    for (int i = 0; i < height*width; i++) {
+    for (int64_t i = 0; i < getPixelCount(); i++) {
         if (completed[i] != 2) {
             // Fail if the pixel is not complete
             return false;
@@ -207,4 +561,613 @@ bool HFractalImage::isDone () {
  * 
  * @return The current completion index
  */
-int HFractalImage::getInd () { return c_ind; }
\ No newline at end of file
+int64_t HFractalImage::getInd () { return c_ind; }
+
+/**
+ * @brief Mark every pixel as uncomputed and reset the completion index, without clearing pixel values or evaluation state
+ * 
+ */
+void HFractalImage::restart () {
+    mut.lock();
+    c_ind = 0;
+    t_ind = 0;
+    for (int64_t i = 0; i < getPixelCount(); i++) completed[i] = 0;
+    mut.unlock();
+}
+// Base lengths and extra bits of the deflate length codes 257 to 285
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+// Base distances and extra bits of the deflate distance codes 0 to 29
+static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// Order the lengths of the code length codes are stored in
+static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+#define DEFLATE_WINDOW 32768 // Largest distance back a deflate match can refer to
+#define DEFLATE_HASH_BITS 15 // Number of bits of the hash used to find earlier occurrences of three bytes
+
+// Struct describing a literal byte, or a match of an earlier string, in deflate compressed data
+struct DeflateSymbol {
+    uint16_t value; // Literal byte, or length of the match
+    uint16_t distance; // Distance back to the match, or 0 for a literal
+};
+
+// Struct appending bits to a buffer in the least significant bit first order deflate uses
+struct DeflateBitWriter {
+    std::vector<uint8_t> &out; // Buffer to append complete bytes to
+    uint64_t bits = 0; // Bits not yet appended
+    int count = 0; // Number of bits not yet appended
+
+    DeflateBitWriter (std::vector<uint8_t> &out_) : out (out_) {}
+    void put (uint32_t value, int n) {
+        bits |= (uint64_t)value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back (bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    void align () { if (count > 0) put (0, 8-count); }
+};
+
+/**
+ * @brief Build the CRC-32 lookup table used by PNG chunks
+ * 
+ * @return The CRC of each byte value
+ */
+static std::vector<uint32_t> makeCRCTable () {
+    std::vector<uint32_t> table (256);
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}
+
+static const std::vector<uint32_t> CRC_TABLE = makeCRCTable ();
+
+/**
+ * @brief Continue a CRC-32 over more bytes
+ * 
+ * @param crc CRC of the bytes so far, 0 for none
+ * @param data Bytes to add
+ * @param length Number of bytes to add
+ * @return CRC of all the bytes
+ */
+static uint32_t crc32 (uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = CRC_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+ * @brief Continue an Adler-32 checksum over more bytes
+ * 
+ * @param adler Checksum of the bytes so far, 1 for none
+ * @param data Bytes to add
+ * @param length Number of bytes to add
+ * @return Checksum of all the bytes
+ */
+static uint32_t adler32 (uint32_t adler, const uint8_t *data, size_t length) {
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (length > 0) {
+        // 5552 bytes is the most that can be summed before b could overflow
+        size_t n = std::min (length, (size_t)5552);
+        for (size_t i = 0; i < n; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        length -= n;
+    }
+    return (b << 16) | a;
+}
+
+/**
+ * @brief Find the Adler-32 checksum of two runs of bytes joined together from the checksum of each, so that runs can be checksummed in parallel
+ * 
+ * @param adler_1 Checksum of the first run
+ * @param adler_2 Checksum of the second run
+ * @param length_2 Length of the second run
+ * @return Checksum of the joined runs
+ */
+static uint32_t adler32Combine (uint32_t adler_1, uint32_t adler_2, size_t length_2) {
+    const uint32_t base = 65521;
+    uint32_t rem = length_2 % base;
+    uint32_t a = adler_1 & 0xffff;
+    uint32_t b = (uint32_t)(((uint64_t)rem*a) % base);
+    a += (adler_2 & 0xffff) + base - 1;
+    b += (adler_1 >> 16) + (adler_2 >> 16) + base - rem;
+    if (a >= base) a -= base;
+    if (a >= base) a -= base;
+    if (b >= 2*base) b -= 2*base;
+    if (b >= base) b -= base;
+    return (b << 16) | a;
+}
+
+/**
+ * @brief Choose the length of the Huffman code of each symbol from how often it occurs, limiting lengths to a maximum by flattening the frequencies until the tree is shallow enough
+ * 
+ * @param freqs Number of occurrences of each symbol
+ * @param max_bits Longest code allowed
+ * @param lengths Output for the code length of each symbol, 0 for symbols which never occur
+ */
+static void buildCodeLengths (std::vector<uint32_t> freqs, int max_bits, std::vector<uint8_t> &lengths) {
+    int symbols = freqs.size();
+    lengths.assign (symbols, 0);
+    while (true) {
+        // Leaves are the symbols, and each merge of the two least frequent nodes adds a parent
+        std::vector<int> parent;
+        std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>, std::greater<std::pair<uint64_t, int>>> nodes;
+        std::vector<int> leaves;
+        for (int i = 0; i < symbols; i++) {
+            if (freqs[i] == 0) continue;
+            nodes.push ({ freqs[i], (int)parent.size() });
+            leaves.push_back (i);
+            parent.push_back (-1);
+        }
+        // Decoders are only guaranteed to accept complete codes, so a lone symbol is paired with an unused one
+        if (leaves.size() == 1) {
+            lengths[leaves[0]] = 1;
+            lengths[leaves[0] == 0 ? 1 : 0] = 1;
+            return;
+        }
+        while (nodes.size() > 1) {
+            auto a = nodes.top(); nodes.pop();
+            auto b = nodes.top(); nodes.pop();
+            int node = parent.size();
+            parent.push_back (-1);
+            parent[a.second] = node;
+            parent[b.second] = node;
+            nodes.push ({ a.first+b.first, node });
+        }
+        // Parents always come after their children, so depths are found walking backwards from the root
+        std::vector<int> depth (parent.size(), 0);
+        for (int i = (int)parent.size()-2; i >= 0; i--) depth[i] = depth[parent[i]]+1;
+        int deepest = 0;
+        for (size_t i = 0; i < leaves.size(); i++) deepest = std::max (deepest, depth[i]);
+        if (deepest <= max_bits) {
+            for (size_t i = 0; i < leaves.size(); i++) lengths[leaves[i]] = depth[i];
+            return;
+        }
+        for (auto &f : freqs) if (f != 0) f = (f >> 1) | 1;
+    }
+}
+
+/**
+ * @brief Assign canonical Huffman codes from code lengths, bit reversed so that they can be written least significant bit first
+ * 
+ * @param lengths Code length of each symbol
+ * @param codes Output for the code of each symbol
+ */
+static void buildCodes (const std::vector<uint8_t> &lengths, std::vector<uint16_t> &codes) {
+    int count[16] = { 0 };
+    for (auto l : lengths) count[l]++;
+    count[0] = 0;
+    int next[16] = { 0 };
+    for (int bits = 1, code = 0; bits < 16; bits++) {
+        code = (code + count[bits-1]) << 1;
+        next[bits] = code;
+    }
+    codes.assign (lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); i++) {
+        int l = lengths[i];
+        if (l == 0) continue;
+        int code = next[l]++;
+        int reversed = 0;
+        for (int b = 0; b < l; b++) reversed |= ((code >> b) & 1) << (l-1-b);
+        codes[i] = reversed;
+    }
+}
+
+/**
+ * @brief Get the deflate length code of a match length
+ * 
+ * @param length Length of the match, from 3 to 258
+ * @return Index of the code, from 0 for symbol 257
+ */
+static int lengthCode (int length) {
+    int code = 28;
+    while (LENGTH_BASE[code] > length) code--;
+    return code;
+}
+
+/**
+ * @brief Get the deflate distance code of a match distance
+ * 
+ * @param distance Distance back to the match, from 1 to DEFLATE_WINDOW
+ * @return The distance code
+ */
+static int distanceCode (int distance) {
+    int code = 29;
+    while (DISTANCE_BASE[code] > distance) code--;
+    return code;
+}
+
+/**
+ * @brief Write a non-final deflate block compressed with Huffman codes built for its own symbols
+ * 
+ * @param writer Bit writer to write the block with
+ * @param symbols Literals and matches to write
+ * @param start Index of the first symbol of the block
+ * @param end Index after the last symbol of the block
+ */
+static void writeDeflateBlock (DeflateBitWriter &writer, const std::vector<DeflateSymbol> &symbols, size_t start, size_t end) {
+    std::vector<uint32_t> literal_freqs (286, 0);
+    std::vector<uint32_t> distance_freqs (30, 0);
+    for (size_t i = start; i < end; i++) {
+        if (symbols[i].distance == 0) literal_freqs[symbols[i].value]++;
+        else {
+            literal_freqs[257+lengthCode (symbols[i].value)]++;
+            distance_freqs[distanceCode (symbols[i].distance)]++;
+        }
+    }
+    literal_freqs[256] = 1;
+    if (distance_freqs[0] == 0) distance_freqs[0] = 1;
+    std::vector<uint8_t> literal_lengths, distance_lengths;
+    buildCodeLengths (literal_freqs, 15, literal_lengths);
+    buildCodeLengths (distance_freqs, 15, distance_lengths);
+    int literal_count = 286;
+    while (literal_count > 257 && literal_lengths[literal_count-1] == 0) literal_count--;
+    int distance_count = 30;
+    while (distance_count > 1 && distance_lengths[distance_count-1] == 0) distance_count--;
+
+    // Run length encode the code lengths of both codes, as pairs of code length symbol and repeat count
+    std::vector<uint8_t> all_lengths (literal_lengths.begin(), literal_lengths.begin()+literal_count);
+    all_lengths.insert (all_lengths.end(), distance_lengths.begin(), distance_lengths.begin()+distance_count);
+    std::vector<std::pair<int, int>> runs;
+    for (size_t i = 0; i < all_lengths.size(); ) {
+        int value = all_lengths[i];
+        int run = 1;
+        while (i+run < all_lengths.size() && all_lengths[i+run] == value) run++;
+        i += run;
+        if (value == 0) {
+            for (; run >= 11; run -= std::min (run, 138)) runs.push_back ({ 18, std::min (run, 138)-11 });
+            if (run >= 3) runs.push_back ({ 17, run-3 });
+            else for (; run > 0; run--) runs.push_back ({ 0, 0 });
+        } else {
+            runs.push_back ({ value, 0 });
+            for (run--; run >= 3; run -= std::min (run, 6)) runs.push_back ({ 16, std::min (run, 6)-3 });
+            for (; run > 0; run--) runs.push_back ({ value, 0 });
+        }
+    }
+    std::vector<uint32_t> length_freqs (19, 0);
+    for (auto &r : runs) length_freqs[r.first]++;
+    std::vector<uint8_t> length_lengths;
+    buildCodeLengths (length_freqs, 7, length_lengths);
+    int length_count = 19;
+    while (length_count > 4 && length_lengths[CODE_LENGTH_ORDER[length_count-1]] == 0) length_count--;
+
+    std::vector<uint16_t> literal_codes, distance_codes, length_codes;
+    buildCodes (literal_lengths, literal_codes);
+    buildCodes (distance_lengths, distance_codes);
+    buildCodes (length_lengths, length_codes);
+
+    // Block header, then the code lengths, then the compressed symbols
+    writer.put (0, 1);
+    writer.put (2, 2);
+    writer.put (literal_count-257, 5);
+    writer.put (distance_count-1, 5);
+    writer.put (length_count-4, 4);
+    for (int i = 0; i < length_count; i++) writer.put (length_lengths[CODE_LENGTH_ORDER[i]], 3);
+    for (auto &r : runs) {
+        writer.put (length_codes[r.first], length_lengths[r.first]);
+        if (r.first == 16) writer.put (r.second, 2);
+        else if (r.first == 17) writer.put (r.second, 3);
+        else if (r.first == 18) writer.put (r.second, 7);
+    }
+    for (size_t i = start; i < end; i++) {
+        const DeflateSymbol &symbol = symbols[i];
+        if (symbol.distance == 0) {
+            writer.put (literal_codes[symbol.value], literal_lengths[symbol.value]);
+            continue;
+        }
+        int l = lengthCode (symbol.value);
+        writer.put (literal_codes[257+l], literal_lengths[257+l]);
+        writer.put (symbol.value-LENGTH_BASE[l], LENGTH_EXTRA[l]);
+        int d = distanceCode (symbol.distance);
+        writer.put (distance_codes[d], distance_lengths[d]);
+        writer.put (symbol.distance-DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+    }
+    writer.put (literal_codes[256], literal_lengths[256]);
+}
+
+/**
+ * @brief Deflate compress a run of bytes without referring to any data before it, ending with a sync flush so the output finishes on a byte boundary and can be followed by further compressed runs in the same stream
+ * 
+ * @param data Bytes to compress
+ * @param length Number of bytes
+ * @param out Buffer to append the compressed data to
+ */
+static void deflateRun (const uint8_t *data, size_t length, std::vector<uint8_t> &out) {
+    // Greedily match each position against the longest string found among recent earlier positions with the same first three bytes
+    std::vector<DeflateSymbol> symbols;
+    std::vector<int32_t> head (1 << DEFLATE_HASH_BITS, -1);
+    std::vector<int32_t> previous (DEFLATE_WINDOW, -1);
+    auto hash = [&](size_t i) { return (((uint32_t)data[i] << 16 | (uint32_t)data[i+1] << 8 | data[i+2])*2654435761u) >> (32-DEFLATE_HASH_BITS); };
+    auto insert = [&](size_t i) {
+        uint32_t h = hash (i);
+        previous[i % DEFLATE_WINDOW] = head[h];
+        head[h] = i;
+    };
+    for (size_t i = 0; i < length; ) {
+        size_t best_length = 0;
+        size_t best_distance = 0;
+        if (i+3 <= length) {
+            size_t max_length = std::min ((size_t)258, length-i);
+            int32_t candidate = head[hash (i)];
+            for (int chain = 0; chain < PNG_MAX_CHAIN && candidate >= 0 && i-candidate <= DEFLATE_WINDOW; chain++) {
+                if (data[candidate+best_length] == data[i+best_length]) {
+                    size_t l = 0;
+                    while (l < max_length && data[candidate+l] == data[i+l]) l++;
+                    if (l > best_length) {
+                        best_length = l;
+                        best_distance = i-candidate;
+                        if (l == max_length) break;
+                    }
+                }
+                // Entries older than the window may have been overwritten by newer positions, which ends the chain
+                int32_t next = previous[candidate % DEFLATE_WINDOW];
+                if (next >= candidate) break;
+                candidate = next;
+            }
+        }
+        if (best_length >= 3) {
+            symbols.push_back ({ (uint16_t)best_length, (uint16_t)best_distance });
+            for (size_t end = i+best_length; i < end; i++) if (i+3 <= length) insert (i);
+        } else {
+            symbols.push_back ({ data[i], 0 });
+            if (i+3 <= length) insert (i);
+            i++;
+        }
+    }
+
+    DeflateBitWriter writer (out);
+    for (size_t start = 0; start < symbols.size(); start += PNG_BLOCK_SYMBOLS) writeDeflateBlock (writer, symbols, start, std::min (symbols.size(), start+PNG_BLOCK_SYMBOLS));
+    // Empty stored block as a sync flush
+    writer.put (0, 3);
+    writer.align ();
+    out.insert (out.end(), { 0x00, 0x00, 0xff, 0xff });
+}
+
+/**
+ * @brief Predict each byte of a row from its neighbours with whichever PNG filter gives the smallest residuals
+ * 
+ * @param row Bytes of the row
+ * @param above Bytes of the row above, or NULL if it is unavailable, in which case only filters not using it are tried
+ * @param row_bytes Number of bytes in the row
+ * @param bpp Number of bytes per pixel
+ * @param out Buffer for the filter type followed by the filtered bytes
+ */
+static void filterRow (const uint8_t *row, const uint8_t *above, size_t row_bytes, int bpp, uint8_t *out) {
+    auto predict = [&](int filter, size_t i) -> uint8_t {
+        int a = i >= (size_t)bpp ? row[i-bpp] : 0;
+        int b = above != NULL ? above[i] : 0;
+        int c = (above != NULL && i >= (size_t)bpp) ? above[i-bpp] : 0;
+        switch (filter) {
+        case 1: return a;
+        case 2: return b;
+        case 3: return (a+b) >> 1;
+        case 4: {
+            int p = a+b-c;
+            int pa = abs (p-a), pb = abs (p-b), pc = abs (p-c);
+            return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+        }
+        default: return 0;
+        }
+    };
+    // Smallest sum of residuals as signed bytes, the usual heuristic for the most compressible filter
+    int best_filter = 0;
+    uint64_t best_sum = UINT64_MAX;
+    for (int filter = 0; filter < (above != NULL ? 5 : 2); filter++) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < row_bytes; i++) sum += abs ((int8_t)(uint8_t)(row[i]-predict (filter, i)));
+        if (sum < best_sum) {
+            best_sum = sum;
+            best_filter = filter;
+        }
+    }
+    out[0] = best_filter;
+    for (size_t i = 0; i < row_bytes; i++) out[i+1] = row[i]-predict (best_filter, i);
+}
+
+/**
+ * @brief Append a 32 bit value to a buffer in big endian order, as PNG files store them
+ * 
+ * @param out Buffer to append to
+ * @param value Value to append
+ */
+static void appendBigEndian (std::vector<uint8_t> &out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back ((value >> shift) & 0xff);
+}
+
+/**
+ * @brief Create a PNG file and write its signature, header and the start of the zlib stream, ready for bands to be encoded
+ * 
+ * @param path Path to the output file
+ * @param w Width of the image
+ * @param h Height of the image
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalPNGWriter::open (std::string path, int w, int h, int colour_preset, int eval_limit) {
+    close ();
+    if (w <= 0 || h <= 0) return false;
+    png_file = fopen (path.c_str(), "wb");
+    if (png_file == NULL) return false;
+    return start (w, h, colour_preset, eval_limit);
+}
+
+/**
+ * @brief Start encoding a PNG image into a buffer rather than a file, writing its signature, header and the start of the zlib stream
+ * 
+ * @param buffer Buffer to append the image to, which must stay alive until the writer is closed
+ * @param w Width of the image
+ * @param h Height of the image
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalPNGWriter::open (std::vector<uint8_t> *buffer, int w, int h, int colour_preset, int eval_limit) {
+    close ();
+    if (w <= 0 || h <= 0 || buffer == NULL) return false;
+    png_buffer = buffer;
+    return start (w, h, colour_preset, eval_limit);
+}
+
+/**
+ * @brief Reset band progress for an image of a given size, and write everything before the pixel data to the open file or buffer
+ * 
+ * @param w Width of the image
+ * @param h Height of the image
+ * @param colour_preset Colour palette preset to use
+ * @param eval_limit Evaluation limit of the render, whose pixels are coloured black
+ * @return True for success, false for failure
+ */
+bool HFractalPNGWriter::start (int w, int h, int colour_preset, int eval_limit) {
+    width = w;
+    height = h;
+    palette = makePalette (colour_preset, eval_limit);
+    band_chunks.assign (getBandCount(), std::vector<uint8_t>());
+    band_adler.assign (getBandCount(), 1);
+    band_lengths.assign (getBandCount(), 0);
+    band_encoded.assign (getBandCount(), false);
+    next_unencoded = 0;
+    next_band = 0;
+    adler = 1;
+    failed = false;
+
+    const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    failed |= !output (signature, sizeof (signature));
+    // 8 bit RGB, not interlaced
+    std::vector<uint8_t> header;
+    appendBigEndian (header, width);
+    appendBigEndian (header, height);
+    header.insert (header.end(), { 8, 2, 0, 0, 0 });
+    failed |= !writeChunk ("IHDR", header.data(), header.size());
+    // zlib header for deflate with a 32K window
+    const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    failed |= !writeChunk ("IDAT", zlib_header, sizeof (zlib_header));
+    return !failed;
+}
+
+/**
+ * @brief Write bytes to the end of the open file or buffer
+ * 
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @return True for success, false for failure
+ */
+bool HFractalPNGWriter::output (const uint8_t *data, size_t length) {
+    if (png_buffer != NULL) {
+        png_buffer->insert (png_buffer->end(), data, data+length);
+        return true;
+    }
+    return fwrite (data, 1, length, png_file) == length;
+}
+
+/**
+ * @brief Write a chunk to the file
+ * 
+ * @param type Four letter chunk type
+ * @param data Data of the chunk
+ * @param length Length of the data
+ * @return True for success, false for failure
+ */
+bool HFractalPNGWriter::writeChunk (const char *type, const uint8_t *data, size_t length) {
+    std::vector<uint8_t> chunk;
+    chunk.reserve (length+12);
+    appendBigEndian (chunk, length);
+    chunk.insert (chunk.end(), type, type+4);
+    chunk.insert (chunk.end(), data, data+length);
+    appendBigEndian (chunk, crc32 (0, chunk.data()+4, length+4));
+    return output (chunk.data(), chunk.size());
+}
+
+/**
+ * @brief Filter and compress one band of rows into a complete IDAT chunk, then write it along with any later bands which were waiting for it.
+ * The first row of each band is filtered without the row above, so that bands do not depend on each other
+ * 
+ * @param band Index of the band
+ * @param image Image to encode, whose rows in the band must all be computed
+ */
+void HFractalPNGWriter::encodeBand (int band, HFractalImage *image) {
+    int start_y = band*PNG_BAND_HEIGHT;
+    int rows = std::min (PNG_BAND_HEIGHT, height-start_y);
+    size_t row_bytes = (size_t)width*3;
+    std::vector<uint8_t> pixels (rows*row_bytes);
+    image->convertRows (start_y, start_y+rows, pixels.data(), palette.data());
+    std::vector<uint8_t> filtered (rows*(row_bytes+1));
+    for (int y = 0; y < rows; y++) filterRow (pixels.data()+(y*row_bytes), y == 0 ? NULL : pixels.data()+((y-1)*row_bytes), row_bytes, 3, filtered.data()+(y*(row_bytes+1)));
+
+    // Leave room for the length and type, which are filled in once the size is known
+    std::vector<uint8_t> chunk (8);
+    deflateRun (filtered.data(), filtered.size(), chunk);
+    uint32_t length = chunk.size()-8;
+    for (int i = 0; i < 4; i++) chunk[i] = (length >> (24-(8*i))) & 0xff;
+    memcpy (chunk.data()+4, "IDAT", 4);
+    appendBigEndian (chunk, crc32 (0, chunk.data()+4, length+4));
+    uint32_t band_checksum = adler32 (1, filtered.data(), filtered.size());
+
+    mut.lock();
+    band_chunks[band].swap (chunk);
+    band_adler[band] = band_checksum;
+    band_lengths[band] = filtered.size();
+    band_encoded[band] = true;
+    writeEncodedBands ();
+    mut.unlock();
+}
+
+/**
+ * @brief Write every encoded band which directly follows the last band written, in order, freeing each once written
+ * 
+ */
+void HFractalPNGWriter::writeEncodedBands () {
+    while (next_band < getBandCount() && band_encoded[next_band]) {
+        std::vector<uint8_t> &chunk = band_chunks[next_band];
+        failed |= !output (chunk.data(), chunk.size());
+        std::vector<uint8_t>().swap (chunk);
+        adler = adler32Combine (adler, band_adler[next_band], band_lengths[next_band]);
+        next_band++;
+    }
+}
+
+/**
+ * @brief Encode bands which have not been handed out yet until none are left. Several threads may call this at once to share the encoding of a finished image
+ * 
+ * @param image Image to encode, which must be fully computed
+ */
+void HFractalPNGWriter::encodeRemaining (HFractalImage *image) {
+    while (true) {
+        mut.lock();
+        int band = next_unencoded++;
+        mut.unlock();
+        if (band >= getBandCount()) return;
+        encodeBand (band, image);
+    }
+}
+
+/**
+ * @brief End the zlib stream with an empty final block and the combined checksum, write the closing chunk, and close the file or release the buffer
+ * 
+ * @return True if every band was written and every write succeeded, false otherwise
+ */
+bool HFractalPNGWriter::close () {
+    if (png_file == NULL && png_buffer == NULL) return false;
+    bool success = !failed && next_band == getBandCount();
+    std::vector<uint8_t> trailer = { 0x03, 0x00 };
+    appendBigEndian (trailer, adler);
+    success &= writeChunk ("IDAT", trailer.data(), trailer.size());
+    success &= writeChunk ("IEND", NULL, 0);
+    if (png_file != NULL) success &= fclose (png_file) == 0;
+    png_file = NULL;
+    png_buffer = NULL;
+    band_chunks.clear();
+    return success;
+}
@@ -4,6 +4,76 @@
 #define IMAGE_H
 
 #include <mutex>
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define TILE_SIZE 32 // Horizontal and vertical dimension of the square tiles which images are split into for rendering
+
+#define WRITE_BLOCK_BYTES (8*1024*1024) // Size of the blocks of rows which are converted to an output format in parallel, then written with one call
+#define WRITE_MIN_THREAD_PIXELS 65536 // Smallest number of pixels worth converting on a separate thread
+
+#define PNG_BAND_HEIGHT 128 // Number of rows in each band of a PNG file, which are filtered and compressed independently so that bands can be encoded in parallel
+#define PNG_MAX_CHAIN 32 // Largest number of earlier positions compared when searching for a repeated string while compressing PNG data
+#define PNG_BLOCK_SYMBOLS 65536 // Number of literals and matches compressed with each set of Huffman codes
+
+#define RAW_MAGIC "HFRAW" // Identifies iteration buffer files, padded with zeros to 8 bytes
+#define RAW_VERSION 1 // Version of the iteration buffer file layout
+#define RAW_ALIGNMENT 8 // Alignment in bytes of the tile index and of every tile in an iteration buffer file
+
+// Enum describing how a tile of an iteration buffer file is stored
+enum RAW_ENCODING {
+    RE_PLAIN = 0, // Values row by row, so the tile can be used in place
+    RE_RLE // Pairs of 16 bit run length and value, used when shorter than plain storage
+};
+
+// Struct describing the render an iteration buffer file was produced by, recorded in its header
+struct HFractalRawSpec {
+    long double offset_x; // Horizontal offset in the complex plane
+    long double offset_y; // Vertical offset in the complex plane
+    long double zoom; // Scaling value for the image
+    int eval_limit; // Evaluation limit the image was rendered with
+    int accuracy; // MATH_ACCURACY the image was rendered with
+    int render_strategy; // RENDER_STRATEGY the image was rendered with
+    std::string equation; // String equation the image was rendered with
+};
+
+/**
+ * Header at the start of an iteration buffer file, laid out so that a mapped file can be read through a pointer to it.
+ * Every field is little endian. The header is followed by the equation, then, at the next multiple of RAW_ALIGNMENT, one HFractalRawTileEntry per tile, row by row
+ */
+struct HFractalRawHeader {
+    char magic[8]; // RAW_MAGIC
+    uint32_t version; // RAW_VERSION
+    uint32_t header_size; // Size of this struct, so that fields can be added in later versions
+    uint32_t width; // Width of the image
+    uint32_t height; // Height of the image
+    uint32_t tile_size; // Side length of the tiles, which are smaller at the right and bottom edges
+    uint32_t compressed; // Whether tiles may be run length encoded
+    int32_t eval_limit; // Evaluation limit of the render, which marks pixels that never escaped
+    int32_t accuracy; // MATH_ACCURACY of the render
+    int32_t render_strategy; // RENDER_STRATEGY of the render
+    uint32_t equation_length; // Length of the equation string following the header
+    uint32_t precision_bits; // Number of mantissa bits of the floating point type pixel coordinates were computed with
+    uint32_t reserved; // Zero
+    uint64_t index_offset; // Offset in bytes from the start of the file to the tile index
+    double offset_x_approx; // Offsets and zoom rounded to double precision, for convenience
+    double offset_y_approx;
+    double zoom_approx;
+    char offset_x[48]; // Offsets and zoom as exact decimal strings, for full precision
+    char offset_y[48];
+    char zoom[48];
+};
+
+// Struct describing where a tile is stored in an iteration buffer file
+struct HFractalRawTileEntry {
+    uint64_t offset; // Offset in bytes from the start of the file
+    uint32_t size; // Size in bytes
+    uint32_t encoding; // RAW_ENCODING of the tile
+};
 
 // Class containing information about an image currently being generated
 class HFractalImage {
@@ -11,23 +81,92 @@ private:
     int width; // Width of the image
     int height; // Heigh of the image
     uint16_t * data_image; // Computed data values of the image
-    int c_ind = 0; // Index of the next pixel to be sent out to a rendering thread
+    int64_t c_ind = 0; // Index of the next pixel to be sent out to a rendering thread
+    int t_ind = 0; // Index of the next tile to be sent out to a rendering thread
+    int tile_origin_x = 0; // Column at which a tile starts, so that tiles can line up with those of other images. Tiles crossing the left edge are clipped
+    int tile_origin_y = 0; // Row at which a tile starts. Tiles crossing the top edge are clipped
     std::mutex mut; // Mutex object used to lock class resources during multi-threading events
+    bool writeRows (FILE *, bool, int, int); // Convert every row in parallel blocks and write each block to an open file
+
+    std::complex<long double> * state_z = NULL; // Last z value of each pixel, only allocated if the image keeps evaluation state
+    int * state_depth = NULL; // Number of iterations performed to reach each value in state_z
 
 public:
-    HFractalImage (int, int); // Constructor, creates a new image buffer of the specified size
+    HFractalImage (int, int, bool = false); // Constructor, creates a new image buffer of the specified size, optionally keeping evaluation state for each pixel
     ~HFractalImage (); // Destructor, destroys and deallocates resources used in the current image
     
     void set (int, int, uint16_t); // Set the value of a pixel
     uint16_t get (int, int); // Get the value of a pixel
     uint8_t * completed; // Stores the completion status of each pixel, 0 = not computed, 1 = in progress, 2 = computed
-    int getUncompleted (); // Get the index of an uncomputed pixel, to be sent to a rendering thread, and update completion data
+    int64_t getUncompleted (); // Get the index of an uncomputed pixel, to be sent to a rendering thread, and update completion data
+    int getUncompletedTile (); // Get the index of an uncomputed tile, to be sent to a rendering thread, and update completion data
+    void getTileBounds (int, int &, int &, int &, int &); // Get the position and size of a tile from its index
+    void setTileOrigin (int, int); // Shift the grid of tiles so that a tile starts at the given pixel, before any tiles are fetched
+    void getTile (int, int, int, int, uint16_t *); // Copy the values of a rectangular block of pixels into a buffer
     bool isDone (); // Check if the image has been completed or not
-    int getInd (); // Get the current completion index
+    int64_t getInd (); // Get the current completion index
+    void restart (); // Mark every pixel as uncomputed, keeping data and state, so that the image can be recomputed incrementally
+
+    int getWidth () { return width; } // Get the width of the image
+    int getHeight () { return height; } // Get the height of the image
+    int64_t getPixelCount () { return (int64_t)width*height; } // Get the number of pixels in the image, which may not fit in an int
+    int getTileColumns () { return (tile_origin_x > 0) + (std::max (width-tile_origin_x, 0)+TILE_SIZE-1)/TILE_SIZE; } // Get the number of columns of tiles
+    int getTileRows () { return (tile_origin_y > 0) + (std::max (height-tile_origin_y, 0)+TILE_SIZE-1)/TILE_SIZE; } // Get the number of rows of tiles
+    int getTileCount () { return getTileColumns()*getTileRows(); } // Get the number of tiles the image is split into
+    void convertRows (int, int, uint8_t *, const uint32_t *); // Convert rows of the image to big endian 16 bit grey values or 8 bit RGB colours
+    bool hasState () { return state_z != NULL; } // Check if this image keeps evaluation state for each pixel
+    void setState (int, int, std::complex<long double>, int); // Set the evaluation state of a pixel
+    void getState (int, int, std::complex<long double> &, int &); // Get the evaluation state of a pixel
     bool writePGM (std::string); // Write out the contents of the data buffer to a simple image file, PGM format, with the given path
+    bool writePGMRows (FILE *); // Write the pixel data of every row to an open PGM file, so that images rendered in bands can be streamed into one file
+    bool writePPM (std::string, int, int); // Write out the data buffer as a colour PPM image using a colour palette, with pixels at a given evaluation limit in black
+    bool writePNG (std::string, int, int); // Write out the data buffer as a colour PNG image using a colour palette, with pixels at a given evaluation limit in black
+    bool encodePNG (std::vector<uint8_t> &, int, int); // Encode the data buffer as a colour PNG image into memory, on the calling thread only
+    static bool writePGMHeader (FILE *, int, int); // Write the header of a PGM file with a given width and height
+    bool writeRaw (std::string, const HFractalRawSpec &, bool); // Write out the data buffer to a tiled iteration buffer file, optionally run length encoding tiles, with the given path
 
     static uint32_t HSVToRGB (float h, float s, float v); // Create a 32 bit RGB colour from hue, saturation, value components
     static uint32_t colourFromValue (uint16_t, int); // Convert a computed value into a 32 bit RGBA colour value, using the specified palette
 };
 
+/**
+ * Class writing an image to a colour PNG file in bands of PNG_BAND_HEIGHT rows.
+ * Each band is filtered and deflate compressed on its own, ending with a sync flush on a byte boundary, so bands can be encoded on any thread in any order and still join into one zlib stream.
+ * Each band becomes one IDAT chunk, whose CRC is computed by the thread which encoded it, and is written as soon as every band above it has been written, when its Adler-32 checksum is combined into that of the whole stream
+ */
+class HFractalPNGWriter {
+private:
+    FILE *png_file = NULL; // File being written, or NULL if none is open
+    std::vector<uint8_t> *png_buffer = NULL; // Buffer being written instead of a file, or NULL
+    int width = 0; // Dimensions of the image
+    int height = 0;
+    std::vector<uint32_t> palette; // Colour of every possible value, packed as 0xRRGGBBAA
+    std::vector<std::vector<uint8_t>> band_chunks; // IDAT chunk of each band which has been encoded but not yet written
+    std::vector<uint32_t> band_adler; // Adler-32 checksum of the filtered rows of each band
+    std::vector<size_t> band_lengths; // Number of bytes of filtered rows in each band
+    std::vector<bool> band_encoded; // Whether each band has been encoded
+    int next_unencoded = 0; // Index of the next band to be handed out by encodeRemaining
+    int next_band = 0; // Index of the next band to be written to the file
+    uint32_t adler = 1; // Adler-32 checksum of the filtered rows of every band written so far
+    bool failed = false; // Whether any write has failed
+    std::mutex mut; // Mutex object used to lock the file and band progress between encoding threads
+
+    bool start (int, int, int, int); // Prepare to encode an image of a given size and write everything before the pixel data
+    bool output (const uint8_t *, size_t); // Write bytes to the file or buffer
+    bool writeChunk (const char *, const uint8_t *, size_t); // Write a chunk with a given type and data to the file or buffer
+    void writeEncodedBands (); // Write every encoded band following the last band written, assuming the mutex is locked
+
+public:
+    bool open (std::string, int, int, int, int); // Create a PNG file of a given size and write everything before the pixel data
+    bool open (std::vector<uint8_t> *, int, int, int, int); // Encode a PNG image of a given size into a buffer rather than a file
+    bool close (); // Finish the file or buffer once every band is written, returning whether every write succeeded
+    void encodeBand (int, HFractalImage *); // Filter and compress one band of rows of an image, then write it and any bands waiting for it
+    void encodeRemaining (HFractalImage *); // Encode bands until none are left, so that several threads can share the encoding of a finished image
+
+    int getBandCount () { return (height+PNG_BAND_HEIGHT-1)/PNG_BAND_HEIGHT; } // Get the number of bands the image is encoded in
+    static int getBand (int y) { return y/PNG_BAND_HEIGHT; } // Get the index of the band containing a row
+
+    ~HFractalPNGWriter () { close (); } // Destructor, closes the file if it is still open
+};
+
 #endif
\ No newline at end of file
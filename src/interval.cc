@@ -0,0 +1,286 @@
+// src/interval.cc
+
+#include "interval.hh"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// Interval versions of real functions. Every result is widened outwards so that it also contains the value computed in floating point for any point of the operands
+
+/**
+ * @brief Widen an interval outwards by INTERVAL_WIDENING relative to each bound
+ *
+ * @param a Interval to widen
+ * @return The widened interval
+ */
+static inline Interval widen (Interval a) {
+    return { a.lo - (fabsl (a.lo)*(long double)INTERVAL_WIDENING), a.hi + (fabsl (a.hi)*(long double)INTERVAL_WIDENING) };
+}
+
+static inline Interval iAdd (Interval a, Interval b) { return widen ({ a.lo+b.lo, a.hi+b.hi }); }
+static inline Interval iSub (Interval a, Interval b) { return widen ({ a.lo-b.hi, a.hi-b.lo }); }
+static inline Interval iNeg (Interval a) { return { -a.hi, -a.lo }; }
+static inline Interval iScale (Interval a, long double k) { return k >= 0 ? Interval { a.lo*k, a.hi*k } : Interval { a.hi*k, a.lo*k }; }
+
+static inline Interval iMul (Interval a, Interval b) {
+    long double p1 = a.lo*b.lo, p2 = a.lo*b.hi, p3 = a.hi*b.lo, p4 = a.hi*b.hi;
+    return widen ({ min (min (p1, p2), min (p3, p4)), max (max (p1, p2), max (p3, p4)) });
+}
+
+/**
+ * @brief Square every value in an interval. Tighter than multiplying the interval by itself, as the result can never be negative
+ *
+ * @param a Interval to square
+ * @return Interval containing the squares
+ */
+static inline Interval iSqr (Interval a) {
+    long double l = a.lo*a.lo, h = a.hi*a.hi;
+    if (a.lo <= 0 && a.hi >= 0) return widen ({ 0, max (l, h) });
+    return widen ({ min (l, h), max (l, h) });
+}
+
+static inline Interval iDiv (Interval a, Interval b, bool &valid) {
+    if (b.lo <= 0 && b.hi >= 0) { valid = false; return a; }
+    return iMul (a, widen ({ 1/b.hi, 1/b.lo }));
+}
+
+static inline Interval iAbs (Interval a) {
+    if (a.lo >= 0) return a;
+    if (a.hi <= 0) return iNeg (a);
+    return { 0, max (-a.lo, a.hi) };
+}
+
+static inline Interval iSqrt (Interval a, bool &valid) {
+    if (a.hi < 0) { valid = false; return a; }
+    return widen ({ sqrtl (max (a.lo, (long double)0)), sqrtl (a.hi) });
+}
+
+static inline Interval iExp (Interval a) { return widen ({ expl (a.lo), expl (a.hi) }); }
+
+static inline Interval iLog (Interval a, bool &valid) {
+    if (a.lo <= 0) { valid = false; return a; }
+    return widen ({ logl (a.lo), logl (a.hi) });
+}
+
+/**
+ * @brief Check whether an interval contains a point of the form t + 2k*pi for some integer k
+ *
+ * @param a Interval to check
+ * @param t Point in the first period
+ * @return True if the interval contains a point with the same phase as t
+ */
+static inline bool containsPhase (Interval a, long double t) {
+    long double k = ceill ((a.lo-t)/(2*M_PIl));
+    return t + (2*M_PIl*k) <= a.hi;
+}
+
+static inline Interval iSin (Interval a) {
+    if (a.hi-a.lo >= 2*M_PIl) return { -1, 1 };
+    long double s_lo = sinl (a.lo), s_hi = sinl (a.hi);
+    Interval result = widen ({ min (s_lo, s_hi), max (s_lo, s_hi) });
+    if (containsPhase (a, M_PIl/2)) result.hi = 1;
+    if (containsPhase (a, -M_PIl/2)) result.lo = -1;
+    return result;
+}
+
+static inline Interval iCos (Interval a) {
+    if (a.hi-a.lo >= 2*M_PIl) return { -1, 1 };
+    long double c_lo = cosl (a.lo), c_hi = cosl (a.hi);
+    Interval result = widen ({ min (c_lo, c_hi), max (c_lo, c_hi) });
+    if (containsPhase (a, 0)) result.hi = 1;
+    if (containsPhase (a, M_PIl)) result.lo = -1;
+    return result;
+}
+
+static inline Interval iSinh (Interval a) { return widen ({ sinhl (a.lo), sinhl (a.hi) }); }
+
+static inline Interval iCosh (Interval a) {
+    Interval m = iAbs (a);
+    return widen ({ coshl (m.lo), coshl (m.hi) });
+}
+
+/**
+ * @brief Find the range of atan2 (y, x) over a box. The extremes are at the corners, as long as the box does not contain the origin or cross the branch cut along the negative real axis
+ *
+ * @param y Range of imaginary parts
+ * @param x Range of real parts
+ * @param valid Cleared if the box touches the origin or the branch cut
+ * @return Interval containing every angle
+ */
+static inline Interval iAtan2 (Interval y, Interval x, bool &valid) {
+    if (x.lo <= 0 && y.lo <= 0 && y.hi >= 0) { valid = false; return x; }
+    long double a1 = atan2l (y.lo, x.lo), a2 = atan2l (y.lo, x.hi), a3 = atan2l (y.hi, x.lo), a4 = atan2l (y.hi, x.hi);
+    return widen ({ min (min (a1, a2), min (a3, a4)), max (max (a1, a2), max (a3, a4)) });
+}
+
+// Interval versions of complex functions, on boxes in the complex plane
+
+static inline IntervalBox real (Interval a) { return { a, { 0, 0 } }; }
+static inline IntervalBox bAdd (IntervalBox a, IntervalBox b) { return { iAdd (a.re, b.re), iAdd (a.im, b.im) }; }
+static inline IntervalBox bSub (IntervalBox a, IntervalBox b) { return { iSub (a.re, b.re), iSub (a.im, b.im) }; }
+static inline IntervalBox bMul (IntervalBox a, IntervalBox b) { return { iSub (iMul (a.re, b.re), iMul (a.im, b.im)), iAdd (iMul (a.re, b.im), iMul (a.im, b.re)) }; }
+static inline IntervalBox bMulReal (IntervalBox a, Interval b) { return { iMul (a.re, b), iMul (a.im, b) }; }
+static inline IntervalBox bSqr (IntervalBox a) { return { iSub (iSqr (a.re), iSqr (a.im)), iScale (iMul (a.re, a.im), 2) }; }
+static inline Interval bNorm (IntervalBox a) { return iAdd (iSqr (a.re), iSqr (a.im)); }
+
+static inline IntervalBox bDiv (IntervalBox a, IntervalBox b, bool &valid) {
+    // a/b = a*conj(b)/|b|^2
+    IntervalBox numerator = bMul (a, { b.re, iNeg (b.im) });
+    Interval denominator = bNorm (b);
+    return { iDiv (numerator.re, denominator, valid), iDiv (numerator.im, denominator, valid) };
+}
+
+static inline IntervalBox bExp (IntervalBox a) {
+    Interval magnitude = iExp (a.re);
+    return { iMul (magnitude, iCos (a.im)), iMul (magnitude, iSin (a.im)) };
+}
+
+static inline IntervalBox bLog (IntervalBox a, bool &valid) {
+    return { iScale (iLog (bNorm (a), valid), 0.5), iAtan2 (a.im, a.re, valid) };
+}
+
+/**
+ * @brief Raise a box to a constant integer power by repeated multiplication, in the same way as HFractalComplexMath::powInt
+ *
+ * @param a Box to raise
+ * @param n Exponent
+ * @param valid Cleared if the exponent is negative and the result contains zero
+ * @return Box containing every power
+ */
+static inline IntervalBox bPowInt (IntervalBox a, int n, bool &valid) {
+    IntervalBox result = real ({ 1, 1 });
+    unsigned int m = n < 0 ? -n : n;
+    while (m != 0) {
+        if (m & 1) result = bMul (result, a);
+        a = bSqr (a);
+        m >>= 1;
+    }
+    return n < 0 ? bDiv (real ({ 1, 1 }), result, valid) : result;
+}
+
+/**
+ * @brief Run a sequence of compiled instructions on boxes, mirroring HFractalEquation::execute. Real values are held as boxes with an imaginary part of zero
+ *
+ * @param program Instructions to run
+ * @param z Box containing every value of z
+ * @param c Box containing every value of c
+ * @return Box containing every value the instructions could produce, only meaningful if `valid` is still set
+ */
+IntervalBox HFractalIntervalEvaluator::execute (const vector<Instruction> &program, IntervalBox z, IntervalBox c) {
+    int top = -1;
+    IntervalBox *s = value_stack.data();
+    for (const Instruction &ins : program) {
+        switch (ins.op) {
+        // Instructions pushing values onto the stack
+        case INS_CONST: s[++top] = { { ins.const_val.real(), ins.const_val.real() }, { ins.const_val.imag(), ins.const_val.imag() } }; break;
+        case INS_Z: s[++top] = z; break;
+        case INS_C: s[++top] = c; break;
+        case INS_X: s[++top] = real (z.re); break;
+        case INS_Y: s[++top] = real (z.im); break;
+        case INS_A: s[++top] = real (c.re); break;
+        case INS_B: s[++top] = real (c.im); break;
+        // Instructions combining the top two values on the stack
+        case INS_ADD_RR: top--; s[top] = real (iAdd (s[top].re, s[top+1].re)); break;
+        case INS_ADD_RC: top--; s[top] = bAdd (real (s[top].re), s[top+1]); break;
+        case INS_ADD_CR: top--; s[top] = bAdd (s[top], real (s[top+1].re)); break;
+        case INS_ADD_CC: top--; s[top] = bAdd (s[top], s[top+1]); break;
+        case INS_SUB_RR: top--; s[top] = real (iSub (s[top].re, s[top+1].re)); break;
+        case INS_SUB_RC: top--; s[top] = bSub (real (s[top].re), s[top+1]); break;
+        case INS_SUB_CR: top--; s[top] = bSub (s[top], real (s[top+1].re)); break;
+        case INS_SUB_CC: top--; s[top] = bSub (s[top], s[top+1]); break;
+        case INS_MUL_RR: top--; s[top] = real (iMul (s[top].re, s[top+1].re)); break;
+        case INS_MUL_RC: top--; s[top] = bMulReal (s[top+1], s[top].re); break;
+        case INS_MUL_CR: top--; s[top] = bMulReal (s[top], s[top+1].re); break;
+        case INS_MUL_CC: top--; s[top] = bMul (s[top], s[top+1]); break;
+        case INS_DIV_RR: top--; s[top] = real (iDiv (s[top].re, s[top+1].re, valid)); break;
+        case INS_DIV_RC: top--; s[top] = bDiv (real (s[top].re), s[top+1], valid); break;
+        case INS_DIV_CR: top--; s[top] = { iDiv (s[top].re, s[top+1].re, valid), iDiv (s[top].im, s[top+1].re, valid) }; break;
+        case INS_DIV_CC: top--; s[top] = bDiv (s[top], s[top+1], valid); break;
+        case INS_POW_RR: top--; s[top] = real (iExp (iMul (s[top+1].re, iLog (s[top].re, valid)))); break;
+        case INS_POW_CC: top--; s[top] = bExp (bMul (s[top+1], bLog (s[top], valid))); break;
+        // Instructions with the exponent folded in, modifying only the top value on the stack
+        case INS_POW_RI: s[top] = real (bPowInt (real (s[top].re), ins.int_val, valid).re); break;
+        case INS_POW_CI: s[top] = bPowInt (s[top], ins.int_val, valid); break;
+        case INS_SQRT_R: s[top] = real (iSqrt (s[top].re, valid)); break;
+        // Instructions applying a function to the top value on the stack
+        case INS_ABS_R: s[top] = real (iAbs (s[top].re)); break;
+        case INS_ABS_C: s[top] = real (iSqrt (bNorm (s[top]), valid)); break;
+        case INS_CONJ: s[top] = { s[top].re, iNeg (s[top].im) }; break;
+        case INS_SQR_R: s[top] = real (iSqr (s[top].re)); break;
+        case INS_SQR_C: s[top] = bSqr (s[top]); break;
+        case INS_RE: s[top] = real (s[top].re); break;
+        case INS_IM: s[top] = real (s[top].im); break;
+        case INS_EXP_R: s[top] = real (iExp (s[top].re)); break;
+        case INS_EXP_C: s[top] = bExp (s[top]); break;
+        case INS_LOG_R: s[top] = real (iLog (s[top].re, valid)); break;
+        case INS_LOG_C: s[top] = bLog (s[top], valid); break;
+        case INS_SIN_R: s[top] = real (iSin (s[top].re)); break;
+        case INS_SIN_C: s[top] = { iMul (iSin (s[top].re), iCosh (s[top].im)), iMul (iCos (s[top].re), iSinh (s[top].im)) }; break;
+        case INS_COS_R: s[top] = real (iCos (s[top].re)); break;
+        case INS_COS_C: s[top] = { iMul (iCos (s[top].re), iCosh (s[top].im)), iNeg (iMul (iSin (s[top].re), iSinh (s[top].im))) }; break;
+        // Instructions moving values between the stack and per pixel slots
+        case INS_STORE: slots[ins.int_val] = s[top--]; break;
+        case INS_LOAD: s[++top] = slots[ins.int_val]; break;
+        default: valid = false; break;
+        }
+    }
+
+    return top >= 0 ? s[top] : real ({ 0, 0 });
+}
+
+/**
+ * @brief Check whether boxes can be classified for the equation. Presets have faster dedicated paths, and approximate accuracies do not compute the same functions the interval versions bound
+ *
+ * @return True if classify can give results
+ */
+bool HFractalIntervalEvaluator::isSupported () {
+    return equation->isValid() && !equation->getIsPreset() && equation->getAccuracy() == MA_PRECISE;
+}
+
+/**
+ * @brief Iterate every coordinate in a box at once, to find whether they all give the same result.
+ * At each iteration, if |z| is more than 2 everywhere in the box then every coordinate escapes there, and if |z| is at most 2 everywhere, none escape and iteration continues. Otherwise nothing can be proven
+ *
+ * @param c_lo Coordinate with the smallest real and imaginary parts in the box
+ * @param c_hi Coordinate with the largest real and imaginary parts in the box
+ * @param limit Limit for the number of iterations
+ * @param depth Output for the number of iterations every coordinate escapes after, or the limit if they are all bounded
+ * @param z Output for a value of z which has escaped, usable as the state of escaped pixels
+ * @return BOX_ESCAPES or BOX_BOUNDED if every coordinate gives the same result, BOX_UNKNOWN otherwise
+ */
+BOX_CLASS HFractalIntervalEvaluator::classify (complex<long double> c_lo, complex<long double> c_hi, int limit, int &depth, complex<long double> &z) {
+    if (!isSupported()) return BOX_UNKNOWN;
+    valid = true;
+    IntervalBox c = { { c_lo.real(), c_hi.real() }, { c_lo.imag(), c_hi.imag() } };
+    // Custom equations start with z equal to c
+    IntervalBox box_z = c;
+    execute (equation->getPrologue(), box_z, c);
+    for (depth = 0; depth < limit;) {
+        box_z = execute (equation->getInstructions(), box_z, c);
+        depth++;
+        if (!valid) return BOX_UNKNOWN;
+        Interval norm = bNorm (box_z);
+        if (norm.lo > 4) {
+            // The point of the box nearest the origin has escaped, so it stands in for every point
+            auto nearest = [](Interval a) { return a.lo > 0 ? a.lo : (a.hi < 0 ? a.hi : (long double)0); };
+            z = complex<long double> (nearest (box_z.re), nearest (box_z.im));
+            return BOX_ESCAPES;
+        }
+        // Written so that NaN bounds also give up
+        if (!(norm.hi <= 4)) return BOX_UNKNOWN;
+    }
+    return BOX_BOUNDED;
+}
+
+/**
+ * @brief Initialise for an equation, allocating the stack and slots it needs
+ *
+ * @param eq Equation to iterate
+ */
+HFractalIntervalEvaluator::HFractalIntervalEvaluator (HFractalEquation *eq) {
+    equation = eq;
+    value_stack.resize (max (eq->getMaxStack(), 1));
+    slots.resize (eq->getNumSlots());
+}
@@ -0,0 +1,54 @@
+// src/interval.hh
+
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <complex>
+#include <vector>
+
+#include "fractal.hh"
+
+// Relative amount every interval result is widened by in each direction, to cover rounding error in the per pixel computation
+#define INTERVAL_WIDENING 1e-16
+
+// Enum describing what is known about every coordinate in a box of the complex plane
+enum BOX_CLASS {
+    BOX_UNKNOWN = 0, // Different coordinates may give different results, or nothing could be proven
+    BOX_ESCAPES, // Every coordinate escapes after the same number of iterations
+    BOX_BOUNDED // Every coordinate stays bounded up to the limit
+};
+
+// Struct describing a closed range of real numbers
+struct Interval {
+    long double lo;
+    long double hi;
+};
+
+// Struct describing a rectangle in the complex plane, as a range of real parts and a range of imaginary parts
+struct IntervalBox {
+    Interval re;
+    Interval im;
+};
+
+/**
+ * Class iterating a whole box of coordinates at once using interval arithmetic over the compiled instructions of an equation.
+ * Each value is replaced by a box guaranteed to contain that value for every coordinate in the starting box, so if every point of the box escapes at the same iteration, or no point escapes before the limit, the result for every coordinate is known without evaluating any of them.
+ * Only custom equations evaluated at MA_PRECISE accuracy are supported
+ */
+class HFractalIntervalEvaluator {
+private:
+    HFractalEquation *equation; // Equation being iterated
+    std::vector<IntervalBox> value_stack; // Value stack for the instructions
+    std::vector<IntervalBox> slots; // Values computed by the prologue
+    bool valid; // Cleared when an operation cannot be bounded, e.g. division by a range containing zero
+
+    IntervalBox execute (const std::vector<Instruction> &, IntervalBox, IntervalBox); // Run a sequence of compiled instructions on boxes
+
+public:
+    bool isSupported (); // Check if boxes can be classified for the equation
+    BOX_CLASS classify (std::complex<long double>, std::complex<long double>, int, int &, std::complex<long double> &); // Find whether every coordinate in a box gives the same result
+
+    HFractalIntervalEvaluator (HFractalEquation *); // Initialise for an equation
+};
+
+#endif
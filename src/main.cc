@@ -1,10 +1,15 @@
 // src/main.cc
 
 #include <iostream>
+#include <filesystem>
 
 #include "hyperfractal.hh"
-#include "guimain.hh"
+#include "batch.hh"
+#include "server.hh"
 #include "utils.hh"
+#ifndef HEADLESS
+#include "guimain.hh"
+#endif
 
 using namespace std;
 
@@ -17,10 +22,346 @@ using namespace std;
  * 
  **/
 
+/**
+ * @brief Render a list of images through one shared thread pool, read either from a spec file or from every config profile in a database
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if every image was written
+ */
+int batchMain (int argc, char *argv[]) {
+    bool from_database = string (argv[1]) == "--batch-database";
+    int next_argument = from_database ? 4 : 3; // Index of the worker threads argument, after the optional resolution
+    int argument_error = 1;
+    try {
+        string source = string (argv[2]);
+        int resolution = 0;
+        if (from_database) {
+            argument_error = 2;
+            resolution = stoi (argv[3]);
+            if (resolution <= 0) throw runtime_error("Specified resolution too low.");
+        }
+        argument_error = next_argument-1;
+        int threads = stoi (argv[next_argument]);
+        if (threads <= 0) throw runtime_error("Must use at least one worker thread.");
+        HFractalBatch batch (threads);
+        argument_error = next_argument;
+        if (!batch.setOutputDirectory (string (argv[next_argument+1]))) throw runtime_error("Unable to create output directory.");
+        argument_error = next_argument+1;
+        IMAGE_TYPE image_type = PGM;
+        if (argc == next_argument+3 && !imageTypeFromName (string (argv[next_argument+2]), image_type)) throw runtime_error("Image type must be pgm, ppm, png, raw or raw-rle.");
+        batch.setImageType (image_type);
+        argument_error = 1;
+        int added = from_database ? batch.readDatabase (source, resolution) : batch.readSpecFile (source);
+        if (added < 0) throw runtime_error("Unable to read spec file.");
+        if (added == 0) throw runtime_error("No render specs found.");
+        return batch.run () != 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Render every frame of an animation through a list of keyframes, sharing threads between frames and reusing pixels which line up with earlier frames
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if every frame was written
+ */
+int animationMain (int argc, char *argv[]) {
+    int argument_error = 2;
+    try {
+        int resolution = stoi (argv[3]);
+        if (resolution <= 0) throw runtime_error("Specified resolution too low.");
+        argument_error++;
+        int eval_limit = stoi (argv[4]);
+        if (eval_limit <= 0) throw runtime_error("Must use at least one evaluation iteration.");
+        argument_error++;
+        string equation = string (argv[5]);
+        HFractalEquation *parsed = HFractalMain::parseEquation (equation);
+        if (parsed == NULL) throw runtime_error("Specified equation is invalid.");
+        delete parsed;
+        argument_error++;
+        int threads = stoi (argv[6]);
+        if (threads <= 0) throw runtime_error("Must use at least one worker thread.");
+        HFractalBatch batch (threads);
+        argument_error++;
+        if (!batch.setOutputDirectory (string (argv[7]))) throw runtime_error("Unable to create output directory.");
+        argument_error++;
+        IMAGE_TYPE image_type = PGM;
+        if (argc == 9 && !imageTypeFromName (string (argv[8]), image_type)) throw runtime_error("Image type must be pgm, ppm, png, raw or raw-rle.");
+        batch.setImageType (image_type);
+        argument_error = 1;
+        int added = batch.readKeyframeFile (string (argv[2]), resolution, eval_limit, equation);
+        if (added < 0) throw runtime_error("Unable to read keyframes, which must be in order of increasing frame.");
+        if (added == 0) throw runtime_error("No keyframes found.");
+        return batch.run () != 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Render the frames of a zoom toward a fixed point by rendering one exponential map strip, then resampling it into every frame
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if every frame was written
+ */
+int expZoomMain (int argc, char *argv[]) {
+    HFractalMain hm;
+    int argument_error = 1;
+    try {
+        hm.setResolution (stoi (argv[2]));
+        if (hm.getResolution() <= 0) throw runtime_error("Specified resolution too low.");
+        argument_error++;
+        hm.setOffsetX (stold (argv[3]));
+        argument_error++;
+        hm.setOffsetY (stold (argv[4]));
+        argument_error++;
+        long double zoom_start = stold (argv[5]);
+        if (zoom_start <= 0) throw runtime_error("Zoom must be positive.");
+        argument_error++;
+        long double zoom_end = stold (argv[6]);
+        if (zoom_end < zoom_start) throw runtime_error("Must zoom in, with the end zoom at least the start zoom.");
+        argument_error++;
+        int frames = stoi (argv[7]);
+        if (frames <= 0) throw runtime_error("Must render at least one frame.");
+        argument_error++;
+        hm.setEquation (string (argv[8]));
+        if (!hm.isValidEquation()) throw runtime_error("Specified equation is invalid.");
+        argument_error++;
+        hm.setWorkerThreads (stoi (argv[9]));
+        if (hm.getWorkerThreads() <= 0) throw runtime_error("Must use at least one worker thread.");
+        argument_error++;
+        hm.setEvalLimit (stoi (argv[10]));
+        if (hm.getEvalLimit() <= 0) throw runtime_error("Must use at least one evaluation iteration.");
+        argument_error++;
+        string directory = string (argv[11]);
+        error_code ec;
+        filesystem::create_directories (directory, ec);
+        if (!filesystem::is_directory (directory, ec)) throw runtime_error("Unable to create output directory.");
+        if (directory.back() != '/' && directory.back() != '\\') directory += '/';
+        argument_error++;
+        IMAGE_TYPE image_type = PGM;
+        if (argc == 13 && !imageTypeFromName (string (argv[12]), image_type)) throw runtime_error("Image type must be pgm, ppm, png, raw or raw-rle.");
+
+        if (hm.generateExpStrip (zoom_start, zoom_end) != 0) return 1;
+        for (int frame = 0; frame < frames; frame++) {
+            long double t = (frames == 1) ? 0 : (long double)frame/(frames-1);
+            string number = to_string (frame);
+            string path = directory + "frame_" + string (number.length() < 6 ? 6-number.length() : 0, '0') + number;
+            if (hm.resampleExpStrip (zoom_start*powl (zoom_end/zoom_start, t)) != 0 || !hm.writeImage (image_type, path)) {
+                cout << "Failed to write " << path << imageTypeExtension (image_type) << endl;
+                return 1;
+            }
+        }
+        cout << "Wrote " << frames << " frames." << endl;
+        return 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Render a multi-resolution tile pyramid of a view through one shared thread pool, for serving from a web viewer
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if every tile was written
+ */
+int pyramidMain (int argc, char *argv[]) {
+    int argument_error = 1;
+    try {
+        int levels = stoi (argv[2]);
+        if (levels <= 0 || levels > 16) throw runtime_error("Levels must be between 1 and 16.");
+        argument_error++;
+        HFractalRenderSpec view;
+        view.offset_x = stold (argv[3]);
+        argument_error++;
+        view.offset_y = stold (argv[4]);
+        argument_error++;
+        view.zoom = stold (argv[5]);
+        if (view.zoom <= 0) throw runtime_error("Zoom must be positive.");
+        argument_error++;
+        view.equation = string (argv[6]);
+        argument_error++;
+        int threads = stoi (argv[7]);
+        if (threads <= 0) throw runtime_error("Must use at least one worker thread.");
+        argument_error++;
+        view.eval_limit = stoi (argv[8]);
+        if (view.eval_limit <= 0) throw runtime_error("Must use at least one evaluation iteration.");
+        argument_error++;
+        HFractalBatch batch (threads);
+        if (!batch.setOutputDirectory (string (argv[9]))) throw runtime_error("Unable to create output directory.");
+        argument_error++;
+        PYRAMID_LAYOUT layout = PL_XYZ;
+        if (argc >= 11 && string (argv[10]) == "dzi") layout = PL_DZI;
+        else if (argc >= 11 && string (argv[10]) != "xyz") throw runtime_error("Layout must be xyz or dzi.");
+        argument_error++;
+        IMAGE_TYPE image_type = PNG;
+        if (argc == 12 && !imageTypeFromName (string (argv[11]), image_type)) throw runtime_error("Image type must be pgm, ppm, png, raw or raw-rle.");
+        batch.setImageType (image_type);
+        argument_error = 1;
+        if (batch.addPyramid (view, levels, layout) < 0) throw runtime_error("Unable to create tile directories.");
+        return batch.run () != 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Render one image in bands, streaming each band to a PGM file as it completes, so images too large for memory can be rendered
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if the image was written
+ */
+int streamMain (int argc, char *argv[]) {
+    HFractalMain hm;
+    int argument_error = 1;
+    try {
+        hm.setResolution (stoi (argv[2]));
+        if (hm.getResolution() <= 0) throw runtime_error("Specified resolution too low.");
+        argument_error++;
+        hm.setOffsetX (stod (argv[3]));
+        argument_error++;
+        hm.setOffsetY (stod (argv[4]));
+        argument_error++;
+        hm.setZoom (stod (argv[5]));
+        argument_error++;
+        hm.setEquation (string (argv[6]));
+        if (!hm.isValidEquation()) throw runtime_error("Specified equation is invalid.");
+        argument_error++;
+        hm.setWorkerThreads (stoi (argv[7]));
+        if (hm.getWorkerThreads() <= 0) throw runtime_error("Must use at least one worker thread.");
+        argument_error++;
+        hm.setEvalLimit (stoi (argv[8]));
+        if (hm.getEvalLimit() <= 0) throw runtime_error("Must use at least one evaluation iteration.");
+        argument_error++;
+        string path = string (argv[9]);
+        argument_error++;
+        int band_height = (argc == 11) ? stoi (argv[10]) : STREAM_DEFAULT_BAND_HEIGHT;
+        if (band_height <= 0) throw runtime_error("Bands must have at least one row.");
+        int status = hm.generateImageStreamed (path, band_height);
+        if (status == 3) cout << "Unable to write " << path << endl;
+        return status != 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Render one image straight to a colour PNG file, compressing each band of rows as soon as it is rendered
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, 0 if the image was written
+ */
+int pngMain (int argc, char *argv[]) {
+    HFractalMain hm;
+    int argument_error = 1;
+    try {
+        hm.setResolution (stoi (argv[2]));
+        if (hm.getResolution() <= 0) throw runtime_error("Specified resolution too low.");
+        argument_error++;
+        hm.setOffsetX (stod (argv[3]));
+        argument_error++;
+        hm.setOffsetY (stod (argv[4]));
+        argument_error++;
+        hm.setZoom (stod (argv[5]));
+        argument_error++;
+        hm.setEquation (string (argv[6]));
+        if (!hm.isValidEquation()) throw runtime_error("Specified equation is invalid.");
+        argument_error++;
+        hm.setWorkerThreads (stoi (argv[7]));
+        if (hm.getWorkerThreads() <= 0) throw runtime_error("Must use at least one worker thread.");
+        argument_error++;
+        hm.setEvalLimit (stoi (argv[8]));
+        if (hm.getEvalLimit() <= 0) throw runtime_error("Must use at least one evaluation iteration.");
+        argument_error++;
+        string path = string (argv[9]);
+        argument_error++;
+        int colour_preset = (argc == 11) ? stoi (argv[10]) : CP_VAPORWAVE;
+        if (colour_preset < CP_VAPORWAVE || colour_preset > CP_GREYSCALE_DARK) throw runtime_error("Unknown colour preset.");
+        int status = hm.generateImagePNG (path, colour_preset);
+        if (status == 3) cout << "Unable to write " << path << endl;
+        return status != 0;
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * @brief Serve pyramid tiles of a view over HTTP on the loopback interface, rendering them on request through one persistent thread pool
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments, starting with the mode flag
+ * @return Exit code, only returned if the server could not start
+ */
+int serveMain (int argc, char *argv[]) {
+    int argument_error = 1;
+    try {
+        HFractalRenderSpec view;
+        view.offset_x = stold (argv[2]);
+        argument_error++;
+        view.offset_y = stold (argv[3]);
+        argument_error++;
+        view.zoom = stold (argv[4]);
+        if (view.zoom <= 0) throw runtime_error("Zoom must be positive.");
+        argument_error++;
+        int threads = stoi (argv[5]);
+        if (threads <= 0) throw runtime_error("Must use at least one worker thread.");
+        argument_error++;
+        int port = (argc == 7) ? stoi (argv[6]) : SERVER_DEFAULT_PORT;
+        if (port <= 0 || port > 65535) throw runtime_error("Port must be between 1 and 65535.");
+        HFractalServer server (port, threads, view);
+        return server.run ();
+    } catch (exception &e) {
+        cout << "Parameter error on argument number " << argument_error << ":" << endl;
+        cout << "  " << e.what() << endl;
+        return 1;
+    }
+}
+
 int main (int argc, char *argv[]) {
-    if (argc == 8) {
+    if (((argc == 5 || argc == 6) && string (argv[1]) == "--batch") || ((argc == 6 || argc == 7) && string (argv[1]) == "--batch-database")) {
+        // Render many images in one process, sharing threads and parsed equations between them
+        return batchMain (argc, argv);
+    } else if ((argc == 8 || argc == 9) && string (argv[1]) == "--animate") {
+        // Render the frames of a keyframed zoom or pan
+        return animationMain (argc, argv);
+    } else if ((argc == 12 || argc == 13) && string (argv[1]) == "--exp-zoom") {
+        // Render a zoom toward a fixed point from one exponential map strip
+        return expZoomMain (argc, argv);
+    } else if ((argc == 10 || argc == 11) && string (argv[1]) == "--stream") {
+        // Render an image too large for memory in bands
+        return streamMain (argc, argv);
+    } else if (argc >= 10 && argc <= 12 && string (argv[1]) == "--pyramid") {
+        // Render a tile pyramid for a web viewer
+        return pyramidMain (argc, argv);
+    } else if ((argc == 6 || argc == 7) && string (argv[1]) == "--serve") {
+        // Serve tiles to interactive clients from one long running process
+        return serveMain (argc, argv);
+    } else if ((argc == 10 || argc == 11) && string (argv[1]) == "--png") {
+        // Render an image straight to a compressed colour image
+        return pngMain (argc, argv);
+    } else if (argc == 8 || argc == 9) {
         // If we have the required arguments, run a console-only render
         HFractalMain hm;
+        HFractalTileCache tile_cache (TILE_CACHE_DEFAULT_BUDGET);
         int argument_error = 0;
         try {
             hm.setResolution (stoi (argv[1]));
@@ -41,6 +382,12 @@ int main (int argc, char *argv[]) {
             hm.setEvalLimit (stoi (argv[7]));
             if (hm.getEvalLimit() <= 0) throw runtime_error("Must use at least one evaluation iteration.");
             argument_error++;
+            if (argc == 9) {
+                // Optionally persist rendered tiles, so that repeated renders can reuse them
+                if (!tile_cache.setCacheDirectory (string (argv[8]))) throw runtime_error("Unable to create cache directory.");
+                hm.setTileCache (&tile_cache);
+            }
+            argument_error++;
             hm.generateImage(true);
             return !hm.autoWriteImage (IMAGE_TYPE::PGM);
         } catch (runtime_error e) {
@@ -51,11 +398,33 @@ int main (int argc, char *argv[]) {
     } else if (argc != 1) {
         // If we have only some arguments, show the user what arguments they need to provide
         cout << "Provide all the correct arguments please:" << endl;
-        cout << "int resolution, long double offset_x, long double offset_y, long double zoom, string equation, int worker_threads, int eval_limit" << endl;
+        cout << "int resolution, long double offset_x, long double offset_y, long double zoom, string equation, int worker_threads, int eval_limit, [string cache_directory]" << endl;
+        cout << "or: --batch string spec_file, int worker_threads, string output_directory, [string image_type]" << endl;
+        cout << "or: --batch-database string database_path, int resolution, int worker_threads, string output_directory, [string image_type]" << endl;
+        cout << "or: --animate string keyframe_file, int resolution, int eval_limit, string equation, int worker_threads, string output_directory, [string image_type]" << endl;
+        cout << "or: --stream int resolution, long double offset_x, long double offset_y, long double zoom, string equation, int worker_threads, int eval_limit, string output_path, [int band_height]" << endl;
+        cout << "or: --png int resolution, long double offset_x, long double offset_y, long double zoom, string equation, int worker_threads, int eval_limit, string output_path, [int colour_preset]" << endl;
+        cout << "or: --pyramid int levels, long double offset_x, long double offset_y, long double zoom, string equation, int worker_threads, int eval_limit, string output_directory, [string layout], [string image_type]" << endl;
+        cout << "or: --serve long double offset_x, long double offset_y, long double zoom, int worker_threads, [int port]" << endl;
+        cout << "or: --exp-zoom int resolution, long double offset_x, long double offset_y, long double zoom_start, long double zoom_end, int frames, string equation, int worker_threads, int eval_limit, string output_directory, [string image_type]" << endl;
         return 1;
     } else {
+        #ifdef HEADLESS
+        // Headless builds have no GUI to fall back on
+        cout << "Usage: " << argv[0] << " resolution offset_x offset_y zoom equation worker_threads eval_limit [cache_directory]" << endl;
+        cout << "       " << argv[0] << " --batch spec_file worker_threads output_directory [pgm|ppm|png|raw|raw-rle]" << endl;
+        cout << "       " << argv[0] << " --batch-database database_path resolution worker_threads output_directory [pgm|ppm|png|raw|raw-rle]" << endl;
+        cout << "       " << argv[0] << " --animate keyframe_file resolution eval_limit equation worker_threads output_directory [pgm|ppm|png|raw|raw-rle]" << endl;
+        cout << "       " << argv[0] << " --stream resolution offset_x offset_y zoom equation worker_threads eval_limit output_path [band_height]" << endl;
+        cout << "       " << argv[0] << " --png resolution offset_x offset_y zoom equation worker_threads eval_limit output_path [colour_preset]" << endl;
+        cout << "       " << argv[0] << " --pyramid levels offset_x offset_y zoom equation worker_threads eval_limit output_directory [xyz|dzi] [pgm|ppm|png|raw|raw-rle]" << endl;
+        cout << "       " << argv[0] << " --serve offset_x offset_y zoom worker_threads [port]" << endl;
+        cout << "       " << argv[0] << " --exp-zoom resolution offset_x offset_y zoom_start zoom_end frames equation worker_threads eval_limit output_directory [pgm|ppm|png|raw|raw-rle]" << endl;
+        return 1;
+        #else
         // Otherwise, start the GUI
         cout << trimExecutableFromPath(argv[0]) << endl;
         return guiMain(trimExecutableFromPath(argv[0]));
+        #endif
     }
 }
\ No newline at end of file
@@ -0,0 +1,237 @@
+// src/rawimage.cc
+
+#include "rawimage.hh"
+
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * @brief Map an iteration buffer file into memory and check its header, closing any file already open
+ *
+ * @param path Path to the file
+ * @return True for success, false if the file could not be mapped or is not a valid iteration buffer file
+ */
+bool HFractalRawReader::open (string path) {
+    close ();
+    #ifdef _WIN32
+    HANDLE file = CreateFileA (path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx (file, &file_size) && file_size.QuadPart > 0) mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle (file);
+        return false;
+    }
+    data = (const uint8_t *)MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+    file_handle = file;
+    mapping_handle = mapping;
+    size = file_size.QuadPart;
+    #else
+    int file = ::open (path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    struct stat file_stat;
+    if (fstat (file, &file_stat) != 0 || file_stat.st_size <= 0) {
+        ::close (file);
+        return false;
+    }
+    void *mapped = mmap (NULL, file_stat.st_size, PROT_READ, MAP_SHARED, file, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close (file);
+    if (mapped == MAP_FAILED) return false;
+    data = (const uint8_t *)mapped;
+    size = file_stat.st_size;
+    #endif
+    if (data == NULL || !validate ()) {
+        close ();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Unmap the open file, if any
+ *
+ */
+void HFractalRawReader::close () {
+    #ifdef _WIN32
+    if (data != NULL) UnmapViewOfFile (data);
+    if (mapping_handle != NULL) CloseHandle ((HANDLE)mapping_handle);
+    if (file_handle != NULL) CloseHandle ((HANDLE)file_handle);
+    file_handle = NULL;
+    mapping_handle = NULL;
+    #else
+    if (data != NULL) munmap ((void *)data, size);
+    #endif
+    data = NULL;
+    size = 0;
+    header = NULL;
+    index = NULL;
+    tiles_x = 0;
+    tiles_y = 0;
+}
+
+/**
+ * @brief Check that the mapped file starts with a supported header, and that the index and every tile it lists lie within the file, with tiles after the index. Sizes are compared against the space left after each offset, so that huge offsets cannot wrap around
+ *
+ * @return True if the file can be read safely
+ */
+bool HFractalRawReader::validate () {
+    if (size < sizeof (HFractalRawHeader)) return false;
+    header = (const HFractalRawHeader *)data;
+    if (strncmp (header->magic, RAW_MAGIC, sizeof (header->magic)) != 0 || header->version != RAW_VERSION) return false;
+    if (header->header_size < sizeof (HFractalRawHeader) || header->tile_size == 0 || header->width == 0 || header->height == 0) return false;
+    if (header->header_size + (uint64_t)header->equation_length > header->index_offset || header->index_offset % RAW_ALIGNMENT != 0) return false;
+
+    // Dimensions and tile counts are handled as ints, so reject any which do not fit, computing the counts in 64 bits so they cannot wrap
+    if (header->width > INT_MAX || header->height > INT_MAX || header->tile_size > INT_MAX) return false;
+    uint64_t count_x = ((uint64_t)header->width+header->tile_size-1)/header->tile_size;
+    uint64_t count_y = ((uint64_t)header->height+header->tile_size-1)/header->tile_size;
+    if (count_x*count_y > INT_MAX) return false;
+    tiles_x = (int)count_x;
+    tiles_y = (int)count_y;
+    uint64_t index_size = (uint64_t)getTileCount()*sizeof (HFractalRawTileEntry);
+    if (header->index_offset > size || index_size > size - header->index_offset) return false;
+    index = (const HFractalRawTileEntry *)(data + header->index_offset);
+    uint64_t tiles_start = header->index_offset + index_size;
+
+    for (int tile = 0; tile < getTileCount(); tile++) {
+        int x, y, w, h;
+        getTileBounds (tile, x, y, w, h);
+        const HFractalRawTileEntry &entry = index[tile];
+        if (entry.offset < tiles_start || entry.offset > size || entry.size > size - entry.offset || entry.offset % sizeof (uint16_t) != 0) return false;
+        if (entry.encoding == RE_PLAIN && entry.size != (uint64_t)w*h*sizeof (uint16_t)) return false;
+        if (entry.encoding == RE_RLE && entry.size % (2*sizeof (uint16_t)) != 0) return false;
+        if (entry.encoding != RE_PLAIN && entry.encoding != RE_RLE) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the equation string the image was rendered with
+ *
+ * @return The equation string
+ */
+string HFractalRawReader::getEquation () {
+    return string ((const char *)data + header->header_size, header->equation_length);
+}
+
+/**
+ * @brief Get the horizontal offset the image was rendered with, at full precision
+ *
+ * @return The offset
+ */
+long double HFractalRawReader::getOffsetX () {
+    return strtold (string (header->offset_x, strnlen (header->offset_x, sizeof (header->offset_x))).c_str(), NULL);
+}
+
+/**
+ * @brief Get the vertical offset the image was rendered with, at full precision
+ *
+ * @return The offset
+ */
+long double HFractalRawReader::getOffsetY () {
+    return strtold (string (header->offset_y, strnlen (header->offset_y, sizeof (header->offset_y))).c_str(), NULL);
+}
+
+/**
+ * @brief Get the zoom the image was rendered with, at full precision
+ *
+ * @return The zoom
+ */
+long double HFractalRawReader::getZoom () {
+    return strtold (string (header->zoom, strnlen (header->zoom, sizeof (header->zoom))).c_str(), NULL);
+}
+
+/**
+ * @brief Get the position and size of a tile. Tiles are numbered row by row, and are square except at the right and bottom edges
+ *
+ * @param tile Index of the tile
+ * @param x Output for the horizontal coordinate of the top-left pixel
+ * @param y Output for the vertical coordinate of the top-left pixel
+ * @param w Output for the width of the tile
+ * @param h Output for the height of the tile
+ */
+void HFractalRawReader::getTileBounds (int tile, int &x, int &y, int &w, int &h) {
+    int tile_size = header->tile_size;
+    x = (tile%tiles_x)*tile_size;
+    y = (tile/tiles_x)*tile_size;
+    w = min (tile_size, (int)header->width-x);
+    h = min (tile_size, (int)header->height-y);
+}
+
+/**
+ * @brief Get the values of a tile without copying them, row by row, directly from the mapped file
+ *
+ * @param tile Index of the tile
+ * @return Pointer to the values, valid until the file is closed, or NULL if the tile is run length encoded or out of range
+ */
+const uint16_t *HFractalRawReader::getTileData (int tile) {
+    if (tile < 0 || tile >= getTileCount() || index[tile].encoding != RE_PLAIN) return NULL;
+    return (const uint16_t *)(data + index[tile].offset);
+}
+
+/**
+ * @brief Copy the values of a tile into a buffer, decoding runs if the tile is run length encoded
+ *
+ * @param tile Index of the tile
+ * @param values Buffer to copy values into, row by row, which must hold at least the tile's width times height values
+ * @return True for success, false if the tile is out of range or its runs do not fill it exactly
+ */
+bool HFractalRawReader::readTile (int tile, uint16_t *values) {
+    if (tile < 0 || tile >= getTileCount()) return false;
+    int x, y, w, h;
+    getTileBounds (tile, x, y, w, h);
+    const uint16_t *stored = (const uint16_t *)(data + index[tile].offset);
+    size_t count = (size_t)w*h;
+    if (index[tile].encoding == RE_PLAIN) {
+        memcpy (values, stored, count*sizeof (uint16_t));
+        return true;
+    }
+    size_t filled = 0;
+    for (size_t i = 0; i+1 < index[tile].size/sizeof (uint16_t); i += 2) {
+        size_t run = stored[i];
+        if (filled+run > count) return false;
+        fill (values+filled, values+filled+run, stored[i+1]);
+        filled += run;
+    }
+    return filled == count;
+}
+
+/**
+ * @brief Get the value of a single pixel. Convenient for sparse lookups, but reading whole tiles is much faster when many pixels are needed
+ *
+ * @param x Horizontal coordinate
+ * @param y Vertical coordinate
+ * @return The value of the pixel, or 0 if it is out of range or its tile is corrupt
+ */
+uint16_t HFractalRawReader::get (int x, int y) {
+    if (x < 0 || y < 0 || x >= getWidth() || y >= getHeight()) return 0;
+    int tile_size = header->tile_size;
+    int tile = ((y/tile_size)*tiles_x) + (x/tile_size);
+    int tile_x, tile_y, tile_w, tile_h;
+    getTileBounds (tile, tile_x, tile_y, tile_w, tile_h);
+    int64_t offset = ((int64_t)(y-tile_y)*tile_w) + (x-tile_x);
+    const uint16_t *plain = getTileData (tile);
+    if (plain != NULL) return plain[offset];
+    // Walk the runs until the one covering the pixel
+    const uint16_t *stored = (const uint16_t *)(data + index[tile].offset);
+    int64_t filled = 0;
+    for (size_t i = 0; i+1 < index[tile].size/sizeof (uint16_t); i += 2) {
+        filled += stored[i];
+        if (offset < filled) return stored[i+1];
+    }
+    return 0;
+}
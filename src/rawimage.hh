@@ -0,0 +1,58 @@
+// src/rawimage.hh
+
+#ifndef RAWIMAGE_H
+#define RAWIMAGE_H
+
+#include <string>
+#include <cstdint>
+
+#include "image.hh"
+
+/**
+ * Class giving read access to an iteration buffer file written by HFractalImage::writeRaw.
+ * The file is memory mapped rather than read, so opening it costs nothing however large it is, and plain tiles are used in place without being copied
+ */
+class HFractalRawReader {
+private:
+    const uint8_t *data = NULL; // Start of the mapped file
+    uint64_t size = 0; // Size of the mapped file in bytes
+    const HFractalRawHeader *header = NULL; // Header at the start of the file
+    const HFractalRawTileEntry *index = NULL; // Tile index, one entry per tile
+    int tiles_x = 0; // Number of tiles across and down the image
+    int tiles_y = 0;
+    #ifdef _WIN32
+    void *file_handle = NULL; // Handles of the open file and its mapping
+    void *mapping_handle = NULL;
+    #endif
+
+    bool validate (); // Check that the header and index describe a file of this size
+
+public:
+    bool open (std::string); // Map an iteration buffer file, replacing any file already open
+    void close (); // Unmap the open file, if any
+    bool isOpen () { return data != NULL; } // Check if a file is open
+
+    int getWidth () { return header->width; } // Get the dimensions of the image
+    int getHeight () { return header->height; }
+    int getTileSize () { return header->tile_size; } // Get the side length of the tiles
+    int getTileCount () { return tiles_x*tiles_y; } // Get the number of tiles
+    int getEvalLimit () { return header->eval_limit; } // Get the evaluation limit of the render
+    int getAccuracy () { return header->accuracy; } // Get the MATH_ACCURACY of the render
+    int getRenderStrategy () { return header->render_strategy; } // Get the RENDER_STRATEGY of the render
+    int getPrecisionBits () { return header->precision_bits; } // Get the number of mantissa bits pixel coordinates were computed with
+    std::string getEquation (); // Get the equation string of the render
+    long double getOffsetX (); // Get the exact parameters of the render
+    long double getOffsetY ();
+    long double getZoom ();
+
+    void getTileBounds (int, int &, int &, int &, int &); // Get the position and size of a tile from its index
+    const uint16_t *getTileData (int); // Get a pointer to the values of a plain tile inside the mapped file, or NULL if the tile is run length encoded
+    bool readTile (int, uint16_t *); // Copy or decode the values of a tile into a buffer
+    uint16_t get (int, int); // Get the value of a single pixel
+
+    HFractalRawReader () {} // Initialise with no file open
+    HFractalRawReader (std::string path) { open (path); } // Map an iteration buffer file
+    ~HFractalRawReader () { close (); } // Destructor, unmaps the file
+};
+
+#endif
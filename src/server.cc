@@ -0,0 +1,465 @@
+// src/server.cc
+
+#include "server.hh"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+#include "utils.hh"
+
+using namespace std;
+
+/**
+ * @brief Close a socket
+ *
+ * @param s The socket
+ */
+static void closeSocket (HFractalSocket s) {
+    #ifdef _WIN32
+    closesocket ((SOCKET)s);
+    #else
+    close (s);
+    #endif
+}
+
+/**
+ * @brief Send every byte of a buffer, continuing after partial sends
+ *
+ * @param s Connected socket
+ * @param data Bytes to send
+ * @param length Number of bytes
+ * @return True if everything was sent, false if the connection failed
+ */
+static bool sendAll (HFractalSocket s, const char *data, size_t length) {
+    while (length > 0) {
+        int sent = send (s, data, (int)min (length, (size_t)1 << 20), 0);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/**
+ * @brief Make a plain text body for a response
+ *
+ * @param message Text of the body
+ * @param body Output for the body
+ * @param content_type Output for the content type of the body
+ */
+static void textBody (string message, shared_ptr<const vector<uint8_t>> &body, string &content_type) {
+    body = make_shared<const vector<uint8_t>> (message.begin(), message.end());
+    content_type = "text/plain";
+}
+
+/**
+ * @brief Construct a tile server. Nothing is bound until run is called
+ *
+ * @param port_ Port to listen on
+ * @param threads Number of worker threads rendering tiles
+ * @param view_ Offsets and zoom which level 0 of the pyramid covers
+ */
+HFractalServer::HFractalServer (int port_, int threads, HFractalRenderSpec view_) : tile_cache (TILE_CACHE_DEFAULT_BUDGET) {
+    port = port_;
+    worker_threads = threads;
+    view = view_;
+}
+
+/**
+ * @brief Listen on the loopback interface and serve requests, each connection on its own thread, while the worker threads render the tiles they ask for
+ *
+ * @return 1 if the server could not start listening, otherwise does not return until the process ends
+ */
+int HFractalServer::run () {
+    #ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup (MAKEWORD (2, 2), &wsa_data) != 0) return 1;
+    SOCKET listener = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET) return 1;
+    #else
+    // Writing to a connection the client has closed should fail rather than end the process
+    signal (SIGPIPE, SIG_IGN);
+    int listener = socket (AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return 1;
+    #endif
+    int reuse = 1;
+    setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof (reuse));
+    sockaddr_in address;
+    memset (&address, 0, sizeof (address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons (port);
+    address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (::bind (listener, (sockaddr *)&address, sizeof (address)) != 0 || listen (listener, SOMAXCONN) != 0) {
+        if (verbose) cout << "Unable to listen on port " << port << endl;
+        closeSocket (listener);
+        return 1;
+    }
+
+    for (int i = 0; i < worker_threads; i++) thread (&HFractalServer::workerMain, this).detach();
+    if (verbose) cout << "Serving tiles at http://127.0.0.1:" << port << "/z/x/y.png?eq=<equation>&limit=<eval_limit>[&palette=<colour_preset>] on " << worker_threads << " threads" << endl;
+
+    while (true) {
+        #ifdef _WIN32
+        SOCKET client = accept (listener, NULL, NULL);
+        bool accepted = client != INVALID_SOCKET;
+        #else
+        int client = accept (listener, NULL, NULL);
+        bool accepted = client >= 0;
+        #endif
+        if (!accepted) {
+            crossPlatformDelay (10);
+            continue;
+        }
+        mut.lock();
+        bool refuse = connections >= SERVER_MAX_CONNECTIONS;
+        if (!refuse) connections++;
+        mut.unlock();
+        if (refuse) {
+            const char *busy = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            sendAll ((HFractalSocket)client, busy, strlen (busy));
+            closeSocket ((HFractalSocket)client);
+            continue;
+        }
+        thread (&HFractalServer::handleConnection, this, (HFractalSocket)client).detach();
+    }
+}
+
+/**
+ * @brief Main function called on each worker thread. Fetches parts of the oldest queued tile, moving on to the next tile as soon as every part of it is handed out, and the thread finishing the last part of a tile encodes it
+ *
+ */
+void HFractalServer::workerMain () {
+    unique_lock<mutex> lock (mut);
+    while (true) {
+        work_available.wait (lock, [this] { return !queue.empty(); });
+        shared_ptr<HFractalServerJob> job = queue.front();
+        if (job->environment == NULL && !job->exhausted && !job->starting) startJob (*job, lock);
+        if (job->starting) {
+            // Another thread is allocating this tile, so wait until its parts can be fetched
+            job_started.wait (lock, [&job] { return !job->starting; });
+            continue;
+        }
+        int part = (job->environment == NULL) ? -1 : job->environment->fetchTile();
+        if (part == -1) {
+            queue.pop_front();
+            job->exhausted = true;
+            if (job->in_flight == 0) {
+                lock.unlock();
+                finishJob (job);
+                lock.lock();
+            }
+            continue;
+        }
+        job->in_flight++;
+        lock.unlock();
+
+        job->environment->renderTile (part);
+
+        lock.lock();
+        job->in_flight--;
+        if (job->exhausted && job->in_flight == 0) {
+            lock.unlock();
+            finishJob (job);
+            lock.lock();
+        }
+    }
+}
+
+/**
+ * @brief Create the rendering environment for a tile, using its shared equation and the shared tile cache. Assumes the mutex is locked, and releases it while the tile is allocated, with the tile marked as starting so that other threads wait for it
+ *
+ * @param job The tile to start
+ * @param lock Lock held on the mutex
+ */
+void HFractalServer::startJob (HFractalServerJob &job, unique_lock<mutex> &lock) {
+    HFractalMain *environment = new HFractalMain;
+    environment->setVerbose (false);
+    environment->setResolution (job.spec.resolution);
+    environment->setOffsetX (job.spec.offset_x);
+    environment->setOffsetY (job.spec.offset_y);
+    environment->setZoom (job.spec.zoom);
+    environment->setEvalLimit (job.spec.eval_limit);
+    environment->setWorkerThreads (1);
+    environment->setTileCache (&tile_cache);
+    environment->setSharedEquation (job.spec.equation, job.equation.get());
+    job.starting = true;
+    lock.unlock();
+    int result = environment->beginRender ();
+    lock.lock();
+    job.starting = false;
+    job_started.notify_all ();
+    if (result != 0) {
+        delete environment;
+        return;
+    }
+    job.environment = environment;
+}
+
+/**
+ * @brief Encode a tile once every part of it is rendered, free its rendering environment, then publish the response to every request waiting for it and to the response cache
+ *
+ * @param job The completed tile
+ */
+void HFractalServer::finishJob (shared_ptr<HFractalServerJob> job) {
+    shared_ptr<vector<uint8_t>> png = make_shared<vector<uint8_t>> ();
+    bool encoded = false;
+    if (job->environment != NULL) {
+        job->environment->endRender ();
+        encoded = job->environment->encodePNG (*png, job->spec.palette);
+        delete job->environment;
+        job->environment = NULL;
+    }
+    string content_type;
+    shared_ptr<const vector<uint8_t>> body = png;
+    if (!encoded) textBody ("Render failed\n", body, content_type);
+
+    lock_guard<mutex> lock (mut);
+    job->status = encoded ? 200 : 500;
+    job->response = body;
+    job->done = true;
+    in_flight.erase (job->key);
+    if (encoded) cacheResponse (job->key, body);
+    job_finished.notify_all ();
+}
+
+/**
+ * @brief Add an encoded tile to the front of the response cache, evicting the least recently used tiles beyond the memory budget. Assumes the mutex is locked
+ *
+ * @param key Key of the tile
+ * @param response Encoded tile
+ */
+void HFractalServer::cacheResponse (string key, shared_ptr<const vector<uint8_t>> response) {
+    if (response_index.count (key) != 0) return;
+    responses.push_front ({ key, response });
+    response_index[key] = responses.begin();
+    response_memory += response->size() + key.size();
+    while (response_memory > SERVER_RESPONSE_CACHE_BUDGET && !responses.empty()) {
+        response_memory -= responses.back().second->size() + responses.back().first.size();
+        response_index.erase (responses.back().first);
+        responses.pop_back();
+    }
+}
+
+/**
+ * @brief Get the parsed form of an equation, shared by every tile using it, parsing it the first time it is requested. Parsing happens outside the mutex so that it does not hold up other requests.
+ * At most SERVER_MAX_EQUATIONS equations are kept, evicting the least recently used. Tiles hold their own reference, so an evicted equation is only freed once no tile is using it. Strings which fail to parse are not kept
+ *
+ * @param equation String equation
+ * @return The parsed equation, or NULL if the string is invalid
+ */
+shared_ptr<HFractalEquation> HFractalServer::getEquation (string equation) {
+    {
+        lock_guard<mutex> lock (mut);
+        auto it = equation_index.find (equation);
+        if (it != equation_index.end()) {
+            equations.splice (equations.begin(), equations, it->second);
+            return it->second->second;
+        }
+    }
+    HFractalEquation *parsed = NULL;
+    try {
+        parsed = HFractalMain::parseEquation (equation);
+    } catch (...) {
+        parsed = NULL;
+    }
+    if (parsed == NULL) return NULL;
+    shared_ptr<HFractalEquation> shared (parsed);
+    lock_guard<mutex> lock (mut);
+    // Another request may have parsed the same equation in the meantime
+    auto it = equation_index.find (equation);
+    if (it != equation_index.end()) return it->second->second;
+    equations.push_front ({ equation, shared });
+    equation_index[equation] = equations.begin();
+    while (equations.size() > SERVER_MAX_EQUATIONS) {
+        equation_index.erase (equations.back().first);
+        equations.pop_back();
+    }
+    return shared;
+}
+
+/**
+ * @brief Read one request from a connection, answer it and close the connection
+ *
+ * @param client Connected socket
+ */
+void HFractalServer::handleConnection (HFractalSocket client) {
+    // Slow clients are dropped rather than holding a thread indefinitely
+    #ifdef _WIN32
+    DWORD timeout = SERVER_TIMEOUT_SECONDS*1000;
+    #else
+    timeval timeout = { SERVER_TIMEOUT_SECONDS, 0 };
+    #endif
+    setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof (timeout));
+    setsockopt (client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof (timeout));
+
+    string request;
+    char buffer[1024];
+    while (request.find ("\r\n\r\n") == string::npos && request.size() < SERVER_MAX_REQUEST) {
+        int received = recv (client, buffer, sizeof (buffer), 0);
+        if (received <= 0) break;
+        request.append (buffer, received);
+    }
+
+    shared_ptr<const vector<uint8_t>> body;
+    string content_type;
+    int status = 400;
+    if (request.find ("\r\n\r\n") == string::npos) textBody ("Incomplete request\n", body, content_type);
+    else status = handleRequest (request, body, content_type);
+
+    string reason = "Bad Request";
+    if (status == 200) reason = "OK";
+    else if (status == 404) reason = "Not Found";
+    else if (status == 405) reason = "Method Not Allowed";
+    else if (status == 500) reason = "Internal Server Error";
+    else if (status == 503) reason = "Service Unavailable";
+    string header = "HTTP/1.1 " + to_string (status) + " " + reason + "\r\n";
+    header += "Content-Type: " + content_type + "\r\n";
+    header += "Content-Length: " + to_string (body->size()) + "\r\n";
+    header += "Access-Control-Allow-Origin: *\r\n";
+    if (status == 200 && content_type == "image/png") header += "Cache-Control: max-age=86400\r\n";
+    if (status == 503) header += "Retry-After: 1\r\n";
+    header += "Connection: close\r\n\r\n";
+    if (sendAll (client, header.data(), header.size())) sendAll (client, (const char *)body->data(), body->size());
+    closeSocket (client);
+
+    lock_guard<mutex> lock (mut);
+    connections--;
+}
+
+/**
+ * @brief Answer a request for a tile, or for the server's statistics at /status. A tile is served from the response cache if possible, otherwise the request waits for the render of the tile already in progress, or queues a new render if the queue has room
+ *
+ * @param request Full request header
+ * @param body Output for the body of the response
+ * @param content_type Output for the content type of the body
+ * @return HTTP status of the response
+ */
+int HFractalServer::handleRequest (string request, shared_ptr<const vector<uint8_t>> &body, string &content_type) {
+    istringstream request_line (request.substr (0, request.find ("\r\n")));
+    string method, target;
+    request_line >> method >> target;
+    if (method != "GET") {
+        textBody ("Only GET requests are supported\n", body, content_type);
+        return 405;
+    }
+    size_t question = target.find ('?');
+    string path = target.substr (0, question);
+    string query = (question == string::npos) ? "" : target.substr (question+1);
+
+    if (path == "/status") {
+        lock_guard<mutex> lock (mut);
+        ostringstream status;
+        status << "requests " << requests << "\ncache_hits " << cache_hits << "\ncoalesced " << coalesced << "\nrejected " << rejected << "\n";
+        status << "queued " << queue.size() << "\nin_flight " << in_flight.size() << "\nconnections " << connections << "\n";
+        status << "cached_tiles " << responses.size() << "\ncached_bytes " << response_memory << "\n";
+        textBody (status.str(), body, content_type);
+        return 200;
+    }
+
+    int z, x, y;
+    char trailing;
+    if (sscanf (path.c_str(), "/%d/%d/%d.png%c", &z, &x, &y, &trailing) != 3) {
+        textBody ("Tiles are requested as /z/x/y.png?eq=<equation>&limit=<eval_limit>[&palette=<colour_preset>]\n", body, content_type);
+        return 404;
+    }
+    if (z < 0 || z > SERVER_MAX_LEVEL || x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z)) {
+        textBody ("Tile is outside the pyramid\n", body, content_type);
+        return 404;
+    }
+
+    // Parameters are separated by '&', with '+' left as it is since equations use it
+    map<string, string> parameters;
+    istringstream fields (query);
+    string field;
+    while (getline (fields, field, '&')) {
+        size_t equals = field.find ('=');
+        if (equals != string::npos) parameters[field.substr (0, equals)] = urlDecode (field.substr (equals+1));
+    }
+    HFractalRenderSpec tile_view = view;
+    try {
+        if (parameters.count ("eq") == 0 || parameters.count ("limit") == 0) throw runtime_error("Parameters eq and limit are required");
+        tile_view.equation = parameters["eq"];
+        tile_view.eval_limit = stoi (parameters["limit"]);
+        if (tile_view.eval_limit <= 0 || tile_view.eval_limit > 65535) throw runtime_error("Evaluation limit must be between 1 and 65535");
+        tile_view.palette = parameters.count ("palette") != 0 ? stoi (parameters["palette"]) : CP_VAPORWAVE;
+        if (tile_view.palette < CP_VAPORWAVE || tile_view.palette > CP_GREYSCALE_DARK) throw runtime_error("Unknown colour preset");
+    } catch (exception &e) {
+        textBody (string (e.what()) + "\n", body, content_type);
+        return 400;
+    }
+    shared_ptr<HFractalEquation> equation = getEquation (tile_view.equation);
+    if (equation == NULL) {
+        textBody ("Equation is invalid\n", body, content_type);
+        return 400;
+    }
+    HFractalRenderSpec spec = HFractalBatch::getPyramidTile (tile_view, PYRAMID_TILE_SIZE << z, PYRAMID_TILE_SIZE, x, y);
+    string key = to_string (z) + "/" + to_string (x) + "/" + to_string (y) + "|" + to_string (spec.eval_limit) + "|" + to_string (spec.palette) + "|" + spec.equation;
+
+    unique_lock<mutex> lock (mut);
+    requests++;
+    auto cached = response_index.find (key);
+    if (cached != response_index.end()) {
+        cache_hits++;
+        responses.splice (responses.begin(), responses, cached->second);
+        body = cached->second->second;
+        content_type = "image/png";
+        return 200;
+    }
+    shared_ptr<HFractalServerJob> job;
+    auto running = in_flight.find (key);
+    if (running != in_flight.end()) {
+        coalesced++;
+        job = running->second;
+    } else {
+        if ((int)queue.size() >= SERVER_MAX_QUEUE) {
+            rejected++;
+            lock.unlock();
+            textBody ("Too many tiles queued, try again shortly\n", body, content_type);
+            return 503;
+        }
+        job = make_shared<HFractalServerJob> ();
+        job->key = key;
+        job->spec = spec;
+        job->equation = equation;
+        in_flight[key] = job;
+        queue.push_back (job);
+        work_available.notify_all ();
+    }
+    job_finished.wait (lock, [&job] { return job->done; });
+    body = job->response;
+    content_type = (job->status == 200) ? "image/png" : "text/plain";
+    return job->status;
+}
+
+/**
+ * @brief Decode the percent escapes in part of a URL
+ *
+ * @param text Encoded text
+ * @return Decoded text
+ */
+string HFractalServer::urlDecode (string text) {
+    string decoded;
+    for (size_t i = 0; i < text.length(); i++) {
+        unsigned int value;
+        if (text[i] == '%' && i+2 < text.length() && isxdigit (text[i+1]) && isxdigit (text[i+2]) && sscanf (text.substr (i+1, 2).c_str(), "%x", &value) == 1) {
+            decoded += (char)value;
+            i += 2;
+        } else decoded += text[i];
+    }
+    return decoded;
+}
@@ -0,0 +1,97 @@
+// src/server.hh
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "hyperfractal.hh"
+#include "batch.hh"
+
+#define SERVER_DEFAULT_PORT 8080 // Port the tile server listens on if none is given
+#define SERVER_MAX_QUEUE 64 // Largest number of distinct tiles waiting to be rendered, beyond which new tiles are refused until the queue drains
+#define SERVER_MAX_CONNECTIONS 256 // Largest number of connections served at once
+#define SERVER_RESPONSE_CACHE_BUDGET (64*1024*1024) // Memory budget of the cache of encoded tiles, in bytes
+#define SERVER_MAX_EQUATIONS 64 // Largest number of parsed equations kept, beyond which the least recently used are freed once no tile is using them
+#define SERVER_MAX_REQUEST 8192 // Largest request header accepted, in bytes
+#define SERVER_TIMEOUT_SECONDS 10 // Time a client may take to send its request or receive its response
+#define SERVER_MAX_LEVEL 22 // Deepest pyramid level served, beyond which the dimension of a level no longer fits in an int
+
+#ifdef _WIN32
+typedef uintptr_t HFractalSocket; // Native socket handle, SOCKET on Windows
+#else
+typedef int HFractalSocket;
+#endif
+
+// Struct describing one tile being rendered by the server, shared by every request waiting for it
+struct HFractalServerJob {
+    std::string key; // Key identifying the tile and everything else affecting its encoded image
+    HFractalRenderSpec spec; // Parameters of the tile
+    std::shared_ptr<HFractalEquation> equation; // Parsed equation, kept alive until the tile is finished
+    HFractalMain *environment = NULL; // Rendering environment, only allocated while the tile is being rendered
+    bool starting = false; // Whether a worker thread is allocating the tile, outside the mutex
+    int in_flight = 0; // Number of parts of the tile fetched by worker threads which are still being rendered
+    bool exhausted = false; // Whether every part of the tile has been fetched
+    bool done = false; // Whether the response is ready
+    int status = 200; // HTTP status of the response
+    std::shared_ptr<const std::vector<uint8_t>> response; // Encoded PNG image, or an error message
+};
+
+/**
+ * Class serving pyramid tiles over HTTP on the loopback interface, so that interactive clients and web viewers can request renders without starting a process per image.
+ * Tiles are requested as /z/x/y.png?eq=<equation>&limit=<eval_limit>[&palette=<colour_preset>], in the XYZ layout of HFractalBatch::addPyramid, with level 0 covering the server's view.
+ * One pool of worker threads renders every tile, fetching parts of the oldest tile first as HFractalBatch does. The most recently used parsed equations and a tile cache persist across requests, requests for a tile already being rendered wait for that render rather than starting another, and encoded tiles are kept in a response cache.
+ * The number of distinct tiles waiting is bounded, and requests beyond it are refused with 503 so that a burst of slow tiles delays new requests by at most a bounded amount rather than indefinitely
+ */
+class HFractalServer {
+private:
+    int port; // Port listened on
+    int worker_threads; // Number of worker threads rendering tiles
+    HFractalRenderSpec view; // Offsets and zoom of level 0 of the pyramid
+    bool verbose = true; // Whether the server's address and failures are written to the terminal
+
+    std::deque<std::shared_ptr<HFractalServerJob>> queue; // Tiles with parts left to fetch, oldest first
+    std::unordered_map<std::string, std::shared_ptr<HFractalServerJob>> in_flight; // Tiles requested but not finished, against their keys
+    std::list<std::pair<std::string, std::shared_ptr<HFractalEquation>>> equations; // Parsed equations against their strings, most recently used first. Strings which fail to parse are not kept
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::shared_ptr<HFractalEquation>>>::iterator> equation_index; // Map of strings to parsed equations
+    HFractalTileCache tile_cache; // Rendered values shared by every tile, so that tiles requested again with another palette are not recomputed
+    std::list<std::pair<std::string, std::shared_ptr<const std::vector<uint8_t>>>> responses; // Encoded tiles against their keys, most recently used first
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::shared_ptr<const std::vector<uint8_t>>>>::iterator> response_index; // Map of keys to encoded tiles
+    size_t response_memory = 0; // Number of bytes occupied by encoded tiles
+    int connections = 0; // Number of connections currently being served
+    long requests = 0; // Number of tile requests received
+    long cache_hits = 0; // Number of tile requests answered from the response cache
+    long coalesced = 0; // Number of tile requests which waited for a render already in progress
+    long rejected = 0; // Number of tile requests refused because the queue was full
+    std::mutex mut; // Mutex object used to lock the queue, caches and statistics between threads
+    std::condition_variable work_available; // Signalled when a tile is queued
+    std::condition_variable job_finished; // Signalled when a tile's response is ready
+    std::condition_variable job_started; // Signalled when a tile has finished being allocated
+
+    void workerMain (); // Method called on each worker thread, fetching and rendering parts of the oldest tile
+    void startJob (HFractalServerJob &, std::unique_lock<std::mutex> &); // Create the rendering environment for a tile, assuming the mutex is locked and releasing it while the tile is allocated
+    void finishJob (std::shared_ptr<HFractalServerJob>); // Encode a completed tile, publish its response and wake the requests waiting for it
+    void cacheResponse (std::string, std::shared_ptr<const std::vector<uint8_t>>); // Add an encoded tile to the response cache, assuming the mutex is locked
+    std::shared_ptr<HFractalEquation> getEquation (std::string); // Get the shared parsed form of an equation, parsing it on first use
+    void handleConnection (HFractalSocket); // Read one request from a connection, answer it and close the connection
+    int handleRequest (std::string, std::shared_ptr<const std::vector<uint8_t>> &, std::string &); // Answer a request, returning its HTTP status along with the body and its content type
+    static std::string urlDecode (std::string); // Decode percent escapes in part of a URL
+
+public:
+    HFractalServer (int, int, HFractalRenderSpec); // Initialise a server with a port, a number of worker threads and the view of level 0
+
+    bool getVerbose () { return verbose; } // Inline methods to get/set whether the server writes to the terminal
+    void setVerbose (bool v_) { verbose = v_; }
+
+    int run (); // Listen for requests and serve them, blocking until the process ends
+};
+
+#endif
@@ -0,0 +1,258 @@
+// src/tilecache.cc
+
+#include "tilecache.hh"
+
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <cmath>
+
+using namespace std;
+
+/**
+ * @brief Initialise an empty tile cache
+ * 
+ * @param budget Maximum number of bytes the cached tiles may occupy
+ */
+HFractalTileCache::HFractalTileCache (size_t budget) {
+    memory_budget = budget;
+}
+
+/**
+ * @brief Construct the key which identifies a tile. Tiles are placed by the global index of their top-left pixel on the lattice of pixels at the given spacing, counted from the origin of the complex plane, so views panned by whole pixels share tiles.
+ * The spacing is written in hexadecimal so that the key is exact, and the sub-pixel phase of the lattice is rounded to TILE_CACHE_PHASE_STEPS, so two tiles with the same key hold values for the same points to within that fraction of a pixel
+ * 
+ * @param equation Canonical form of the equation being rendered
+ * @param eval_limit Evaluation limit being used
+ * @param spacing Distance in the complex plane between adjacent pixels
+ * @param phase_x Horizontal offset of the view's pixels from the lattice, as a fraction of a pixel
+ * @param phase_y Vertical offset of the view's pixels from the lattice, as a fraction of a pixel
+ * @param index_x Global column of the top-left pixel of the tile on the lattice
+ * @param index_y Global row of the top-left pixel of the tile on the lattice
+ * @param width Width of the tile
+ * @param height Height of the tile
+ * @return The key for the tile
+ */
+string HFractalTileCache::makeKey (string equation, int eval_limit, long double spacing, long double phase_x, long double phase_y, int64_t index_x, int64_t index_y, int width, int height) {
+    char buffer[256];
+    long long steps_x = llroundl (phase_x*TILE_CACHE_PHASE_STEPS);
+    long long steps_y = llroundl (phase_y*TILE_CACHE_PHASE_STEPS);
+    snprintf (buffer, sizeof(buffer), "%s|%d|%La|%lld:%lld|%lld:%lld|%dx%d|", TILE_CACHE_PRECISION, eval_limit, spacing, steps_x, steps_y, (long long)index_x, (long long)index_y, width, height);
+    return string (buffer) + equation;
+}
+
+/**
+ * @brief Estimate the number of bytes occupied by a cached tile, including bookkeeping overhead
+ * 
+ * @param tile Tile to measure
+ * @return Approximate size in bytes
+ */
+size_t HFractalTileCache::tileMemory (const HFractalCachedTile &tile) {
+    // Key is stored twice, once in the tile and once in the index
+    return sizeof(HFractalCachedTile) + (tile.data.size()*sizeof(uint16_t)) + (2*tile.key.size()) + 64;
+}
+
+/**
+ * @brief Remove least recently used tiles until the cache fits within its memory budget. Assumes the mutex is already locked
+ * 
+ */
+void HFractalTileCache::evict () {
+    while (memory_used > memory_budget && !tiles.empty()) {
+        memory_used -= tileMemory (tiles.back());
+        index.erase (tiles.back().key);
+        tiles.pop_back();
+    }
+}
+
+/**
+ * @brief Look up a tile, and copy it into a buffer if present. Tiles not held in memory are read from the cache directory, if one is set. Updates hit and miss counters
+ * 
+ * @param key Key of the tile to look up
+ * @param values Buffer to copy the tile into
+ * @param size Number of values the buffer holds, which a tile must match exactly to be copied
+ * @return True if the tile was found, false otherwise
+ */
+bool HFractalTileCache::fetch (string key, uint16_t *values, int size) {
+    mut.lock();
+    auto it = index.find (key);
+    if (it != index.end() && it->second->data.size() == (size_t)size) {
+        hits++;
+        // Move the tile to the front, marking it as most recently used
+        tiles.splice (tiles.begin(), tiles, it->second);
+        memcpy (values, it->second->data.data(), it->second->data.size()*sizeof(uint16_t));
+        mut.unlock();
+        return true;
+    }
+    mut.unlock();
+
+    // Fall back to the cache directory, without holding the lock during file access
+    vector<uint16_t> data;
+    bool found = readTile (key, data, size);
+
+    mut.lock();
+    if (found) {
+        hits++;
+        disk_hits++;
+        insert (key, data.data(), data.size());
+        memcpy (values, data.data(), data.size()*sizeof(uint16_t));
+    } else {
+        misses++;
+    }
+    mut.unlock();
+    return found;
+}
+
+/**
+ * @brief Insert a tile into the cache, evicting older tiles if necessary, and persist it to the cache directory if one is set
+ * 
+ * @param key Key of the tile
+ * @param values Rendered values of the tile, row by row
+ * @param size Number of values in the tile
+ */
+void HFractalTileCache::store (string key, const uint16_t *values, int size) {
+    mut.lock();
+    insert (key, values, size);
+    mut.unlock();
+    writeTile (key, values, size);
+}
+
+/**
+ * @brief Insert a tile into memory, evicting older tiles if necessary. Assumes the mutex is already locked
+ * 
+ * @param key Key of the tile
+ * @param values Rendered values of the tile, row by row
+ * @param size Number of values in the tile
+ */
+void HFractalTileCache::insert (string key, const uint16_t *values, int size) {
+    if (index.count (key) != 0) return;
+    HFractalCachedTile tile;
+    tile.key = key;
+    tile.data.assign (values, values+size);
+    // Don't bother caching tiles which could never fit
+    if (tileMemory (tile) > memory_budget) return;
+    memory_used += tileMemory (tile);
+    tiles.push_front (tile);
+    index[key] = tiles.begin();
+    evict ();
+}
+
+/**
+ * @brief Set the directory tiles are persisted in, allowing tiles to be reused across runs. Tiles are stored in individual files named by a hash of their key
+ * 
+ * @param path Path to the directory, or an empty string to disable persistence
+ * @return True if the directory exists or was created, false otherwise
+ */
+bool HFractalTileCache::setCacheDirectory (string path) {
+    if (path.length() > 0 && path.back() != '/' && path.back() != '\\') path += '/';
+    error_code ec;
+    if (path.length() > 0 && !filesystem::is_directory (path, ec)) {
+        filesystem::create_directories (path, ec);
+        if (ec) return false;
+    }
+    lock_guard<mutex> lock (mut);
+    cache_directory = path;
+    return true;
+}
+
+/**
+ * @brief Hash a tile key using 64 bit FNV-1a, giving the content address the tile is stored under
+ * 
+ * @param key Tile key to hash
+ * @return The hash of the key
+ */
+uint64_t HFractalTileCache::hashKey (string key) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : key) {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * @brief Get the path of the file a tile is persisted in
+ * 
+ * @param key Key of the tile
+ * @return Path to the tile's file
+ */
+string HFractalTileCache::tilePath (string key) {
+    char name[32];
+    snprintf (name, sizeof(name), "%016llx.hft", (unsigned long long)hashKey (key));
+    return cache_directory + name;
+}
+
+/**
+ * @brief Read a persisted tile from the cache directory. The file stores the full key, which is checked to rule out hash collisions
+ * 
+ * @param key Key of the tile
+ * @param values Output for the rendered values of the tile
+ * @param expected_size Number of values the tile must hold, so that truncated or corrupt files are rejected rather than overflowing the caller's buffer
+ * @return True if the tile was found and read successfully, false otherwise
+ */
+bool HFractalTileCache::readTile (string key, vector<uint16_t> &values, int expected_size) {
+    if (cache_directory.length() == 0) return false;
+    FILE *tile_file = fopen (tilePath (key).c_str(), "rb");
+    if (tile_file == NULL) return false;
+
+    // Header is a magic number, then the key length and key, then the number of values
+    bool success = false;
+    char magic[4];
+    uint32_t key_length = 0;
+    uint32_t size = 0;
+    if (fread (magic, 1, 4, tile_file) == 4 && memcmp (magic, "HFTC", 4) == 0
+        && fread (&key_length, sizeof(key_length), 1, tile_file) == 1 && key_length == key.length()) {
+        string file_key (key_length, '\0');
+        if (fread (&file_key[0], 1, key_length, tile_file) == key_length && file_key == key
+            && fread (&size, sizeof(size), 1, tile_file) == 1 && size == (uint32_t)expected_size) {
+            values.resize (size);
+            success = fread (values.data(), sizeof(uint16_t), size, tile_file) == size;
+        }
+    }
+    fclose (tile_file);
+    return success;
+}
+
+/**
+ * @brief Persist a tile to the cache directory, if one is set. The file is written under a temporary name and then moved into place, so concurrent readers never see a partial tile
+ * 
+ * @param key Key of the tile
+ * @param values Rendered values of the tile, row by row
+ * @param size Number of values in the tile
+ * @return True if the tile was written, false otherwise
+ */
+bool HFractalTileCache::writeTile (string key, const uint16_t *values, int size) {
+    if (cache_directory.length() == 0) return false;
+    string path = tilePath (key);
+    string temp_path = path + ".tmp" + to_string (hash<thread::id>{} (this_thread::get_id()));
+    FILE *tile_file = fopen (temp_path.c_str(), "wb");
+    if (tile_file == NULL) return false;
+
+    uint32_t key_length = key.length();
+    uint32_t value_count = size;
+    bool success = fwrite ("HFTC", 1, 4, tile_file) == 4
+        && fwrite (&key_length, sizeof(key_length), 1, tile_file) == 1
+        && fwrite (key.data(), 1, key_length, tile_file) == key_length
+        && fwrite (&value_count, sizeof(value_count), 1, tile_file) == 1
+        && fwrite (values, sizeof(uint16_t), size, tile_file) == (size_t)size;
+    success &= fclose (tile_file) == 0;
+
+    error_code ec;
+    if (success) filesystem::rename (temp_path, path, ec);
+    if (!success || ec) {
+        filesystem::remove (temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Remove every tile from the cache. Hit and miss counters are kept
+ * 
+ */
+void HFractalTileCache::clear () {
+    lock_guard<mutex> lock (mut);
+    tiles.clear();
+    index.clear();
+    memory_used = 0;
+}
@@ -0,0 +1,65 @@
+// src/tilecache.hh
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#define TILE_CACHE_DEFAULT_BUDGET (64*1024*1024) // Default memory budget of a tile cache, in bytes
+#define TILE_CACHE_PRECISION "ld" // Identifies the floating point precision tiles are rendered with, so cached tiles are never mixed across precisions
+#define TILE_CACHE_PHASE_STEPS 65536 // Number of steps per pixel the sub-pixel phase of a view is rounded to in tile keys, so that rounding error from panning does not split views sharing the same lattice
+
+// Struct describing a tile of rendered values held in the cache
+struct HFractalCachedTile {
+    std::string key; // Key identifying the render parameters of the tile
+    std::vector<uint16_t> data; // Rendered values of the tile, row by row
+};
+
+// Class holding recently rendered tiles in memory, so that revisiting a view does not require recomputing it
+class HFractalTileCache {
+private:
+    size_t memory_budget; // Maximum number of bytes the cached tiles may occupy
+    size_t memory_used = 0; // Number of bytes currently occupied by cached tiles
+    std::list<HFractalCachedTile> tiles; // Cached tiles, ordered from most to least recently used
+    std::unordered_map<std::string, std::list<HFractalCachedTile>::iterator> index; // Map of keys to cached tiles
+    long hits = 0; // Number of lookups which found a cached tile
+    long misses = 0; // Number of lookups which did not find a cached tile
+    long disk_hits = 0; // Number of hits which were read from the cache directory rather than memory
+    std::string cache_directory = ""; // Directory in which tiles are persisted across runs, empty if tiles are only held in memory
+    std::mutex mut; // Mutex object used to lock class resources during multi-threading events
+
+    static size_t tileMemory (const HFractalCachedTile &); // Estimate the number of bytes occupied by a cached tile
+    void evict (); // Remove least recently used tiles until the cache fits within its memory budget
+    void insert (std::string, const uint16_t *, int); // Insert a tile into memory, assuming the mutex is locked
+
+    static uint64_t hashKey (std::string); // Hash a tile key to produce its content address
+    std::string tilePath (std::string); // Get the path of the file a tile is persisted in
+    bool readTile (std::string, std::vector<uint16_t> &, int); // Read a persisted tile holding a given number of values from the cache directory
+    bool writeTile (std::string, const uint16_t *, int); // Persist a tile to the cache directory
+
+public:
+    HFractalTileCache (size_t); // Initialise an empty cache with a memory budget in bytes
+
+    static std::string makeKey (std::string, int, long double, long double, long double, int64_t, int64_t, int, int); // Construct the key identifying a tile from its render parameters and position on the pixel lattice
+
+    bool fetch (std::string, uint16_t *, int); // Copy a cached tile into a buffer of a given number of values, if it is present with that size
+    void store (std::string, const uint16_t *, int); // Insert a tile into the cache
+    void clear (); // Remove every tile from the cache
+
+    size_t getMemoryBudget () { std::lock_guard<std::mutex> lock (mut); return memory_budget; } // Inline methods to get/set the memory budget
+    void setMemoryBudget (size_t mb_) { std::lock_guard<std::mutex> lock (mut); memory_budget = mb_; evict (); }
+
+    std::string getCacheDirectory () { std::lock_guard<std::mutex> lock (mut); return cache_directory; } // Get the directory tiles are persisted in
+    bool setCacheDirectory (std::string); // Set the directory tiles are persisted in, creating it if necessary
+
+    size_t getMemoryUsed () { std::lock_guard<std::mutex> lock (mut); return memory_used; } // Get the number of bytes currently occupied by cached tiles
+    long getHits () { std::lock_guard<std::mutex> lock (mut); return hits; } // Get the number of lookups which found a cached tile
+    long getMisses () { std::lock_guard<std::mutex> lock (mut); return misses; } // Get the number of lookups which did not find a cached tile
+    long getDiskHits () { std::lock_guard<std::mutex> lock (mut); return disk_hits; } // Get the number of hits which were read from the cache directory
+};
+
+#endif
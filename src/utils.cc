@@ -144,4 +144,41 @@ char* trimExecutableFromPath(char* path) {
     result[slash_index+1] = '\0';
 
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Get the file extension of an image type
+ * 
+ * @param type The image type
+ * @return The extension, including the dot
+ */
+string imageTypeExtension (IMAGE_TYPE type) {
+    switch (type) {
+    case PPM:
+        return ".ppm";
+    case PNG:
+        return ".png";
+    case RAW:
+    case RAW_RLE:
+        return ".hfr";
+    default:
+        return ".pgm";
+    }
+}
+
+/**
+ * @brief Find the image type with a given name, as accepted on the command line: "pgm", "ppm", "png", "raw" or "raw-rle"
+ * 
+ * @param name The name of the type
+ * @param type Output for the image type
+ * @return True if the name is recognised, false otherwise
+ */
+bool imageTypeFromName (string name, IMAGE_TYPE &type) {
+    if (name == "pgm") type = PGM;
+    else if (name == "ppm") type = PPM;
+    else if (name == "png") type = PNG;
+    else if (name == "raw") type = RAW;
+    else if (name == "raw-rle") type = RAW_RLE;
+    else return false;
+    return true;
+}
@@ -33,9 +33,18 @@ enum CP_PRESETS {
 
 // Enum describing available image types which can be saved to disk
 enum IMAGE_TYPE {
-    PGM
+    PGM,
+    PPM, // Colour image using a palette
+    PNG, // Compressed colour image using a palette
+    RAW, // Tiled iteration buffer file, see HFractalImage::writeRaw
+    RAW_RLE // Tiled iteration buffer file with run length encoded tiles
 };
 
+// Get the file extension, including the dot, of an image type
+std::string imageTypeExtension (IMAGE_TYPE);
+// Find the image type with a given name, as used on the command line
+bool imageTypeFromName (std::string, IMAGE_TYPE &);
+
 // Delay for a given number of milliseconds
 void crossPlatformDelay (int);
 
@@ -0,0 +1,516 @@
+// src/wavefront.cc
+
+#include "wavefront.hh"
+
+#include <cmath>
+
+#include "utils.hh"
+
+using namespace std;
+
+/**
+ * @brief Raise a complex number to a complex power at the requested accuracy. Long double lanes use exactly the same functions as HFractalEquation
+ *
+ * @param a Base
+ * @param b Exponent
+ * @param accuracy Accuracy to compute with
+ * @return a to the power of b
+ */
+static inline complex<long double> lanePow (complex<long double> a, complex<long double> b, MATH_ACCURACY accuracy) {
+    return HFractalComplexMath::pow (a, b, accuracy);
+}
+static inline complex<double> lanePow (complex<double> a, complex<double> b, MATH_ACCURACY accuracy) {
+    double re, im;
+    switch (accuracy) {
+    case MA_DOUBLE: HFractalComplexMath::cpow<MA_DOUBLE> (a.real(), a.imag(), b.real(), b.imag(), re, im); return complex<double> (re, im);
+    case MA_FAST: HFractalComplexMath::cpow<MA_FAST> (a.real(), a.imag(), b.real(), b.imag(), re, im); return complex<double> (re, im);
+    default: return pow (a, b);
+    }
+}
+
+/**
+ * @brief Compute the complex exponential at the requested accuracy
+ *
+ * @param v Value to exponentiate
+ * @param accuracy Accuracy to compute with
+ * @return e to the power of v
+ */
+template <typename T> static inline complex<T> laneExp (complex<T> v, MATH_ACCURACY accuracy) {
+    if (accuracy == MA_PRECISE) {
+        T magnitude = exp (v.real());
+        return complex<T> (magnitude*cos (v.imag()), magnitude*sin (v.imag()));
+    }
+    return (complex<T>)HFractalComplexMath::exp (v, accuracy);
+}
+
+/**
+ * @brief Compute the principal complex logarithm at the requested accuracy
+ *
+ * @param v Value to take the logarithm of
+ * @param accuracy Accuracy to compute with
+ * @return Logarithm of v
+ */
+template <typename T> static inline complex<T> laneLog (complex<T> v, MATH_ACCURACY accuracy) {
+    if (accuracy == MA_PRECISE) {
+        return complex<T> ((T)0.5*log ((v.real()*v.real()) + (v.imag()*v.imag())), atan2 (v.imag(), v.real()));
+    }
+    return (complex<T>)HFractalComplexMath::log (v, accuracy);
+}
+
+/**
+ * @brief Raise every lane of z to the power of the matching lane of w in one pass. Double lanes at reduced accuracy use HFractalComplexMath::cpowLanes, whose loop the compiler vectorises. Other lanes are left to the caller to compute one at a time, so that long double lanes stay identical to HFractalEquation
+ *
+ * @param z_re Real parts of the bases
+ * @param z_im Imaginary parts of the bases
+ * @param w_re Real parts of the exponents
+ * @param w_im Imaginary parts of the exponents
+ * @param out_re Output for the real parts, which must not overlap the inputs
+ * @param out_im Output for the imaginary parts, which must not overlap the inputs
+ * @param n Number of lanes
+ * @param accuracy Accuracy to compute with
+ * @return True if the lanes were computed, false if the caller must compute them one at a time
+ */
+static inline bool powLanes (const double *z_re, const double *z_im, const double *w_re, const double *w_im, double *out_re, double *out_im, int n, MATH_ACCURACY accuracy) {
+    if (accuracy == MA_DOUBLE) HFractalComplexMath::cpowLanes<MA_DOUBLE> (z_re, z_im, w_re, w_im, out_re, out_im, n);
+    else if (accuracy == MA_FAST) HFractalComplexMath::cpowLanes<MA_FAST> (z_re, z_im, w_re, w_im, out_re, out_im, n);
+    else return false;
+    return true;
+}
+static inline bool powLanes (const long double *, const long double *, const long double *, const long double *, long double *, long double *, int, MATH_ACCURACY) {
+    return false;
+}
+
+/**
+ * @brief Compute the complex exponential or principal logarithm of every lane in one pass, in the same way as powLanes
+ *
+ * @param log Whether to compute the logarithm rather than the exponential
+ * @param re Real parts of the arguments
+ * @param im Imaginary parts of the arguments
+ * @param out_re Output for the real parts, which must not overlap the inputs
+ * @param out_im Output for the imaginary parts, which must not overlap the inputs
+ * @param n Number of lanes
+ * @param accuracy Accuracy to compute with
+ * @return True if the lanes were computed, false if the caller must compute them one at a time
+ */
+static inline bool expLogLanes (bool log, const double *re, const double *im, double *out_re, double *out_im, int n, MATH_ACCURACY accuracy) {
+    if (accuracy == MA_DOUBLE && log) HFractalComplexMath::clogLanes<MA_DOUBLE> (re, im, out_re, out_im, n);
+    else if (accuracy == MA_DOUBLE) HFractalComplexMath::cexpLanes<MA_DOUBLE> (re, im, out_re, out_im, n);
+    else if (accuracy == MA_FAST && log) HFractalComplexMath::clogLanes<MA_FAST> (re, im, out_re, out_im, n);
+    else if (accuracy == MA_FAST) HFractalComplexMath::cexpLanes<MA_FAST> (re, im, out_re, out_im, n);
+    else return false;
+    return true;
+}
+static inline bool expLogLanes (bool, const long double *, const long double *, long double *, long double *, int, MATH_ACCURACY) {
+    return false;
+}
+
+/**
+ * @brief Raise a value to an integer power by repeated squaring, in the same order as HFractalEquation so that results are identical
+ *
+ * @param x Base
+ * @param n Integer exponent
+ * @return x to the power of n
+ */
+template <typename V> static inline V lanePowInt (V x, int n) {
+    V result = 1;
+    unsigned int m = n < 0 ? -n : n;
+    while (m != 0) {
+        if (m & 1) result *= x;
+        x *= x;
+        m >>= 1;
+    }
+    return n < 0 ? (V)1/result : result;
+}
+
+/**
+ * @brief Add a pixel to be iterated
+ *
+ * @param p Index of the pixel, used to look up its results
+ * @param c Coordinate in the complex plane represented by the pixel
+ * @param z Value of z to start from
+ * @param d Number of iterations already performed to reach `z`
+ */
+template <typename T> void HFractalWavefront<T>::addPixel (int p, complex<long double> c, complex<long double> z, int d) {
+    if (active >= capacity) return;
+    z_re[active] = z.real();
+    z_im[active] = z.imag();
+    c_re[active] = c.real();
+    c_im[active] = c.imag();
+    depth[active] = d;
+    pixel[active] = p;
+    done[active] = false;
+    if (track_interior) {
+        ref_re[active] = z_re[active];
+        ref_im[active] = z_im[active];
+        ref_depth[active] = d;
+        window[active] = INTERIOR_CHECK_WINDOW;
+    }
+    result_z[p] = z;
+    result_depth[p] = d;
+    active++;
+}
+
+/**
+ * @brief Iterate every lane until it escapes or reaches the limit, in rounds of WAVEFRONT_ROUND iterations.
+ * Within a round, lanes which finish stop updating but stay in place, so every loop runs over a dense range of lanes. Finished lanes are removed between rounds
+ *
+ * @param limit Limit for the number of iterations
+ */
+template <typename T> void HFractalWavefront<T>::run (int limit) {
+    // Compute the values which are the same on every iteration, once per lane
+    if (!equation->getIsPreset()) executeLanes (equation->getPrologue());
+
+    T tolerance = (T)INTERIOR_PERIOD_TOLERANCE*(T)INTERIOR_PERIOD_TOLERANCE;
+    long interior_exits = 0;
+    while (active > 0) {
+        for (int iteration = 0; iteration < WAVEFRONT_ROUND; iteration++) {
+            const T *n_re;
+            const T *n_im;
+            step (n_re, n_im);
+            // Commit the new value to lanes which are still running, and check for escape
+            for (int i = 0; i < active; i++) {
+                bool running = !done[i];
+                T re = n_re[i];
+                T im = n_im[i];
+                z_re[i] = running ? re : z_re[i];
+                z_im[i] = running ? im : z_im[i];
+                depth[i] += running;
+                done[i] = !running || ((re*re) + (im*im) > (T)4) || depth[i] >= limit;
+            }
+            // Lanes which are still running and have returned close to their reference value may be in an attracting cycle, which is rare, so only those lanes are checked one at a time,
+            // with the same tests in the same order as HFractalEquation::evaluateInterior
+            if (track_interior) {
+                bool any_returned = false;
+                for (int i = 0; i < active; i++) {
+                    T d_re = z_re[i] - ref_re[i];
+                    T d_im = z_im[i] - ref_im[i];
+                    returned[i] = !done[i] && (d_re*d_re) + (d_im*d_im) < tolerance;
+                    any_returned |= returned[i];
+                }
+                if (any_returned) {
+                    for (int i = 0; i < active; i++) {
+                        if (!returned[i]) continue;
+                        // Interior detection only applies to the Mandelbrot preset, so the constant added on each iteration is c
+                        if (!HFractalEquation::isAttractingCycle (z_re[i], z_im[i], c_re[i], c_im[i], depth[i] - ref_depth[i])) continue;
+                        interior_exits++;
+                        depth[i] = limit;
+                        done[i] = true;
+                    }
+                }
+                // Replace the reference of lanes whose window has passed
+                for (int i = 0; i < active; i++) {
+                    bool replace = !done[i] && depth[i] - ref_depth[i] >= window[i];
+                    ref_re[i] = replace ? z_re[i] : ref_re[i];
+                    ref_im[i] = replace ? z_im[i] : ref_im[i];
+                    ref_depth[i] = replace ? depth[i] : ref_depth[i];
+                    window[i] = replace ? window[i]*2 : window[i];
+                }
+            }
+        }
+        compact ();
+    }
+    if (interior_exits > 0) equation->addInteriorExits (interior_exits);
+}
+
+/**
+ * @brief Perform a single iteration of every active lane, leaving z unchanged
+ *
+ * @param n_re Set to point to the real parts of the new values
+ * @param n_im Set to point to the imaginary parts of the new values
+ */
+template <typename T> void HFractalWavefront<T>::step (const T *&n_re, const T *&n_im) {
+    if (!equation->getIsPreset()) {
+        executeLanes (equation->getInstructions());
+        n_re = stack_re.data();
+        n_im = stack_im.data();
+        return;
+    }
+    switch (equation->getPreset()) {
+    case EQ_MANDELBROT: stepPreset<EQ_MANDELBROT> (); break;
+    case EQ_JULIA_1: stepPreset<EQ_JULIA_1> (); break;
+    case EQ_JULIA_2: stepPreset<EQ_JULIA_2> (); break;
+    case EQ_RECIPROCAL: stepPreset<EQ_RECIPROCAL> (); break;
+    case EQ_ZPOWER: stepPreset<EQ_ZPOWER> (); break;
+    case EQ_BARS: stepPreset<EQ_BARS> (); break;
+    case EQ_BURNINGSHIP_MODIFIED: stepPreset<EQ_BURNINGSHIP_MODIFIED> (); break;
+    default: break;
+    }
+    n_re = next_re.data();
+    n_im = next_im.data();
+}
+
+/**
+ * @brief Perform a single iteration of a preset equation on every active lane. Presets built from multiplication and addition are written out in real arithmetic so the loop can be vectorised
+ *
+ */
+template <typename T> template <int PRESET> void HFractalWavefront<T>::stepPreset () {
+    MATH_ACCURACY accuracy = equation->getAccuracy();
+    // Presets built on a complex power raise every lane at once where the lane type allows, then add their constant terms
+    if (PRESET == EQ_ZPOWER && powLanes (z_re.data(), z_im.data(), z_re.data(), z_im.data(), next_re.data(), next_im.data(), active, accuracy)) {
+        for (int i = 0; i < active; i++) {
+            next_re[i] = (next_re[i] + c_re[i]) - (T)0.5;
+            next_im[i] = (next_im[i] + c_im[i]) - (T)0;
+        }
+        return;
+    }
+    if (PRESET == EQ_BARS) {
+        for (int i = 0; i < active; i++) {
+            scratch_re[i] = (c_re[i]*c_re[i]) - (c_im[i]*c_im[i]);
+            scratch_im[i] = (c_re[i]*c_im[i]) + (c_im[i]*c_re[i]);
+        }
+        if (powLanes (z_re.data(), z_im.data(), scratch_re.data(), scratch_im.data(), next_re.data(), next_im.data(), active, accuracy)) return;
+    }
+    for (int i = 0; i < active; i++) {
+        T x = z_re[i];
+        T y = z_im[i];
+        complex<T> last (x, y);
+        complex<T> c (c_re[i], c_im[i]);
+        complex<T> result;
+        switch (PRESET) {
+        case EQ_MANDELBROT:
+            next_re[i] = ((x*x) - (y*y)) + c_re[i];
+            next_im[i] = ((x*y) + (y*x)) + c_im[i];
+            continue;
+        case EQ_JULIA_1:
+            next_re[i] = ((x*x) - (y*y)) + (T)0.285;
+            next_im[i] = ((x*y) + (y*x)) + (T)0.01;
+            continue;
+        case EQ_JULIA_2:
+            next_re[i] = ((x*x) - (y*y)) - (T)0.70176;
+            next_im[i] = ((x*y) + (y*x)) - (T)0.3842;
+            continue;
+        case EQ_RECIPROCAL:
+            result = complex<T>(1,0)/((last*last)+c);
+            break;
+        case EQ_ZPOWER:
+            result = lanePow (last, last, accuracy)+c-complex<T>(0.5, 0);
+            break;
+        case EQ_BARS:
+            result = lanePow (last, c*c, accuracy);
+            break;
+        case EQ_BURNINGSHIP_MODIFIED:
+            if (accuracy != MA_PRECISE) {
+                next_re[i] = ((x*x) - (y*y)) + c_re[i];
+                next_im[i] = (-2*abs(x)*abs(y)) + c_im[i];
+                continue;
+            }
+            result = pow ((complex<T>(abs(x),0) - complex<T>(0, abs(y))),2)+c;
+            break;
+        default:
+            break;
+        }
+        next_re[i] = result.real();
+        next_im[i] = result.imag();
+    }
+}
+
+/**
+ * @brief Run a sequence of compiled instructions on every active lane, one instruction at a time across all lanes. The result is left in the first row of the stack
+ *
+ * @param program Instructions to run
+ */
+template <typename T> void HFractalWavefront<T>::executeLanes (const vector<Instruction> &program) {
+    int n = active;
+    int top = -1;
+    for (const Instruction &ins : program) {
+        // Rows of the stack holding the top value and, for binary instructions, the value beneath it
+        if (HFractalEquation::operandCount (ins.op) == 2) top--;
+        if (HFractalEquation::operandCount (ins.op) == 0 && ins.op != INS_STORE) top++;
+        T *a_re = stack_re.data() + (top*capacity);
+        T *a_im = stack_im.data() + (top*capacity);
+        const T *b_re = a_re + capacity;
+        const T *b_im = a_im + capacity;
+
+        switch (ins.op) {
+        // Instructions pushing values onto the stack
+        case INS_CONST: {
+            T re = ins.const_val.real();
+            T im = ins.const_val.imag();
+            for (int i = 0; i < n; i++) { a_re[i] = re; a_im[i] = im; }
+            break;
+        }
+        case INS_Z: for (int i = 0; i < n; i++) { a_re[i] = z_re[i]; a_im[i] = z_im[i]; } break;
+        case INS_C: for (int i = 0; i < n; i++) { a_re[i] = c_re[i]; a_im[i] = c_im[i]; } break;
+        case INS_X: for (int i = 0; i < n; i++) { a_re[i] = z_re[i]; a_im[i] = 0; } break;
+        case INS_Y: for (int i = 0; i < n; i++) { a_re[i] = z_im[i]; a_im[i] = 0; } break;
+        case INS_A: for (int i = 0; i < n; i++) { a_re[i] = c_re[i]; a_im[i] = 0; } break;
+        case INS_B: for (int i = 0; i < n; i++) { a_re[i] = c_im[i]; a_im[i] = 0; } break;
+        // Instructions combining the top two values on the stack
+        case INS_ADD_RR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] + b_re[i]; a_im[i] = 0; } break;
+        case INS_ADD_RC: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] + b_re[i]; a_im[i] = b_im[i]; } break;
+        case INS_ADD_CR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] + b_re[i]; } break;
+        case INS_ADD_CC: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] + b_re[i]; a_im[i] = a_im[i] + b_im[i]; } break;
+        case INS_SUB_RR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] - b_re[i]; a_im[i] = 0; } break;
+        case INS_SUB_RC: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] - b_re[i]; a_im[i] = -b_im[i]; } break;
+        case INS_SUB_CR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] - b_re[i]; } break;
+        case INS_SUB_CC: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] - b_re[i]; a_im[i] = a_im[i] - b_im[i]; } break;
+        case INS_MUL_RR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] * b_re[i]; a_im[i] = 0; } break;
+        case INS_MUL_RC: for (int i = 0; i < n; i++) { T r = a_re[i]; a_re[i] = r * b_re[i]; a_im[i] = r * b_im[i]; } break;
+        case INS_MUL_CR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] * b_re[i]; a_im[i] = a_im[i] * b_re[i]; } break;
+        case INS_MUL_CC:
+            for (int i = 0; i < n; i++) {
+                T re = (a_re[i]*b_re[i]) - (a_im[i]*b_im[i]);
+                T im = (a_re[i]*b_im[i]) + (a_im[i]*b_re[i]);
+                a_re[i] = re;
+                a_im[i] = im;
+            }
+            break;
+        case INS_DIV_RR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] / b_re[i]; a_im[i] = 0; } break;
+        case INS_DIV_CR: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] / b_re[i]; a_im[i] = a_im[i] / b_re[i]; } break;
+        case INS_DIV_RC:
+        case INS_DIV_CC:
+            // Complex division has special handling of overflow, so use the standard library for identical results
+            for (int i = 0; i < n; i++) {
+                complex<T> result = complex<T> (a_re[i], a_im[i]) / complex<T> (b_re[i], b_im[i]);
+                a_re[i] = result.real();
+                a_im[i] = result.imag();
+            }
+            break;
+        case INS_POW_RR: for (int i = 0; i < n; i++) { a_re[i] = pow (a_re[i], b_re[i]); a_im[i] = 0; } break;
+        case INS_POW_CC:
+            if (powLanes (a_re, a_im, b_re, b_im, scratch_re.data(), scratch_im.data(), n, (MATH_ACCURACY)ins.int_val)) {
+                for (int i = 0; i < n; i++) { a_re[i] = scratch_re[i]; a_im[i] = scratch_im[i]; }
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                complex<T> result = lanePow (complex<T> (a_re[i], a_im[i]), complex<T> (b_re[i], b_im[i]), (MATH_ACCURACY)ins.int_val);
+                a_re[i] = result.real();
+                a_im[i] = result.imag();
+            }
+            break;
+        // Instructions with the exponent folded in, modifying only the top value on the stack
+        case INS_POW_RI: for (int i = 0; i < n; i++) { a_re[i] = lanePowInt (a_re[i], ins.int_val); a_im[i] = 0; } break;
+        case INS_POW_CI:
+            for (int i = 0; i < n; i++) {
+                complex<T> result = lanePowInt (complex<T> (a_re[i], a_im[i]), ins.int_val);
+                a_re[i] = result.real();
+                a_im[i] = result.imag();
+            }
+            break;
+        case INS_SQRT_R: for (int i = 0; i < n; i++) { a_re[i] = sqrt (a_re[i]); a_im[i] = 0; } break;
+        // Instructions applying a function to the top value on the stack
+        case INS_ABS_R: for (int i = 0; i < n; i++) { a_re[i] = fabs (a_re[i]); a_im[i] = 0; } break;
+        case INS_ABS_C: for (int i = 0; i < n; i++) { a_re[i] = sqrt ((a_re[i]*a_re[i]) + (a_im[i]*a_im[i])); a_im[i] = 0; } break;
+        case INS_CONJ: for (int i = 0; i < n; i++) { a_im[i] = -a_im[i]; } break;
+        case INS_SQR_R: for (int i = 0; i < n; i++) { a_re[i] = a_re[i] * a_re[i]; a_im[i] = 0; } break;
+        case INS_SQR_C:
+            for (int i = 0; i < n; i++) {
+                T re = (a_re[i]*a_re[i]) - (a_im[i]*a_im[i]);
+                T im = 2*a_re[i]*a_im[i];
+                a_re[i] = re;
+                a_im[i] = im;
+            }
+            break;
+        case INS_RE: for (int i = 0; i < n; i++) { a_im[i] = 0; } break;
+        case INS_IM: for (int i = 0; i < n; i++) { a_re[i] = a_im[i]; a_im[i] = 0; } break;
+        case INS_EXP_R: for (int i = 0; i < n; i++) { a_re[i] = exp (a_re[i]); a_im[i] = 0; } break;
+        case INS_LOG_R: for (int i = 0; i < n; i++) { a_re[i] = log (a_re[i]); a_im[i] = 0; } break;
+        case INS_SIN_R: for (int i = 0; i < n; i++) { a_re[i] = sin (a_re[i]); a_im[i] = 0; } break;
+        case INS_COS_R: for (int i = 0; i < n; i++) { a_re[i] = cos (a_re[i]); a_im[i] = 0; } break;
+        case INS_EXP_C:
+        case INS_LOG_C:
+        case INS_SIN_C:
+        case INS_COS_C:
+            if ((ins.op == INS_EXP_C || ins.op == INS_LOG_C) && expLogLanes (ins.op == INS_LOG_C, a_re, a_im, scratch_re.data(), scratch_im.data(), n, (MATH_ACCURACY)ins.int_val)) {
+                for (int i = 0; i < n; i++) { a_re[i] = scratch_re[i]; a_im[i] = scratch_im[i]; }
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                complex<T> v (a_re[i], a_im[i]);
+                complex<T> result;
+                if (ins.op == INS_EXP_C) result = laneExp (v, (MATH_ACCURACY)ins.int_val);
+                else if (ins.op == INS_LOG_C) result = laneLog (v, (MATH_ACCURACY)ins.int_val);
+                else if (ins.op == INS_SIN_C) result = complex<T> (sin (v.real())*cosh (v.imag()), cos (v.real())*sinh (v.imag()));
+                else result = complex<T> (cos (v.real())*cosh (v.imag()), -sin (v.real())*sinh (v.imag()));
+                a_re[i] = result.real();
+                a_im[i] = result.imag();
+            }
+            break;
+        // Instructions moving values between the stack and per pixel slots
+        case INS_STORE: {
+            T *s_re = slots_re.data() + (ins.int_val*capacity);
+            T *s_im = slots_im.data() + (ins.int_val*capacity);
+            for (int i = 0; i < n; i++) { s_re[i] = a_re[i]; s_im[i] = a_im[i]; }
+            top--;
+            break;
+        }
+        case INS_LOAD: {
+            const T *s_re = slots_re.data() + (ins.int_val*capacity);
+            const T *s_im = slots_im.data() + (ins.int_val*capacity);
+            for (int i = 0; i < n; i++) { a_re[i] = s_re[i]; a_im[i] = s_im[i]; }
+            break;
+        }
+        default: break;
+        }
+    }
+}
+
+/**
+ * @brief Retire every finished lane by writing its final state into the results, and move the remaining lanes to the front of the buffers, keeping their order
+ *
+ */
+template <typename T> void HFractalWavefront<T>::compact () {
+    int num_slots = equation->getIsPreset() ? 0 : equation->getNumSlots();
+    int kept = 0;
+    for (int i = 0; i < active; i++) {
+        if (done[i]) {
+            result_z[pixel[i]] = complex<long double> (z_re[i], z_im[i]);
+            result_depth[pixel[i]] = depth[i];
+            continue;
+        }
+        z_re[kept] = z_re[i];
+        z_im[kept] = z_im[i];
+        c_re[kept] = c_re[i];
+        c_im[kept] = c_im[i];
+        depth[kept] = depth[i];
+        pixel[kept] = pixel[i];
+        done[kept] = false;
+        if (track_interior) {
+            ref_re[kept] = ref_re[i];
+            ref_im[kept] = ref_im[i];
+            ref_depth[kept] = ref_depth[i];
+            window[kept] = window[i];
+        }
+        for (int s = 0; s < num_slots; s++) {
+            slots_re[(s*capacity)+kept] = slots_re[(s*capacity)+i];
+            slots_im[(s*capacity)+kept] = slots_im[(s*capacity)+i];
+        }
+        kept++;
+    }
+    active = kept;
+}
+
+/**
+ * @brief Initialise the lane buffers for an equation
+ *
+ * @param eq Equation to iterate
+ * @param size Maximum number of pixels which can be added, and the range of pixel indices
+ */
+template <typename T> HFractalWavefront<T>::HFractalWavefront (HFractalEquation *eq, int size) {
+    equation = eq;
+    capacity = size;
+    z_re.resize (size); z_im.resize (size);
+    c_re.resize (size); c_im.resize (size);
+    depth.resize (size);
+    pixel.resize (size);
+    done.resize (size);
+    next_re.resize (size); next_im.resize (size);
+    scratch_re.resize (size); scratch_im.resize (size);
+    track_interior = equation->hasInteriorDetection();
+    if (track_interior) {
+        ref_re.resize (size); ref_im.resize (size);
+        ref_depth.resize (size);
+        window.resize (size);
+        returned.resize (size);
+    }
+    if (!equation->getIsPreset()) {
+        stack_re.resize ((size_t)equation->getMaxStack()*size); stack_im.resize ((size_t)equation->getMaxStack()*size);
+        slots_re.resize ((size_t)equation->getNumSlots()*size); slots_im.resize ((size_t)equation->getNumSlots()*size);
+    }
+    result_z.resize (size);
+    result_depth.resize (size);
+}
+
+// Lane types used by the renderer
+template class HFractalWavefront<double>;
+template class HFractalWavefront<long double>;
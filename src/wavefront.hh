@@ -0,0 +1,69 @@
+// src/wavefront.hh
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <complex>
+#include <vector>
+
+#include "fractal.hh"
+
+// Number of iterations every active pixel advances by between compactions
+#define WAVEFRONT_ROUND 16
+// Smallest pixel spacing at which double lanes are precise enough to be used instead of long double lanes. Double lanes can be vectorised, long double lanes cannot
+#define WAVEFRONT_DOUBLE_SPACING 1e-12
+
+/**
+ * Class iterating a set of pixels together, held in structure-of-arrays buffers with one lane per pixel.
+ * Every active lane advances WAVEFRONT_ROUND iterations at a time, with each operation applied across all lanes before the next, so that the loops can be vectorised.
+ * After each round, finished lanes are retired and the survivors compacted into a dense list, so lanes are never wasted on pixels which have already escaped.
+ * With long double lanes the results are identical to HFractalEquation::evaluate, including interior detection
+ */
+template <typename T> class HFractalWavefront {
+private:
+    HFractalEquation *equation; // Equation being iterated
+    int capacity; // Maximum number of lanes
+    int active = 0; // Number of lanes currently in use
+
+    std::vector<T> z_re; // Real part of z for each lane
+    std::vector<T> z_im; // Imaginary part of z for each lane
+    std::vector<T> c_re; // Real part of c for each lane
+    std::vector<T> c_im; // Imaginary part of c for each lane
+    std::vector<int> depth; // Number of iterations performed by each lane
+    std::vector<int> pixel; // Index of the pixel each lane is computing
+    std::vector<char> done; // Whether each lane has escaped or reached the limit
+    bool track_interior; // Whether each lane is checked for an attracting cycle for interior detection
+    std::vector<T> ref_re; // Real part of the earlier value each lane is compared against, when tracking interior detection
+    std::vector<T> ref_im; // Imaginary part of the earlier value each lane is compared against
+    std::vector<int> ref_depth; // Number of iterations at which each lane's reference value was taken
+    std::vector<int> window; // Number of iterations after which each lane's reference value is replaced
+    std::vector<char> returned; // Whether each lane returned close to its reference value in the latest iteration
+
+    std::vector<T> next_re; // Real part of the value computed by the latest iteration of each lane, for presets
+    std::vector<T> next_im; // Imaginary part of the value computed by the latest iteration of each lane, for presets
+    std::vector<T> scratch_re; // Exponents and results of complex pow, exp and log applied across every lane, kept apart from their arguments
+    std::vector<T> scratch_im;
+    std::vector<T> stack_re; // Value stack for custom equations, with one row of lanes per stack position
+    std::vector<T> stack_im;
+    std::vector<T> slots_re; // Values computed by the prologue of custom equations, with one row of lanes per slot
+    std::vector<T> slots_im;
+
+    std::vector<std::complex<long double>> result_z; // Final value of z for each pixel
+    std::vector<int> result_depth; // Final iteration count for each pixel
+
+    void step (const T *&, const T *&); // Perform a single iteration of every active lane, without updating z
+    template <int PRESET> void stepPreset (); // Perform a single iteration of a preset equation on every active lane
+    void executeLanes (const std::vector<Instruction> &); // Run a sequence of compiled instructions on every active lane
+    void compact (); // Retire finished lanes into the results, and move the remaining lanes to the front
+
+public:
+    void addPixel (int, std::complex<long double>, std::complex<long double>, int); // Add a pixel to be iterated, continuing from a given z value and depth
+    void run (int); // Iterate every lane until it escapes or reaches the limit
+
+    std::complex<long double> getZ (int p) { return result_z[p]; } // Inline methods to get the final state of a pixel after running
+    int getDepth (int p) { return result_depth[p]; }
+
+    HFractalWavefront (HFractalEquation *, int); // Initialise for an equation, with space for a number of pixels
+};
+
+#endif